@@ -0,0 +1,296 @@
+#include"stdafx.h"
+#include"Allocator.h"
+#include<algorithm>
+#include<cassert>
+#include<cstdint>
+#include<new>
+#include<stdexcept>
+
+// Returns the HeapAllocator shared by everything not given an Allocator of its own
+//
+HeapAllocator& HeapAllocator::getInstance()
+{
+	static HeapAllocator instance;
+	return instance;
+}
+
+// Returns 'size' bytes from the global operator new. Alignments greater than that
+// of std::max_align_t are not supported.
+//
+void* HeapAllocator::allocate(std::size_t size, std::size_t alignment)
+{
+	assert(alignment <= alignof(std::max_align_t));
+	(void)alignment;
+	return ::operator new(size);
+}
+
+//
+//
+void HeapAllocator::deallocate(void* memory, std::size_t, std::size_t)
+{
+	::operator delete(memory);
+}
+
+// Build an empty PoolAllocator taking memory from the heap for each size in slabs
+// of up to 'slabSizeIn' bytes; the first slabs of each size are smaller, so that a
+// size used only a little does not hold a whole slab. Requests larger than a slab
+// are given memory of their own.
+// The slab size must be positive or an invalid_argument is thrown.
+//
+PoolAllocator::PoolAllocator(std::size_t slabSizeIn) :
+	slabSize(slabSizeIn),
+	sizeClassCount(0),
+	bytesReserved(0)
+{
+	if (0 == slabSize)
+	{
+		throw std::invalid_argument("PoolAllocator::PoolAllocator:\tslabSizeIn must be positive.");
+	}
+}
+
+// Releases every slab. Any memory still allocated from this PoolAllocator is freed
+// with them, so objects placed in it must be destroyed first.
+//
+PoolAllocator::~PoolAllocator()
+{
+	const std::size_t count = sizeClassCount.load();
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		for (auto& slab : sizeClasses[t].slabs)
+		{
+			::operator delete(slab.second.memory);
+		}
+	}
+	for (auto& block : largeBlocks)
+	{
+		::operator delete(block.second);
+	}
+}
+
+// Internal utility; returns the size class for blocks of the given size and alignment,
+// adding one if 'add' is true and there is none, or null if there is none.
+//
+PoolAllocator::SizeClass* PoolAllocator::findSizeClass(std::size_t size, std::size_t alignment, bool add)
+{
+	// only a handful of distinct sizes are ever pooled, so a linear search is quickest
+	std::size_t count = sizeClassCount.load(std::memory_order_acquire);
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		if (sizeClasses[t].size == size && sizeClasses[t].alignment == alignment)
+		{
+			return &sizeClasses[t];
+		}
+	}
+	if (!add)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(addingSizeClass);
+	const std::size_t seen = count;
+	count = sizeClassCount.load(std::memory_order_acquire);
+	for (std::size_t t = seen; t < count; ++t)
+	{
+		if (sizeClasses[t].size == size && sizeClasses[t].alignment == alignment)
+		{
+			return &sizeClasses[t];
+		}
+	}
+	if (MAX_SIZE_CLASSES == count)
+	{
+		return nullptr;
+	}
+	SizeClass& sizeClass = sizeClasses[count];
+	sizeClass.size = size;
+	sizeClass.alignment = alignment;
+	sizeClass.emptySlabs = 0;
+	sizeClass.nextSlabBytes = std::min(slabSize,
+		std::max(slabSize / FIRST_SLAB_FRACTION, MIN_BLOCKS_PER_SLAB * size + alignment));
+	sizeClassCount.store(count + 1, std::memory_order_release);
+	return &sizeClass;
+}
+
+// Internal utility; returns a block of memory of its own from the heap
+//
+void* PoolAllocator::allocateLarge(std::size_t blockSize, std::size_t alignment)
+{
+	const std::uintptr_t mask = alignment - 1;
+	char* memory = static_cast<char*>(::operator new(blockSize + alignment));
+	void* block = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(memory) + mask) & ~mask);
+	try
+	{
+		std::lock_guard<std::mutex> lock(largeBlocksMutex);
+		largeBlocks.insert(std::make_pair(block, static_cast<void*>(memory)));
+	}
+	catch (...)
+	{
+		::operator delete(memory);
+		throw;
+	}
+	bytesReserved += blockSize + alignment;
+	return block;
+}
+
+// Internal utility; returns a block from allocateLarge to the heap
+//
+void PoolAllocator::deallocateLarge(void* memory, std::size_t blockSize, std::size_t alignment)
+{
+	void* allocated;
+	{
+		std::lock_guard<std::mutex> lock(largeBlocksMutex);
+		const auto found = largeBlocks.find(memory);
+		assert(largeBlocks.end() != found);
+		allocated = found->second;
+		largeBlocks.erase(found);
+	}
+	::operator delete(allocated);
+	bytesReserved -= blockSize + alignment;
+}
+
+// Internal utility; takes a new slab for the size class from the heap and makes it
+// available. The size class must be locked.
+//
+PoolAllocator::Slab& PoolAllocator::addSlab(SizeClass& sizeClass)
+{
+	const std::size_t bytes = sizeClass.nextSlabBytes;
+	sizeClass.available.reserve(sizeClass.available.size() + 1);
+	char* memory = static_cast<char*>(::operator new(bytes));
+	Slab* slab;
+	try
+	{
+		slab = &sizeClass.slabs[memory];
+	}
+	catch (...)
+	{
+		::operator delete(memory);
+		throw;
+	}
+	const std::uintptr_t mask = sizeClass.alignment - 1;
+	slab->memory = memory;
+	slab->bytes = bytes;
+	slab->nextFree = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(memory) + mask) & ~mask);
+	slab->end = memory + bytes;
+	slab->freeHead = nullptr;
+	slab->liveBlocks = 0;
+	slab->availableIndex = NOT_AVAILABLE;
+	makeAvailable(sizeClass, *slab);
+	++sizeClass.emptySlabs;
+	bytesReserved += bytes;
+	sizeClass.nextSlabBytes = std::min(slabSize, 2 * bytes);
+	return *slab;
+}
+
+// Internal utility; returns a slab, which must have no blocks in use, to the heap.
+// The size class must be locked.
+//
+void PoolAllocator::releaseSlab(SizeClass& sizeClass, Slab& slab)
+{
+	assert(0 == slab.liveBlocks);
+	makeUnavailable(sizeClass, slab);
+	--sizeClass.emptySlabs;
+	bytesReserved -= slab.bytes;
+	char* memory = slab.memory;
+	sizeClass.slabs.erase(memory);
+	::operator delete(memory);
+}
+
+// Internal utility; adds the slab to the size class's available slabs
+//
+void PoolAllocator::makeAvailable(SizeClass& sizeClass, Slab& slab)
+{
+	if (NOT_AVAILABLE == slab.availableIndex)
+	{
+		slab.availableIndex = sizeClass.available.size();
+		sizeClass.available.push_back(&slab);
+	}
+}
+
+// Internal utility; removes the slab from the size class's available slabs
+//
+void PoolAllocator::makeUnavailable(SizeClass& sizeClass, Slab& slab)
+{
+	if (NOT_AVAILABLE != slab.availableIndex)
+	{
+		Slab* last = sizeClass.available.back();
+		sizeClass.available[slab.availableIndex] = last;
+		last->availableIndex = slab.availableIndex;
+		sizeClass.available.pop_back();
+		slab.availableIndex = NOT_AVAILABLE;
+	}
+}
+
+// Returns 'size' bytes aligned to 'alignment', taken from a freed block of that size
+// and alignment if possible, and otherwise carved from a slab for that size.
+//
+void* PoolAllocator::allocate(std::size_t size, std::size_t alignment)
+{
+	assert(0 != alignment && 0 == (alignment & (alignment - 1)));
+	const std::size_t blockSize = getBlockSize(size, alignment);
+	SizeClass* sizeClass = isLarge(blockSize, alignment) ? nullptr : findSizeClass(blockSize, alignment, true);
+	if (nullptr == sizeClass)
+	{
+		return allocateLarge(blockSize, alignment);
+	}
+
+	std::lock_guard<std::mutex> lock(sizeClass->mutex);
+	Slab& slab = sizeClass->available.empty() ? addSlab(*sizeClass) : *sizeClass->available.back();
+	void* block;
+	if (nullptr != slab.freeHead)
+	{
+		block = slab.freeHead;
+		slab.freeHead = *static_cast<void**>(block);
+	}
+	else
+	{
+		block = slab.nextFree;
+		slab.nextFree += blockSize;
+	}
+	if (0 == slab.liveBlocks++)
+	{
+		--sizeClass->emptySlabs;
+	}
+	if (nullptr == slab.freeHead && static_cast<std::size_t>(slab.end - slab.nextFree) < blockSize)
+	{
+		makeUnavailable(*sizeClass, slab);
+	}
+	return block;
+}
+
+// Puts the block on its slab's free list, returning the slab to the heap if none of
+// its blocks are then in use and another such slab of the same size is already kept.
+// Blocks with memory of their own are returned to the heap.
+//
+void PoolAllocator::deallocate(void* memory, std::size_t size, std::size_t alignment)
+{
+	if (nullptr == memory)
+	{
+		return;
+	}
+	const std::size_t blockSize = getBlockSize(size, alignment);
+	SizeClass* sizeClass = isLarge(blockSize, alignment) ? nullptr : findSizeClass(blockSize, alignment, false);
+	if (nullptr == sizeClass)
+	{
+		deallocateLarge(memory, blockSize, alignment);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(sizeClass->mutex);
+	auto found = sizeClass->slabs.upper_bound(static_cast<char*>(memory));
+	assert(sizeClass->slabs.begin() != found);
+	Slab& slab = (--found)->second;
+	assert(static_cast<char*>(memory) < slab.end);
+	*static_cast<void**>(memory) = slab.freeHead;
+	slab.freeHead = memory;
+	makeAvailable(*sizeClass, slab);
+	if (0 == --slab.liveBlocks && ++sizeClass->emptySlabs > MAX_EMPTY_SLABS)
+	{
+		releaseSlab(*sizeClass, slab);
+	}
+}
+
+// Returns the number of bytes presently taken from the heap for slabs and blocks
+//
+std::size_t PoolAllocator::getMemoryReserved()const
+{
+	return bytesReserved.load();
+}
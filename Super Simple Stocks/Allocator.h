@@ -0,0 +1,232 @@
+/*
+* Allocator.h
+*
+*	An Allocator supplies the memory StockGroup uses for its Stocks and that each
+*	TradeStore uses for its chunks of trades, so that where those come from can be
+*	chosen by the owner of the group rather than always being the global heap.
+*
+*	HeapAllocator simply forwards to the global operator new and delete, and is used
+*	by Stocks and TradeRecords built on their own.
+*
+*	PoolAllocator carves blocks out of slabs taken from the heap, each slab holding
+*	blocks of a single size and alignment. Blocks handed out one after another sit next
+*	to each other in memory, and freed blocks are kept on their slab's free list and
+*	handed out again before any new memory is carved. A slab whose blocks have all been
+*	freed is returned to the heap, except for one kept per size so that a store growing
+*	and shrinking around a slab boundary does not go back to the heap each time; blocks
+*	too large to share a slab are returned to the heap as soon as they are freed. So the
+*	memory a pool holds follows what is allocated from it, rather than its peak.
+*	Each size has a lock of its own, so that threads allocating different sizes, such
+*	as stocks and the chunks of trades of different stores, do not wait on one another.
+*	Allocation and deallocation are safe to call from many threads at once.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_ALLOCATOR
+#define SUPERSIMPLESTOCKS_ALLOCATOR
+#include<array>
+#include<atomic>
+#include<cstddef>
+#include<map>
+#include<mutex>
+#include<vector>
+
+class Allocator
+{
+public:
+
+	virtual ~Allocator()
+	{
+		// done //
+	}
+
+	// Returns 'size' bytes of memory aligned to 'alignment', which must be a power of two.
+	// Throws a bad_alloc if the memory cannot be found.
+	//
+	virtual void* allocate(std::size_t size, std::size_t alignment) = 0;
+
+	// Returns memory obtained from allocate, with the same size and alignment, for reuse
+	//
+	virtual void deallocate(void* memory, std::size_t size, std::size_t alignment) = 0;
+};
+
+class HeapAllocator : public Allocator
+{
+public:
+
+	// Returns the HeapAllocator shared by everything not given an Allocator of its own
+	//
+	static HeapAllocator& getInstance();
+
+	// Returns 'size' bytes from the global operator new. Alignments greater than that
+	// of std::max_align_t are not supported.
+	//
+	void* allocate(std::size_t size, std::size_t alignment) override;
+
+	void deallocate(void* memory, std::size_t size, std::size_t alignment) override;
+};
+
+class PoolAllocator : public Allocator
+{
+	// One slab of blocks of a single size and alignment. Blocks below nextFree have been
+	// handed out at least once; those since freed are linked through their first bytes
+	// from freeHead.
+	//
+	struct Slab
+	{
+		char* memory;
+		std::size_t bytes;
+		char* nextFree;
+		char* end;
+		void* freeHead;
+		std::size_t liveBlocks;
+
+		// Position in the size class's list of slabs with room, or NOT_AVAILABLE
+		//
+		std::size_t availableIndex;
+	};
+
+	static const std::size_t NOT_AVAILABLE = static_cast<std::size_t>(-1);
+
+	// The slabs holding blocks of one size and alignment
+	//
+	struct SizeClass
+	{
+		std::size_t size;
+		std::size_t alignment;
+
+		// Guards everything below
+		//
+		std::mutex mutex;
+
+		// Every slab, by the address of its memory, so a freed block's slab can be found
+		//
+		std::map<char*, Slab> slabs;
+
+		// Slabs with a free block or uncarved room, blocks being handed out from the last
+		//
+		std::vector<Slab*> available;
+
+		// Number of slabs with no blocks in use
+		//
+		std::size_t emptySlabs;
+
+		// Bytes to take from the heap for the next slab, doubling up to the pool's slab size
+		//
+		std::size_t nextSlabBytes;
+	};
+
+	// Most distinct sizes pooled; blocks of further sizes are taken from the heap alone
+	//
+	static const std::size_t MAX_SIZE_CLASSES = 32;
+
+	// Slabs of every size class are at least this many times their block size, and
+	// start at this fraction of the pool's slab size
+	//
+	static const std::size_t MIN_BLOCKS_PER_SLAB = 4;
+	static const std::size_t FIRST_SLAB_FRACTION = 16;
+
+	// Most slabs of one size kept with no blocks in use
+	//
+	static const std::size_t MAX_EMPTY_SLABS = 1;
+
+	std::size_t slabSize;
+
+	// Size classes [0, sizeClassCount) are in use, and are found without a lock;
+	// addingSizeClass is held while one is added
+	//
+	std::array<SizeClass, MAX_SIZE_CLASSES> sizeClasses;
+	std::atomic<std::size_t> sizeClassCount;
+	std::mutex addingSizeClass;
+
+	// Blocks given memory of their own from the heap, by the address handed out, with the
+	// address of the memory to free. Guarded by largeBlocksMutex.
+	//
+	std::mutex largeBlocksMutex;
+	std::map<void*, void*> largeBlocks;
+
+	std::atomic<std::size_t> bytesReserved;
+
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+	// Internal utility; returns the size class for blocks of the given size and alignment,
+	// adding one if 'add' is true and there is none, or null if there is none.
+	//
+	SizeClass* findSizeClass(std::size_t size, std::size_t alignment, bool add);
+
+	// Internal utility; returns whether blocks of the given size and alignment are too
+	// large to share a slab
+	//
+	bool isLarge(std::size_t blockSize, std::size_t alignment)const
+	{
+		return blockSize + alignment > slabSize;
+	}
+
+	// Internal utility; returns a block of memory of its own from the heap
+	//
+	void* allocateLarge(std::size_t blockSize, std::size_t alignment);
+
+	// Internal utility; returns a block from allocateLarge to the heap
+	//
+	void deallocateLarge(void* memory, std::size_t blockSize, std::size_t alignment);
+
+	// Internal utility; takes a new slab for the size class from the heap and makes it
+	// available. The size class must be locked.
+	//
+	Slab& addSlab(SizeClass& sizeClass);
+
+	// Internal utility; returns a slab, which must have no blocks in use, to the heap.
+	// The size class must be locked.
+	//
+	void releaseSlab(SizeClass& sizeClass, Slab& slab);
+
+	// Internal utility; adds or removes the slab from the size class's available slabs
+	//
+	static void makeAvailable(SizeClass& sizeClass, Slab& slab);
+	static void makeUnavailable(SizeClass& sizeClass, Slab& slab);
+
+	// Internal utility; rounds a requested size up so that a freed block can hold the
+	// free list link, and so that blocks carved one after another stay aligned
+	//
+	static std::size_t getBlockSize(std::size_t size, std::size_t alignment)
+	{
+		const std::size_t linked = (size < sizeof(void*)) ? sizeof(void*) : size;
+		return (linked + alignment - 1) & ~(alignment - 1);
+	}
+
+public:
+
+	// Default number of bytes taken from the heap for each slab
+	//
+	static const std::size_t DEFAULT_SLAB_SIZE = 1 << 20;
+
+	// Build an empty PoolAllocator taking memory from the heap for each size in slabs
+	// of up to 'slabSizeIn' bytes; the first slabs of each size are smaller, so that a
+	// size used only a little does not hold a whole slab. Requests larger than a slab
+	// are given memory of their own.
+	// The slab size must be positive or an invalid_argument is thrown.
+	//
+	explicit PoolAllocator(std::size_t slabSizeIn = DEFAULT_SLAB_SIZE);
+
+	// Releases every slab. Any memory still allocated from this PoolAllocator is freed
+	// with them, so objects placed in it must be destroyed first.
+	//
+	~PoolAllocator();
+
+	// Returns 'size' bytes aligned to 'alignment', taken from a freed block of that size
+	// and alignment if possible, and otherwise carved from a slab for that size.
+	//
+	void* allocate(std::size_t size, std::size_t alignment) override;
+
+	// Puts the block on its slab's free list, returning the slab to the heap if none of
+	// its blocks are then in use and another such slab of the same size is already kept.
+	// Blocks with memory of their own are returned to the heap.
+	//
+	void deallocate(void* memory, std::size_t size, std::size_t alignment) override;
+
+	// Returns the number of bytes presently taken from the heap for slabs and blocks
+	//
+	std::size_t getMemoryReserved()const;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include"stdafx.h"
+#include"BarSeries.h"
+#include"Exceptions.h"
+#include<algorithm>
+#include<stdexcept>
+
+////////////////////////////////////////////////////////////////////////////////
+// Bar
+////////////////////////////////////////////////////////////////////////////////
+
+// Folds the trade into this bar
+//
+void Bar::add(const Trade& trade)
+{
+	const double price = trade.getPrice();
+	if (0 == tradeCount)
+	{
+		firstTradeTime = lastTradeTime = trade.getTimeStamp();
+		open = high = low = close = price;
+	}
+	else
+	{
+		if (trade.getTimeStamp() < firstTradeTime)
+		{
+			firstTradeTime = trade.getTimeStamp();
+			open = price;
+		}
+		if (trade.getTimeStamp() >= lastTradeTime)
+		{
+			lastTradeTime = trade.getTimeStamp();
+			close = price;
+		}
+		high = std::max(high, price);
+		low = std::min(low, price);
+	}
+	volume += trade.getQuantity();
+	if (tickSize > 0.0)
+	{
+		sumOfTicksAndQuantity += TickSum(toTicks(price, tickSize) * trade.getQuantity());
+	}
+	else
+	{
+		sumOfPriceAndQuantity += price * trade.getQuantity();
+	}
+	++tradeCount;
+}
+
+// Folds another bar into this bar
+//
+void Bar::merge(const Bar& other)
+{
+	if (0 == other.tradeCount)
+	{
+		return;
+	}
+	if (0 == tradeCount)
+	{
+		const TimeStamp keptStart = start;
+		*this = other;
+		start = keptStart;
+		return;
+	}
+	if (other.firstTradeTime < firstTradeTime)
+	{
+		firstTradeTime = other.firstTradeTime;
+		open = other.open;
+	}
+	if (other.lastTradeTime >= lastTradeTime)
+	{
+		lastTradeTime = other.lastTradeTime;
+		close = other.close;
+	}
+	high = std::max(high, other.high);
+	low = std::min(low, other.low);
+	volume += other.volume;
+	sumOfPriceAndQuantity += other.sumOfPriceAndQuantity;
+	sumOfTicksAndQuantity += other.sumOfTicksAndQuantity;
+	tradeCount += other.tradeCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BarSeries
+////////////////////////////////////////////////////////////////////////////////
+
+// Build an empty BarSeries of bars 'resolutionIn' long, keeping at most maxBarsIn bars
+// (zero for no limit), for trades with the given tick size (zero for none; see
+// TradeStore::setTickSize). The resolution must be positive or an invalid_argument is thrown.
+//
+BarSeries::BarSeries(std::chrono::seconds resolutionIn, std::size_t maxBarsIn, double tickSizeIn) :
+	resolution(std::chrono::duration_cast<std::chrono::system_clock::duration>(resolutionIn)),
+	tickSize(tickSizeIn),
+	maxBars(maxBarsIn)
+{
+	if (resolutionIn <= std::chrono::seconds::zero())
+	{
+		throw std::invalid_argument("BarSeries::BarSeries:\tresolution must be positive.");
+	}
+}
+
+// Sets the tick size of the trades to come. Throws an InvalidOperation if any bars are held.
+//
+void BarSeries::setTickSize(double tickSizeIn)
+{
+	if (!bars.empty())
+	{
+		throw InvalidOperation("BarSeries::setTickSize:\tbars are already held.");
+	}
+	tickSize = tickSizeIn;
+}
+
+// Returns the start of the bar containing timeStamp
+//
+TimeStamp BarSeries::getBarStart(TimeStamp timeStamp)const
+{
+	auto sinceEpoch = timeStamp.time_since_epoch();
+	auto intoBar = sinceEpoch % resolution;
+	if (intoBar < intoBar.zero())
+	{
+		intoBar += resolution;
+	}
+	return TimeStamp(sinceEpoch - intoBar);
+}
+
+// Adds the trade to the bar for its time, creating that bar if needed.
+// Trades arriving out of order update the bar they belong to.
+//
+void BarSeries::addTrade(const Trade& trade)
+{
+	const TimeStamp barStart = getBarStart(trade.getTimeStamp());
+
+	auto barItr = bars.end();
+	if (bars.empty() || bars.back().start < barStart)
+	{
+		// the common case: a trade in a new, latest bar
+	}
+	else if (bars.back().start == barStart)
+	{
+		--barItr;
+	}
+	else
+	{
+		if (maxBars > 0 && bars.size() >= maxBars && barStart < bars.front().start)
+		{
+			// older than any bar still kept
+			return;
+		}
+		barItr = std::lower_bound(bars.begin(), bars.end(), barStart, [](const Bar& bar, TimeStamp value)
+		{
+			return bar.start < value;
+		});
+	}
+
+	if (barItr == bars.end() || barItr->start != barStart)
+	{
+		Bar bar = Bar();
+		bar.start = barStart;
+		bar.tickSize = tickSize;
+		barItr = bars.insert(barItr, bar);
+	}
+	barItr->add(trade);
+
+	if (maxBars > 0 && bars.size() > maxBars)
+	{
+		bars.pop_front();
+	}
+}
+
+// Merges every bar overlapping [startTimeStamp, endTimeStamp) into 'summary', whose
+// start is set to startTimeStamp. Bars only partly inside the period are included
+// whole, so the result is exact only when the period is aligned to the resolution.
+// Returns false, leaving 'summary' unchanged, if no bars overlap the period.
+//
+bool BarSeries::summarize(TimeStamp startTimeStamp, TimeStamp endTimeStamp, Bar& summary)const
+{
+	const TimeStamp firstBarStart = getBarStart(startTimeStamp);
+	auto barItr = std::lower_bound(bars.begin(), bars.end(), firstBarStart, [](const Bar& bar, TimeStamp value)
+	{
+		return bar.start < value;
+	});
+
+	Bar result = Bar();
+	result.start = startTimeStamp;
+	result.tickSize = tickSize;
+	for (; barItr != bars.end() && barItr->start < endTimeStamp; ++barItr)
+	{
+		result.merge(*barItr);
+	}
+	if (0 == result.tradeCount)
+	{
+		return false;
+	}
+	summary = result;
+	return true;
+}
@@ -0,0 +1,129 @@
+/*
+* BarSeries.h
+*
+*	A BarSeries rolls trades up into consecutive fixed length bars, each recording
+*	open, high, low, close, volume and the sums needed for a Volume Weighted price.
+*	Bars are updated as each trade arrives, so questions over long periods can be
+*	answered from a few hundred bars rather than every trade, and bars remain after
+*	the trades they summarize have been released.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_BAR_SERIES
+#define SUPERSIMPLESTOCKS_BAR_SERIES
+#include"Trade.h"
+#include"TradeSums.h"
+#include<cstddef>
+#include<deque>
+
+// Summary of the trades within a period. open and close are the prices of the earliest
+// and latest trades in the period by time stamp, whatever order they arrived in.
+// For a stock with a tick size, tickSize is set and price*quantity is summed exactly in
+// sumOfTicksAndQuantity rather than in sumOfPriceAndQuantity.
+//
+struct Bar
+{
+	TimeStamp start;
+	TimeStamp firstTradeTime;
+	TimeStamp lastTradeTime;
+	double open;
+	double high;
+	double low;
+	double close;
+	unsigned long long volume;
+	double sumOfPriceAndQuantity;
+	TickSum sumOfTicksAndQuantity;
+	double tickSize;
+	std::size_t tradeCount;
+
+	// Returns the Volume Weighted price of the trades in the bar, or 0.0 if it has none
+	//
+	double getVolumeWeightedPrice()const
+	{
+		if (0 == volume)
+		{
+			return 0.0;
+		}
+		if (tickSize > 0.0)
+		{
+			return sumOfTicksAndQuantity.toDouble() / volume * tickSize;
+		}
+		return sumOfPriceAndQuantity / volume;
+	}
+
+	// Folds the trade into this bar
+	//
+	void add(const Trade& trade);
+
+	// Folds another bar into this bar
+	//
+	void merge(const Bar& other);
+};
+
+class BarSeries
+{
+	std::chrono::system_clock::duration resolution;
+
+	// Tick size of the stock the trades are for, or zero if it has none
+	//
+	double tickSize;
+
+	// Maximum number of bars kept, oldest released first; zero for no limit
+	//
+	std::size_t maxBars;
+
+	// Bars in time order, only for periods containing trades
+	//
+	std::deque<Bar> bars;
+
+public:
+
+	// Build an empty BarSeries of bars 'resolutionIn' long, keeping at most maxBarsIn bars
+	// (zero for no limit), for trades with the given tick size (zero for none; see
+	// TradeStore::setTickSize). The resolution must be positive or an invalid_argument is thrown.
+	//
+	explicit BarSeries(std::chrono::seconds resolutionIn, std::size_t maxBarsIn = 0, double tickSizeIn = 0.0);
+
+	// Sets the tick size of the trades to come. Throws an InvalidOperation if any bars are held.
+	//
+	void setTickSize(double tickSizeIn);
+
+	// Returns the length of each bar
+	//
+	std::chrono::seconds getResolution()const
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(resolution);
+	}
+
+	// Returns the start of the bar containing timeStamp
+	//
+	TimeStamp getBarStart(TimeStamp timeStamp)const;
+
+	// Returns the bars held, in time order
+	//
+	const std::deque<Bar>& getBars()const
+	{
+		return bars;
+	}
+
+	// Adds the trade to the bar for its time, creating that bar if needed.
+	// Trades arriving out of order update the bar they belong to.
+	//
+	void addTrade(const Trade& trade);
+
+	// Returns true IFF startTimeStamp and endTimeStamp both lie on bar boundaries, so that
+	// the bars between them cover the period exactly.
+	//
+	bool isAligned(TimeStamp startTimeStamp, TimeStamp endTimeStamp)const
+	{
+		return getBarStart(startTimeStamp) == startTimeStamp && getBarStart(endTimeStamp) == endTimeStamp;
+	}
+
+	// Merges every bar overlapping [startTimeStamp, endTimeStamp) into 'summary', whose
+	// start is set to startTimeStamp. Bars only partly inside the period are included
+	// whole, so the result is exact only when the period is aligned to the resolution.
+	// Returns false, leaving 'summary' unchanged, if no bars overlap the period.
+	//
+	bool summarize(TimeStamp startTimeStamp, TimeStamp endTimeStamp, Bar& summary)const;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include"stdafx.h"
+#include"BatchPricing.h"
+#include"Stock.h"
+#if defined(__AVX__)
+#define SUPERSIMPLESTOCKS_PRICING_AVX
+#include<immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SUPERSIMPLESTOCKS_PRICING_SSE2
+#include<emmintrin.h>
+#endif
+
+// Makes room for 'count' stocks, so that adding up to that many cannot throw
+//
+void PricingParameters::reserve(std::size_t count)
+{
+	lastDividends.reserve(count);
+	parValues.reserve(count);
+	fixedDividends.reserve(count);
+}
+
+// Adds a stock's fields to the end of the arrays
+//
+void PricingParameters::add(double lastDividend, double parValue, double fixedDividend)
+{
+	lastDividends.push_back(lastDividend);
+	parValues.push_back(parValue);
+	fixedDividends.push_back(fixedDividend);
+}
+
+namespace
+{
+	// Prices one stock's row. yieldDividend is the dividend its yield is found from: its
+	// fixed dividend times par value if it has one, otherwise its last dividend.
+	// Returns the number of prices flagged PRICE_NOT_POSITIVE.
+	//
+	std::size_t priceRow(double yieldDividend,
+		double lastDividend,
+		const double* prices,
+		std::size_t count,
+		double* dividendYields,
+		double* peRatios,
+		unsigned char* errors)
+	{
+		// written so as to hold for a last dividend which is not a number, as the scalar methods do
+		const bool hasLastDividend = !(0.0 == lastDividend);
+		const unsigned char rowFlags = hasLastDividend ? PRICING_OK : NO_LAST_DIVIDEND;
+		std::size_t notPositive = 0;
+		std::size_t t = 0;
+
+#if defined(SUPERSIMPLESTOCKS_PRICING_AVX)
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d yieldDividends = _mm256_set1_pd(yieldDividend);
+		const __m256d lastDividends = _mm256_set1_pd(lastDividend);
+		const __m256d keepPERatios = _mm256_cmp_pd(lastDividends, zero, _CMP_NEQ_UQ);
+		for (; t + 4 <= count; t += 4)
+		{
+			const __m256d price = _mm256_loadu_pd(prices + t);
+			const __m256d positive = _mm256_cmp_pd(price, zero, _CMP_GT_OQ);
+			_mm256_storeu_pd(dividendYields + t, _mm256_and_pd(positive, _mm256_div_pd(yieldDividends, price)));
+			_mm256_storeu_pd(peRatios + t, _mm256_and_pd(_mm256_and_pd(positive, keepPERatios), _mm256_div_pd(price, lastDividends)));
+			const int positiveLanes = _mm256_movemask_pd(positive);
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const bool lanePositive = 0 != (positiveLanes & (1 << lane));
+				errors[t + lane] = static_cast<unsigned char>(rowFlags | (lanePositive ? PRICING_OK : PRICE_NOT_POSITIVE));
+				notPositive += lanePositive ? 0 : 1;
+			}
+		}
+#elif defined(SUPERSIMPLESTOCKS_PRICING_SSE2)
+		const __m128d zero = _mm_setzero_pd();
+		const __m128d yieldDividends = _mm_set1_pd(yieldDividend);
+		const __m128d lastDividends = _mm_set1_pd(lastDividend);
+		const __m128d keepPERatios = _mm_cmpneq_pd(lastDividends, zero);
+		for (; t + 2 <= count; t += 2)
+		{
+			const __m128d price = _mm_loadu_pd(prices + t);
+			const __m128d positive = _mm_cmpgt_pd(price, zero);
+			_mm_storeu_pd(dividendYields + t, _mm_and_pd(positive, _mm_div_pd(yieldDividends, price)));
+			_mm_storeu_pd(peRatios + t, _mm_and_pd(_mm_and_pd(positive, keepPERatios), _mm_div_pd(price, lastDividends)));
+			const int positiveLanes = _mm_movemask_pd(positive);
+			for (int lane = 0; lane < 2; ++lane)
+			{
+				const bool lanePositive = 0 != (positiveLanes & (1 << lane));
+				errors[t + lane] = static_cast<unsigned char>(rowFlags | (lanePositive ? PRICING_OK : PRICE_NOT_POSITIVE));
+				notPositive += lanePositive ? 0 : 1;
+			}
+		}
+#endif
+
+		// the remainder of the row, or all of it without vector instructions
+		for (; t < count; ++t)
+		{
+			const double price = prices[t];
+			const bool positive = price > 0.0;
+			dividendYields[t] = positive ? yieldDividend / price : 0.0;
+			peRatios[t] = (positive && hasLastDividend) ? price / lastDividend : 0.0;
+			errors[t] = static_cast<unsigned char>(rowFlags | (positive ? PRICING_OK : PRICE_NOT_POSITIVE));
+			notPositive += positive ? 0 : 1;
+		}
+		return notPositive;
+	}
+}
+
+// Calculates the dividend yield and P/E ratio of the first stockCount stocks of
+// 'parameters' at each of pricesPerStock prices. 'prices' holds a row of pricesPerStock
+// prices for each stock in turn; dividendYields, peRatios and errors are filled in the
+// same layout, with the results for each price and its PricingError flags.
+// Returns the number of prices flagged PRICE_NOT_POSITIVE.
+//
+std::size_t calculatePricing(const PricingParameters& parameters,
+	std::size_t stockCount,
+	const double* prices,
+	std::size_t pricesPerStock,
+	double* dividendYields,
+	double* peRatios,
+	unsigned char* errors)
+{
+	const double* lastDividends = parameters.lastDividends.data();
+	const double* parValues = parameters.parValues.data();
+	const double* fixedDividends = parameters.fixedDividends.data();
+	std::size_t notPositive = 0;
+	for (std::size_t stock = 0; stock < stockCount; ++stock)
+	{
+		const double yieldDividend = (Stock::NO_FIXED_DIVIDEND != fixedDividends[stock])
+			? fixedDividends[stock] * parValues[stock]
+			: lastDividends[stock];
+		const std::size_t row = stock * pricesPerStock;
+		notPositive += priceRow(yieldDividend,
+			lastDividends[stock],
+			prices + row,
+			pricesPerStock,
+			dividendYields + row,
+			peRatios + row,
+			errors + row);
+	}
+	return notPositive;
+}
+
+// Returns the name of the instruction set calculatePricing was built for: "AVX",
+// "SSE2" or "scalar"
+//
+const char* getPricingKernelName()
+{
+#if defined(SUPERSIMPLESTOCKS_PRICING_AVX)
+	return "AVX";
+#elif defined(SUPERSIMPLESTOCKS_PRICING_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,77 @@
+/*
+* BatchPricing.h
+*
+*	Dividend yields and P/E ratios for many stocks at many prices at once, as when
+*	evaluating every stock over a grid of hypothetical prices.
+*
+*	The stocks' dividend fields are held as one contiguous array per field, and each
+*	stock's row of prices is worked through a vector register at a time: four prices
+*	with AVX, when the build enables it, otherwise two with SSE2, or one at a time on
+*	other processors. The results are identical to those of Stock::calculateDividendYield
+*	and Stock::calculatePERatio, whichever is used. Rather than throwing for a price
+*	which is not positive, each price's results come with a mask of PricingError flags.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_BATCH_PRICING
+#define SUPERSIMPLESTOCKS_BATCH_PRICING
+#include<cstddef>
+#include<vector>
+
+// Flags set in the error mask of each price priced by calculatePricing
+//
+enum PricingError : unsigned char
+{
+	PRICING_OK = 0,
+
+	// The price was zero, negative or not a number. Its dividend yield and P/E ratio are 0.0.
+	//
+	PRICE_NOT_POSITIVE = 1,
+
+	// The stock's last dividend is zero, so its P/E ratio is 0.0, as from Stock::calculatePERatio
+	//
+	NO_LAST_DIVIDEND = 2
+};
+
+// The dividend fields of a set of stocks, one array per field, indexed alike.
+// fixedDividends holds Stock::NO_FIXED_DIVIDEND for stocks without a fixed dividend.
+//
+struct PricingParameters
+{
+	std::vector<double> lastDividends;
+	std::vector<double> parValues;
+	std::vector<double> fixedDividends;
+
+	std::size_t size()const
+	{
+		return lastDividends.size();
+	}
+
+	// Makes room for 'count' stocks, so that adding up to that many cannot throw
+	//
+	void reserve(std::size_t count);
+
+	// Adds a stock's fields to the end of the arrays
+	//
+	void add(double lastDividend, double parValue, double fixedDividend);
+};
+
+// Calculates the dividend yield and P/E ratio of the first stockCount stocks of
+// 'parameters' at each of pricesPerStock prices. 'prices' holds a row of pricesPerStock
+// prices for each stock in turn; dividendYields, peRatios and errors are filled in the
+// same layout, with the results for each price and its PricingError flags.
+// Returns the number of prices flagged PRICE_NOT_POSITIVE.
+//
+std::size_t calculatePricing(const PricingParameters& parameters,
+	std::size_t stockCount,
+	const double* prices,
+	std::size_t pricesPerStock,
+	double* dividendYields,
+	double* peRatios,
+	unsigned char* errors);
+
+// Returns the name of the instruction set calculatePricing was built for: "AVX",
+// "SSE2" or "scalar"
+//
+const char* getPricingKernelName();
+
+#endif
@@ -0,0 +1,489 @@
+/*
+*  Benchmark.cpp : A non-interactive benchmark of the stock classes, built as its own
+*	executable alongside the demonstration.
+*
+*	Each benchmark is run several times from the same fixed random seed and under a
+*	VirtualClock, so that runs on one machine are directly comparable, and the median
+*	and fastest time per operation are reported. Results are written as JSON, to the
+*	file named by --output or else to standard output, for comparison between builds.
+*	--quick runs smaller sizes, for checking the benchmark itself still works.
+*
+*	Usage: Benchmark [--quick] [--repetitions N] [--output path]
+*/
+
+#include"stdafx.h"
+#include"Clock.h"
+#include"StockGroup.h"
+#include<algorithm>
+#include<chrono>
+#include<cstdlib>
+#include<fstream>
+#include<iostream>
+#include<memory>
+#include<random>
+#include<string>
+#include<vector>
+
+namespace
+{
+	const unsigned int SEED = 20160301;
+
+	// Every trade and query is timed against this moment, rather than the system clock
+	//
+	const TimeStamp BASE_TIME(std::chrono::hours(24 * 365 * 46));
+
+	// One measurement: 'operations' calls of the benchmarked operation with the named
+	// parameter set to 'value', taking the given median and fastest time per call
+	//
+	struct Result
+	{
+		std::string name;
+		std::string parameter;
+		std::size_t value;
+		std::size_t operations;
+		double medianNanoseconds;
+		double fastestNanoseconds;
+	};
+
+	struct Settings
+	{
+		bool quick;
+		std::size_t repetitions;
+		std::string outputPath;
+	};
+
+	// Results of benchmarked calls are added here so the compiler cannot drop the calls
+	//
+	volatile double sink = 0.0;
+
+	// Runs setup() then times run() 'repetitions' times, returning the median and fastest
+	// time per operation for run() performing 'operations' operations
+	//
+	template<typename Setup, typename Run>
+	Result measure(const Settings& settings,
+		const std::string& name,
+		const std::string& parameter,
+		std::size_t value,
+		std::size_t operations,
+		Setup setup,
+		Run run)
+	{
+		std::vector<double> times;
+		for (std::size_t t = 0; t < settings.repetitions; ++t)
+		{
+			setup();
+			const auto start = std::chrono::steady_clock::now();
+			run();
+			const auto finish = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double, std::nano>(finish - start).count() / operations);
+		}
+		std::sort(times.begin(), times.end());
+
+		Result result;
+		result.name = name;
+		result.parameter = parameter;
+		result.value = value;
+		result.operations = operations;
+		result.medianNanoseconds = times[times.size() / 2];
+		result.fastestNanoseconds = times.front();
+		std::cerr << name << ' ' << parameter << '=' << value << ":\t" << result.medianNanoseconds << " ns\n";
+		return result;
+	}
+
+	// Returns 'count' trades, one every millisecond from BASE_TIME, in time order
+	//
+	std::vector<Trade> makeTrades(std::size_t count, std::mt19937& engine)
+	{
+		std::uniform_int_distribution<unsigned int> randomQuantity(1, 100);
+		std::uniform_real_distribution<double> randomPrice(50, 150);
+		std::vector<Trade> trades;
+		trades.reserve(count);
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			trades.push_back(Trade(randomQuantity(engine),
+				(0 == t % 2) ? BUY_TYPE : SELL_TYPE,
+				randomPrice(engine),
+				BASE_TIME + std::chrono::milliseconds(t)));
+		}
+		return trades;
+	}
+
+	// Returns 'count' distinct symbols of up to six letters
+	//
+	std::vector<StockSymbol> makeSymbols(std::size_t count)
+	{
+		std::vector<StockSymbol> symbols;
+		symbols.reserve(count);
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			StockSymbol symbol;
+			std::size_t remaining = t;
+			do
+			{
+				symbol += static_cast<char>('A' + remaining % 26);
+				remaining /= 26;
+			} while (remaining > 0);
+			symbols.push_back(symbol);
+		}
+		return symbols;
+	}
+
+	// TradeRecord::addTrade with each trade at or after the newest, and with the same
+	// trades shuffled so that almost every one lands among existing trades
+	//
+	void benchmarkAddTrade(const Settings& settings, std::vector<Result>& results)
+	{
+		const std::size_t count = settings.quick ? 20000 : 1000000;
+		std::mt19937 engine(SEED);
+		const std::vector<Trade> inOrder = makeTrades(count, engine);
+		std::vector<Trade> outOfOrder = inOrder;
+		std::shuffle(outOfOrder.begin(), outOfOrder.end(), engine);
+
+		VirtualClock clock(BASE_TIME + std::chrono::milliseconds(count));
+		std::unique_ptr<TradeRecord> record;
+		const auto setup = [&]()
+		{
+			record.reset(new TradeRecord(std::chrono::minutes(60)));
+			record->setClock(clock);
+		};
+		const auto addAll = [&](const std::vector<Trade>& trades)
+		{
+			for (const Trade& trade : trades)
+			{
+				record->addTrade(trade);
+			}
+			sink = sink + static_cast<double>(record->getTradeCount());
+		};
+
+		results.push_back(measure(settings, "addTrade/inOrder", "trades", count, count, setup, [&]() { addAll(inOrder); }));
+		results.push_back(measure(settings, "addTrade/outOfOrder", "trades", count, count, setup, [&]() { addAll(outOfOrder); }));
+	}
+
+	// Windowed VWSP queries against records holding 'depth' trades in the window, both for
+	// the window the record maintains and for a different window, which is found from the
+	// running totals instead, the latter also for prices held in ticks. Then the price over
+	// each of four horizons, queried one by one and all at once from maintained horizons.
+	//
+	void benchmarkVwspQueries(const Settings& settings, std::vector<Result>& results)
+	{
+		const std::size_t queries = settings.quick ? 10000 : 1000000;
+		const std::size_t maxDepth = settings.quick ? 10000 : 1000000;
+		for (std::size_t depth = 100; depth <= maxDepth; depth *= 10)
+		{
+			std::mt19937 engine(SEED);
+			const std::vector<Trade> trades = makeTrades(depth, engine);
+			VirtualClock clock(BASE_TIME + std::chrono::milliseconds(depth));
+			// an hour long window holds every trade, as there is one each millisecond
+			TradeRecord record(std::chrono::minutes(60));
+			record.setClock(clock);
+			record.addTrades(trades.data(), trades.size());
+			TradeRecord tickRecord(std::chrono::minutes(60));
+			tickRecord.setClock(clock);
+			tickRecord.setTickSize(0.01);
+			tickRecord.addTrades(trades.data(), trades.size());
+			const std::vector<std::chrono::minutes> horizons =
+			{
+				std::chrono::minutes(1), std::chrono::minutes(5), std::chrono::minutes(15), std::chrono::minutes(60)
+			};
+			TradeRecord horizonRecord(std::chrono::minutes(60));
+			horizonRecord.setClock(clock);
+			horizonRecord.setHorizons(horizons);
+			horizonRecord.addTrades(trades.data(), trades.size());
+
+			const auto none = []() {};
+			results.push_back(measure(settings, "vwsp/maintainedWindow", "depth", depth, queries, none, [&]()
+			{
+				bool foundTrades;
+				double total = 0.0;
+				for (std::size_t t = 0; t < queries; ++t)
+				{
+					total += record.calculateVolumeWeightedStockPriceWithin(foundTrades, std::chrono::minutes(60));
+				}
+				sink = sink + total;
+			}));
+			results.push_back(measure(settings, "vwsp/otherWindow", "depth", depth, queries, none, [&]()
+			{
+				bool foundTrades;
+				double total = 0.0;
+				for (std::size_t t = 0; t < queries; ++t)
+				{
+					total += record.calculateVolumeWeightedStockPriceWithin(foundTrades, std::chrono::minutes(30));
+				}
+				sink = sink + total;
+			}));
+			results.push_back(measure(settings, "vwsp/otherWindowTicks", "depth", depth, queries, none, [&]()
+			{
+				bool foundTrades;
+				double total = 0.0;
+				for (std::size_t t = 0; t < queries; ++t)
+				{
+					total += tickRecord.calculateVolumeWeightedStockPriceWithin(foundTrades, std::chrono::minutes(30));
+				}
+				sink = sink + total;
+			}));
+			results.push_back(measure(settings, "vwsp/eachHorizon", "depth", depth, queries, none, [&]()
+			{
+				bool foundTrades;
+				double total = 0.0;
+				for (std::size_t t = 0; t < queries; ++t)
+				{
+					for (const auto horizon : horizons)
+					{
+						total += record.calculateVolumeWeightedStockPriceWithin(foundTrades, horizon);
+					}
+				}
+				sink = sink + total;
+			}));
+			results.push_back(measure(settings, "vwsp/maintainedHorizons", "depth", depth, queries, none, [&]()
+			{
+				std::vector<HorizonPrice> prices;
+				double total = 0.0;
+				for (std::size_t t = 0; t < queries; ++t)
+				{
+					horizonRecord.calculateHorizonPrices(prices);
+					for (const HorizonPrice& price : prices)
+					{
+						total += price.volumeWeightedStockPrice;
+					}
+				}
+				sink = sink + total;
+			}));
+		}
+	}
+
+	// StockGroup::accessStock by symbol, in a random order, against the number of stocks
+	//
+	void benchmarkAccessStock(const Settings& settings, std::vector<Result>& results)
+	{
+		const std::size_t lookups = settings.quick ? 10000 : 1000000;
+		const std::size_t maxStocks = settings.quick ? 1000 : 100000;
+		for (std::size_t stockCount = 10; stockCount <= maxStocks; stockCount *= 10)
+		{
+			const std::vector<StockSymbol> symbols = makeSymbols(stockCount);
+			StockGroup stocks;
+			for (const StockSymbol& symbol : symbols)
+			{
+				stocks.addStock(symbol, COMMON_STOCK, 8, 100);
+			}
+			std::mt19937 engine(SEED);
+			std::uniform_int_distribution<std::size_t> randomStock(0, stockCount - 1);
+			std::vector<const StockSymbol*> order;
+			order.reserve(lookups);
+			for (std::size_t t = 0; t < lookups; ++t)
+			{
+				order.push_back(&symbols[randomStock(engine)]);
+			}
+
+			results.push_back(measure(settings, "accessStock/symbol", "stocks", stockCount, lookups, []() {}, [&]()
+			{
+				double total = 0.0;
+				for (const StockSymbol* symbol : order)
+				{
+					total += stocks.accessStock(*symbol).getParValue();
+				}
+				sink = sink + total;
+			}));
+		}
+	}
+
+	// StockGroup::calculateAllShareIndexWithin for windows other than the index window:
+	// cycling through more windows than the group keeps, so that every stock is priced
+	// each time, and for one window with a trade added between calculations, so that one
+	// stock is; and calculateAllShareIndex, which is maintained incrementally, against
+	// the number of stocks
+	//
+	void benchmarkAllShareIndex(const Settings& settings, std::vector<Result>& results)
+	{
+		const std::size_t tradesPerStock = 100;
+		const std::size_t maxStocks = settings.quick ? 1000 : 10000;
+		for (std::size_t stockCount = 10; stockCount <= maxStocks; stockCount *= 10)
+		{
+			const std::size_t calculations = std::max<std::size_t>(10, (settings.quick ? 100000 : 1000000) / stockCount);
+			const std::vector<StockSymbol> symbols = makeSymbols(stockCount);
+			VirtualClock clock(BASE_TIME + std::chrono::milliseconds(tradesPerStock));
+			StockGroup stocks;
+			stocks.setClock(clock);
+			std::mt19937 engine(SEED);
+			std::vector<StockTrade> batch;
+			for (const StockSymbol& symbol : symbols)
+			{
+				const StockId id = stocks.addStock(symbol, COMMON_STOCK, 8, 100);
+				for (const Trade& trade : makeTrades(tradesPerStock, engine))
+				{
+					batch.push_back(StockTrade{ id, trade });
+				}
+			}
+			stocks.addTrades(batch.data(), batch.size());
+
+			results.push_back(measure(settings, "allShareIndex/everyStockRepriced", "stocks", stockCount, calculations, []() {}, [&]()
+			{
+				double total = 0.0;
+				for (std::size_t t = 0; t < calculations; ++t)
+				{
+					total += stocks.calculateAllShareIndexWithin(std::chrono::minutes(6 + t % 5));
+				}
+				sink = sink + total;
+			}));
+			results.push_back(measure(settings, "allShareIndex/oneStockRepriced", "stocks", stockCount, calculations, []() {}, [&]()
+			{
+				double total = 0.0;
+				for (std::size_t t = 0; t < calculations; ++t)
+				{
+					stocks.addTrade(static_cast<StockId>(t % stockCount), 10, BUY_TYPE, 100.0);
+					total += stocks.calculateAllShareIndexWithin(std::chrono::minutes(4));
+				}
+				sink = sink + total;
+			}));
+			results.push_back(measure(settings, "allShareIndex/maintainedWindow", "stocks", stockCount, calculations, []() {}, [&]()
+			{
+				double total = 0.0;
+				for (std::size_t t = 0; t < calculations; ++t)
+				{
+					total += stocks.calculateAllShareIndex();
+				}
+				sink = sink + total;
+			}));
+		}
+	}
+
+	// Dividend yields and P/E ratios for every stock over a grid of prices, one price at a
+	// time through Stock and all at once through StockGroup::calculatePricing
+	//
+	void benchmarkPricing(const Settings& settings, std::vector<Result>& results)
+	{
+		const std::size_t stockCount = settings.quick ? 100 : 1000;
+		const std::size_t pricesPerStock = 256;
+		const std::size_t count = stockCount * pricesPerStock;
+		const std::vector<StockSymbol> symbols = makeSymbols(stockCount);
+		StockGroup stocks;
+		std::mt19937 engine(SEED);
+		std::uniform_real_distribution<double> randomDividend(0, 20);
+		for (std::size_t t = 0; t < stockCount; ++t)
+		{
+			if (0 == t % 4)
+			{
+				stocks.addStock(symbols[t], PREFERRED_STOCK, randomDividend(engine), 100, 0.02);
+			}
+			else
+			{
+				stocks.addStock(symbols[t], COMMON_STOCK, randomDividend(engine), 100);
+			}
+		}
+		std::uniform_real_distribution<double> randomPrice(50, 150);
+		std::vector<double> prices(count);
+		for (double& price : prices)
+		{
+			price = randomPrice(engine);
+		}
+		std::vector<double> dividendYields(count);
+		std::vector<double> peRatios(count);
+		std::vector<unsigned char> errors(count);
+
+		results.push_back(measure(settings, "pricing/perStock", "prices", count, count, []() {}, [&]()
+		{
+			double total = 0.0;
+			for (std::size_t stock = 0; stock < stockCount; ++stock)
+			{
+				Stock& pricedStock = stocks.accessStock(static_cast<StockId>(stock));
+				for (std::size_t t = stock * pricesPerStock; t < (stock + 1) * pricesPerStock; ++t)
+				{
+					total += pricedStock.calculateDividendYield(prices[t]) + pricedStock.calculatePERatio(prices[t]);
+				}
+			}
+			sink = sink + total;
+		}));
+		std::cerr << "pricing kernel: " << getPricingKernelName() << '\n';
+		results.push_back(measure(settings, "pricing/batch", "prices", count, count, []() {}, [&]()
+		{
+			stocks.calculatePricing(prices.data(), stockCount, pricesPerStock, dividendYields.data(), peRatios.data(), errors.data());
+			sink = sink + dividendYields[count / 2] + peRatios[count / 2];
+		}));
+	}
+
+	// Writes the results as a JSON document
+	//
+	void writeResults(std::ostream& out, const Settings& settings, const std::vector<Result>& results)
+	{
+		out << "{\n"
+			<< "  \"seed\": " << SEED << ",\n"
+			<< "  \"repetitions\": " << settings.repetitions << ",\n"
+			<< "  \"quick\": " << (settings.quick ? "true" : "false") << ",\n"
+			<< "  \"results\": [\n";
+		for (std::size_t t = 0; t < results.size(); ++t)
+		{
+			const Result& result = results[t];
+			out << "    { \"name\": \"" << result.name << "\""
+				<< ", \"parameter\": \"" << result.parameter << "\""
+				<< ", \"value\": " << result.value
+				<< ", \"operations\": " << result.operations
+				<< ", \"median_ns\": " << result.medianNanoseconds
+				<< ", \"fastest_ns\": " << result.fastestNanoseconds
+				<< " }" << (t + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Settings settings;
+	settings.quick = false;
+	settings.repetitions = 5;
+	for (int t = 1; t < argc; ++t)
+	{
+		const std::string argument = argv[t];
+		if ("--quick" == argument)
+		{
+			settings.quick = true;
+		}
+		else if ("--repetitions" == argument && t + 1 < argc)
+		{
+			settings.repetitions = std::strtoul(argv[++t], nullptr, 10);
+		}
+		else if ("--output" == argument && t + 1 < argc)
+		{
+			settings.outputPath = argv[++t];
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--quick] [--repetitions N] [--output path]\n";
+			return 2;
+		}
+	}
+	if (0 == settings.repetitions)
+	{
+		std::cerr << "--repetitions must be at least one.\n";
+		return 2;
+	}
+
+	try
+	{
+		std::vector<Result> results;
+		benchmarkAddTrade(settings, results);
+		benchmarkVwspQueries(settings, results);
+		benchmarkAccessStock(settings, results);
+		benchmarkAllShareIndex(settings, results);
+		benchmarkPricing(settings, results);
+
+		if (settings.outputPath.empty())
+		{
+			writeResults(std::cout, settings, results);
+		}
+		else
+		{
+			std::ofstream out(settings.outputPath);
+			writeResults(out, settings, results);
+			if (!out)
+			{
+				std::cerr << "Could not write " << settings.outputPath << ".\n";
+				return 1;
+			}
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "An exception was thrown:\n   " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,342 @@
+#include"stdafx.h"
+#include"ChangeDispatcher.h"
+#include<algorithm>
+#include<cmath>
+#include<stdexcept>
+#include<utility>
+
+// Build a dispatcher taking changed values from collectorIn. The thread is started
+// by the first subscription.
+//
+ChangeDispatcher::ChangeDispatcher(Collector collectorIn) :
+	collector(std::move(collectorIn)),
+	nextSubscriptionId(0),
+	subscriptionCount(0),
+	subscribed(false),
+	signalled(false),
+	batchInterval(std::chrono::microseconds::zero()),
+	flushRequested(false),
+	stopping(false),
+	passesStarted(0),
+	passesFinished(0)
+{
+	// done //
+}
+
+// Stops the thread, once any pass under way has been delivered
+//
+ChangeDispatcher::~ChangeDispatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	passFinished.notify_all();
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+}
+
+// Adds a subscription, returning its id. 'callback' is called on the dispatcher thread
+// with the subscription's changes whenever its value moves by more than 'threshold'
+// from the value last delivered; a threshold of zero delivers every change.
+// stockId is the stock watched, or EVERY_STOCK to watch every stock, and is ignored
+// for ALL_SHARE_INDEX. readCurrent is called once hasSubscriptions() is true, so no
+// change made after the values it reads can be missed.
+// Exceptions thrown by the callback are caught and discarded, so that other
+// subscribers are still notified.
+// Throws an invalid_argument if threshold is negative or callback is empty.
+//
+SubscriptionId ChangeDispatcher::subscribe(SubscribedValue subscribedValue,
+	StockId stockId,
+	double threshold,
+	ChangeCallback callback,
+	const CurrentReader& readCurrent)
+{
+	if (!(threshold >= 0.0))
+	{
+		throw std::invalid_argument("ChangeDispatcher::subscribe:\tthreshold must not be negative.");
+	}
+	if (!callback)
+	{
+		throw std::invalid_argument("ChangeDispatcher::subscribe:\tcallback must not be empty.");
+	}
+
+	SubscriptionPointer subscription = std::make_shared<Subscription>();
+	subscription->subscribedValue = subscribedValue;
+	subscription->stockId = (ALL_SHARE_INDEX == subscribedValue) ? EVERY_STOCK : stockId;
+	subscription->threshold = threshold;
+	subscription->callback = std::move(callback);
+
+	std::lock_guard<std::mutex> subscriptionsLock(subscriptionsMutex);
+	const bool wasSubscribed = subscribed.load(std::memory_order_relaxed);
+	subscribed.store(true, std::memory_order_release);
+	std::vector<StockValues> current;
+	double currentIndex = 0.0;
+	try
+	{
+		readCurrent(current, currentIndex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!thread.joinable())
+			{
+				thread = std::thread(&ChangeDispatcher::run, this);
+			}
+		}
+
+		if (ALL_SHARE_INDEX == subscribedValue)
+		{
+			subscription->delivered.assign(1, currentIndex);
+			indexSubscriptions.push_back(subscription);
+		}
+		else if (EVERY_STOCK == stockId)
+		{
+			for (const StockValues& values : current)
+			{
+				if (values.stockId >= subscription->delivered.size())
+				{
+					subscription->delivered.resize(values.stockId + 1, 0.0);
+				}
+				subscription->delivered[values.stockId] = (LAST_PRICE == subscribedValue) ? values.lastPrice : values.volumeWeightedStockPrice;
+			}
+			everyStockSubscriptions.push_back(subscription);
+		}
+		else
+		{
+			subscription->delivered.assign(1, 0.0);
+			for (const StockValues& values : current)
+			{
+				if (values.stockId == stockId)
+				{
+					subscription->delivered[0] = (LAST_PRICE == subscribedValue) ? values.lastPrice : values.volumeWeightedStockPrice;
+				}
+			}
+			stockSubscriptions[stockId].push_back(subscription);
+		}
+	}
+	catch (...)
+	{
+		subscribed.store(wasSubscribed, std::memory_order_release);
+		throw;
+	}
+
+	subscription->id = nextSubscriptionId++;
+	++subscriptionCount;
+	return subscription->id;
+}
+
+// Removes a subscription. A pass already under way may still deliver to it; call
+// flush() afterwards to be sure it will not be called again.
+// Throws an invalid_argument if there is no such subscription.
+//
+void ChangeDispatcher::unsubscribe(SubscriptionId id)
+{
+	auto removeFrom = [id](std::vector<SubscriptionPointer>& subscriptions)
+	{
+		const auto found = std::find_if(subscriptions.begin(), subscriptions.end(), [id](const SubscriptionPointer& subscription)
+		{
+			return subscription->id == id;
+		});
+		if (found == subscriptions.end())
+		{
+			return false;
+		}
+		subscriptions.erase(found);
+		return true;
+	};
+
+	std::lock_guard<std::mutex> subscriptionsLock(subscriptionsMutex);
+	bool removed = removeFrom(indexSubscriptions) || removeFrom(everyStockSubscriptions);
+	for (auto stockItr = stockSubscriptions.begin(); !removed && stockItr != stockSubscriptions.end(); ++stockItr)
+	{
+		if (removeFrom(stockItr->second))
+		{
+			removed = true;
+			if (stockItr->second.empty())
+			{
+				stockSubscriptions.erase(stockItr);
+			}
+			break;
+		}
+	}
+	if (!removed)
+	{
+		throw std::invalid_argument("ChangeDispatcher::unsubscribe:\tsubscription does not exist.");
+	}
+	if (0 == --subscriptionCount)
+	{
+		subscribed.store(false, std::memory_order_release);
+	}
+}
+
+// Sets the shortest time between passes, so that changes are gathered into larger
+// batches at the cost of later delivery. Zero, the default, starts each pass as soon
+// as a change is signalled.
+//
+void ChangeDispatcher::setBatchInterval(std::chrono::microseconds interval)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	batchInterval = interval;
+}
+
+// Waits until every change signalled before the call has been delivered. Does
+// nothing when called from a callback, on the dispatcher thread itself.
+//
+void ChangeDispatcher::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!thread.joinable() || std::this_thread::get_id() == thread.get_id())
+	{
+		return;
+	}
+	const std::uint64_t target = passesStarted + 1;
+	flushRequested = true;
+	wake.notify_one();
+	passFinished.wait(lock, [&]()
+	{
+		return passesFinished >= target || stopping;
+	});
+}
+
+// Internal utility; the body of the dispatcher thread
+//
+void ChangeDispatcher::run()
+{
+	std::vector<StockValues> changed;
+	// when values next change with time alone; the first pass finds out
+	std::chrono::steady_clock::time_point nextChange = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		std::chrono::microseconds interval;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			auto woken = [this]()
+			{
+				return stopping || flushRequested || signalled.load(std::memory_order_acquire);
+			};
+			bool timed = false;
+			if (std::chrono::steady_clock::time_point::max() == nextChange || !hasSubscriptions())
+			{
+				wake.wait(lock, woken);
+			}
+			else
+			{
+				timed = !wake.wait_until(lock, nextChange, woken);
+			}
+			if (stopping)
+			{
+				return;
+			}
+			interval = (flushRequested || timed) ? std::chrono::microseconds::zero() : batchInterval;
+		}
+		if (interval > std::chrono::microseconds::zero())
+		{
+			std::this_thread::sleep_for(interval);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			flushRequested = false;
+			++passesStarted;
+		}
+
+		// cleared before collecting, so that a stock marked during collection signals again
+		signalled.store(false, std::memory_order_release);
+		std::chrono::microseconds untilNextChange;
+		const std::vector<SubscriptionPointer> delivering = findChanges(changed, untilNextChange);
+		nextChange = (std::chrono::microseconds::max() == untilNextChange)
+			? std::chrono::steady_clock::time_point::max()
+			: std::chrono::steady_clock::now() + untilNextChange;
+		for (const SubscriptionPointer& subscription : delivering)
+		{
+			try
+			{
+				subscription->callback(subscription->pending.data(), subscription->pending.size());
+			}
+			catch (...)
+			{
+				// a failing subscriber must not stop delivery to the others
+			}
+			subscription->pending.clear();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++passesFinished;
+		}
+		passFinished.notify_all();
+	}
+}
+
+// Internal utility; collects the changed values, compares them with every matching
+// subscription and returns the subscriptions with changes to deliver. untilNextChange
+// is set as by the Collector.
+//
+std::vector<ChangeDispatcher::SubscriptionPointer> ChangeDispatcher::findChanges(std::vector<StockValues>& changed, std::chrono::microseconds& untilNextChange)
+{
+	std::vector<SubscriptionPointer> delivering;
+	std::lock_guard<std::mutex> subscriptionsLock(subscriptionsMutex);
+	changed.clear();
+	untilNextChange = std::chrono::microseconds::max();
+	const double allShareIndex = collector(changed, untilNextChange);
+	if (changed.empty())
+	{
+		return delivering;
+	}
+
+	// only the subscriptions matching a changed stock are visited
+	auto compareStock = [&delivering](const SubscriptionPointer& subscription, std::size_t slot, const StockValues& values)
+	{
+		const double value = (LAST_PRICE == subscription->subscribedValue) ? values.lastPrice : values.volumeWeightedStockPrice;
+		if (compare(*subscription, slot, values.stockId, value))
+		{
+			delivering.push_back(subscription);
+		}
+	};
+	for (const StockValues& values : changed)
+	{
+		for (const SubscriptionPointer& subscription : everyStockSubscriptions)
+		{
+			compareStock(subscription, values.stockId, values);
+		}
+		const auto found = stockSubscriptions.find(values.stockId);
+		if (found != stockSubscriptions.end())
+		{
+			for (const SubscriptionPointer& subscription : found->second)
+			{
+				compareStock(subscription, 0, values);
+			}
+		}
+	}
+	for (const SubscriptionPointer& subscription : indexSubscriptions)
+	{
+		if (compare(*subscription, 0, EVERY_STOCK, allShareIndex))
+		{
+			delivering.push_back(subscription);
+		}
+	}
+	return delivering;
+}
+
+// Internal utility; records a change in the subscription if 'value' differs from the
+// value last delivered for the stock by more than the subscription's threshold.
+// Returns true if this is the subscription's first change of the pass.
+//
+bool ChangeDispatcher::compare(Subscription& subscription, std::size_t slot, StockId stockId, double value)
+{
+	if (slot >= subscription.delivered.size())
+	{
+		// a stock added since subscribing, which started without trades
+		subscription.delivered.resize(slot + 1, 0.0);
+	}
+	double& delivered = subscription.delivered[slot];
+	if (std::fabs(value - delivered) > subscription.threshold)
+	{
+		const ValueChange change = { subscription.id, subscription.subscribedValue, stockId, delivered, value };
+		subscription.pending.push_back(change);
+		delivered = value;
+		return 1 == subscription.pending.size();
+	}
+	return false;
+}
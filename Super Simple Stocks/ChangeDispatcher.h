@@ -0,0 +1,238 @@
+/*
+* ChangeDispatcher.h
+*
+*	Subscriptions to changes in per stock values and the All Share Index, delivered
+*	from a thread of their own so that nobody needs to poll every stock for changes.
+*
+*	Whoever changes a value, such as a StockGroup adding trades, marks the stock as
+*	changed and calls signal(). The dispatcher thread then wakes, collects the current
+*	values of just the stocks marked since its last pass, compares each to the value
+*	last delivered to every matching subscription, and calls each subscriber's callback
+*	once with all of its changes from that pass. Signals arriving while a pass is under
+*	way are gathered into the next pass, so the busier the stocks, the larger each batch.
+*	Values which change with time alone, such as a windowed price as trades leave its
+*	window, cannot be signalled, so each pass is also told when the next such change is
+*	due and the thread passes again then, whether signalled or not.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_CHANGE_DISPATCHER
+#define SUPERSIMPLESTOCKS_CHANGE_DISPATCHER
+#include"SymbolTable.h"
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<cstddef>
+#include<cstdint>
+#include<functional>
+#include<limits>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<unordered_map>
+#include<vector>
+
+typedef std::size_t SubscriptionId;
+
+// Subscribes to a value of every stock rather than of one
+//
+const StockId EVERY_STOCK = std::numeric_limits<StockId>::max();
+
+// The values that can be subscribed to
+//
+enum SubscribedValue
+{
+	// A stock's Volume Weighted Stock Price over the index window, 0.0 without trades in it
+	//
+	VOLUME_WEIGHTED_STOCK_PRICE = 0,
+
+	// The price of a stock's newest trade, 0.0 before it has any
+	//
+	LAST_PRICE,
+
+	// The All Share Index, 0.0 while any stock has no price
+	//
+	ALL_SHARE_INDEX
+};
+
+// One change delivered to a subscriber. previousValue is the value last delivered to
+// the subscription, or the value when it was made if none has been.
+// stockId is meaningless for ALL_SHARE_INDEX.
+//
+struct ValueChange
+{
+	SubscriptionId subscriptionId;
+	SubscribedValue subscribedValue;
+	StockId stockId;
+	double previousValue;
+	double value;
+};
+
+// Called on the dispatcher thread with a subscription's changes from one pass
+//
+typedef std::function<void(const ValueChange* changes, std::size_t count)> ChangeCallback;
+
+// The current values of a stock, as collected by the dispatcher
+//
+struct StockValues
+{
+	StockId stockId;
+	double volumeWeightedStockPrice;
+	double lastPrice;
+};
+
+class ChangeDispatcher
+{
+public:
+
+	// Called by the dispatcher thread at the start of each pass to fill 'changed' with the
+	// current values of every stock marked as changed since the last pass, clearing the
+	// marks, and to return the current All Share Index. untilNextChange is set to how
+	// long until values next change with time alone, when the thread passes again
+	// unsignalled, or to microseconds::max() if none will.
+	//
+	typedef std::function<double(std::vector<StockValues>& changed, std::chrono::microseconds& untilNextChange)> Collector;
+
+private:
+
+	struct Subscription
+	{
+		SubscriptionId id;
+		SubscribedValue subscribedValue;
+		StockId stockId;
+		double threshold;
+		ChangeCallback callback;
+
+		// The value last delivered, indexed by StockId for EVERY_STOCK, otherwise one entry
+		//
+		std::vector<double> delivered;
+
+		// Changes found for this subscription in the current pass
+		//
+		std::vector<ValueChange> pending;
+	};
+
+	typedef std::shared_ptr<Subscription> SubscriptionPointer;
+
+	Collector collector;
+
+	// Guards the subscriptions, and is held for the whole of each pass's collection and
+	// comparison, so that a subscription is made either wholly before or after a pass
+	//
+	std::mutex subscriptionsMutex;
+	std::unordered_map<StockId, std::vector<SubscriptionPointer>> stockSubscriptions;
+	std::vector<SubscriptionPointer> everyStockSubscriptions;
+	std::vector<SubscriptionPointer> indexSubscriptions;
+	SubscriptionId nextSubscriptionId;
+	std::size_t subscriptionCount;
+
+	// Read without a lock by those changing values, to skip marking stocks at all
+	//
+	std::atomic<bool> subscribed;
+
+	// Set by signal() until the next pass starts, so that only the first signal of a
+	// batch takes the mutex to wake the thread
+	//
+	std::atomic<bool> signalled;
+
+	// Guards everything below
+	//
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable passFinished;
+	std::chrono::microseconds batchInterval;
+	bool flushRequested;
+	bool stopping;
+	std::uint64_t passesStarted;
+	std::uint64_t passesFinished;
+	std::thread thread;
+
+	ChangeDispatcher(const ChangeDispatcher&) = delete;
+	ChangeDispatcher& operator=(const ChangeDispatcher&) = delete;
+
+	// Internal utility; the body of the dispatcher thread
+	//
+	void run();
+
+	// Internal utility; collects the changed values, compares them with every matching
+	// subscription and returns the subscriptions with changes to deliver. untilNextChange
+	// is set as by the Collector.
+	//
+	std::vector<SubscriptionPointer> findChanges(std::vector<StockValues>& changed, std::chrono::microseconds& untilNextChange);
+
+	// Internal utility; records a change in the subscription if 'value' differs from the
+	// value last delivered for the stock by more than the subscription's threshold.
+	// Returns true if this is the subscription's first change of the pass.
+	//
+	static bool compare(Subscription& subscription, std::size_t slot, StockId stockId, double value);
+
+public:
+
+	// Build a dispatcher taking changed values from collectorIn. The thread is started
+	// by the first subscription.
+	//
+	explicit ChangeDispatcher(Collector collectorIn);
+
+	// Stops the thread, once any pass under way has been delivered
+	//
+	~ChangeDispatcher();
+
+	// Returns true while there is at least one subscription. Those changing values need
+	// only mark stocks as changed and signal while this is true.
+	//
+	bool hasSubscriptions()const
+	{
+		return subscribed.load(std::memory_order_acquire);
+	}
+
+	// Wakes the thread for a pass, unless it has already been signalled since its last one.
+	// Call after marking a stock as changed; safe to call from any thread, under any lock.
+	//
+	void signal()
+	{
+		if (!signalled.exchange(true, std::memory_order_acq_rel))
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			wake.notify_one();
+		}
+	}
+
+	// Reads the present values the first changes of a new subscription are measured
+	// against: those of each stock watched into 'current', and the All Share Index
+	//
+	typedef std::function<void(std::vector<StockValues>& current, double& currentIndex)> CurrentReader;
+
+	// Adds a subscription, returning its id. 'callback' is called on the dispatcher thread
+	// with the subscription's changes whenever its value moves by more than 'threshold'
+	// from the value last delivered; a threshold of zero delivers every change.
+	// stockId is the stock watched, or EVERY_STOCK to watch every stock, and is ignored
+	// for ALL_SHARE_INDEX. readCurrent is called once hasSubscriptions() is true, so no
+	// change made after the values it reads can be missed.
+	// Exceptions thrown by the callback are caught and discarded, so that other
+	// subscribers are still notified.
+	// Throws an invalid_argument if threshold is negative or callback is empty.
+	//
+	SubscriptionId subscribe(SubscribedValue subscribedValue,
+		StockId stockId,
+		double threshold,
+		ChangeCallback callback,
+		const CurrentReader& readCurrent);
+
+	// Removes a subscription. A pass already under way may still deliver to it; call
+	// flush() afterwards to be sure it will not be called again.
+	// Throws an invalid_argument if there is no such subscription.
+	//
+	void unsubscribe(SubscriptionId id);
+
+	// Sets the shortest time between passes, so that changes are gathered into larger
+	// batches at the cost of later delivery. Zero, the default, starts each pass as soon
+	// as a change is signalled.
+	//
+	void setBatchInterval(std::chrono::microseconds interval);
+
+	// Waits until every change signalled before the call has been delivered. Does
+	// nothing when called from a callback, on the dispatcher thread itself.
+	//
+	void flush();
+};
+
+#endif
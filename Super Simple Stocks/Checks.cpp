@@ -0,0 +1,1219 @@
+/*
+*  Checks.cpp : Brute-force comparisons of the stock classes, built as its own
+*	executable alongside the demonstration and the benchmark, and run by ctest.
+*
+*	Each check drives the classes from a fixed random seed and under a VirtualClock,
+*	and compares what they maintain incrementally against the same quantity computed
+*	from scratch. The first few mismatches are reported and the exit status is the
+*	number of checks that failed, capped at 255.
+*
+*	Usage: Checks
+*/
+
+#include"stdafx.h"
+#include"Allocator.h"
+#include"Clock.h"
+#include"CsvTradeLoader.h"
+#include"Exceptions.h"
+#include"Snapshot.h"
+#include"StockGroup.h"
+#include"TradeJournal.h"
+#include"TradeRecord.h"
+#include"WorkerPool.h"
+#include<algorithm>
+#include<atomic>
+#include<chrono>
+#include<cmath>
+#include<cstdio>
+#include<cstdint>
+#include<cstring>
+#include<fstream>
+#include<iostream>
+#include<mutex>
+#include<random>
+#include<stdexcept>
+#include<string>
+#include<thread>
+#include<vector>
+
+namespace
+{
+	const unsigned int SEED = 20160301;
+
+	// Every trade and query is timed against this moment, rather than the system clock
+	//
+	const TimeStamp BASE_TIME(std::chrono::hours(24 * 365 * 46));
+
+	// Mismatches are reported until this many have been seen by one check
+	//
+	const std::size_t MAX_REPORTED = 10;
+
+	// Counts the comparisons made by one check and reports its mismatches
+	//
+	class Checker
+	{
+	public:
+		explicit Checker(const std::string& name)
+			:name(name), comparisons(0), mismatches(0)
+		{
+			// done //
+		}
+
+		// Compares 'actual' with 'expected' to within a relative 'tolerance', reporting
+		// 'context' on a mismatch
+		//
+		void expectNear(double actual, double expected, double tolerance, const std::string& context)
+		{
+			++comparisons;
+			if (std::fabs(actual - expected) > tolerance * std::max(1.0, std::fabs(expected)))
+			{
+				report(context + ": " + std::to_string(actual) + " against " + std::to_string(expected));
+			}
+		}
+
+		// Reports 'context' unless 'condition' holds
+		//
+		void expect(bool condition, const std::string& context)
+		{
+			++comparisons;
+			if (!condition)
+			{
+				report(context);
+			}
+		}
+
+		// Prints a summary line, returning whether every comparison matched
+		//
+		bool finish()const
+		{
+			std::cout << name << ": " << comparisons << " comparisons, " << mismatches << " mismatches\n";
+			return 0 == mismatches;
+		}
+
+	private:
+		void report(const std::string& message)
+		{
+			if (++mismatches <= MAX_REPORTED)
+			{
+				std::cout << name << ":\t" << message << "\n";
+			}
+		}
+
+		std::string name;
+		std::size_t comparisons;
+		std::size_t mismatches;
+	};
+
+	// The All Share Index within the last 'window' computed from scratch, as the
+	// geometric mean of each stock's volume weighted stock price
+	//
+	double bruteForceAllShareIndex(StockGroup& stocks, std::chrono::minutes window)
+	{
+		const std::size_t count = stocks.getStockCount();
+		if (0 == count)
+		{
+			return 0.0;
+		}
+		double sumOfLogs = 0.0;
+		for (StockId id = 0; id < count; ++id)
+		{
+			bool foundTrades;
+			const double price = stocks.calculateVolumeWeightedStockPriceWithin(id, foundTrades, window);
+			if (price <= 0.0)
+			{
+				return 0.0;
+			}
+			sumOfLogs += std::log(price);
+		}
+		return std::exp(sumOfLogs / count);
+	}
+
+	// Compares calculateAllShareIndexWithin, which recomputes only the stocks changed
+	// since a window was last queried, against the index computed from scratch, while
+	// trades arrive late and out of order, stocks are added, the clock is swapped
+	// backwards and forwards, and retention and memory budgets evict trades. Four
+	// windows are queried often enough to stay cached and a fifth now and then, so that
+	// cached windows are also evicted and recomputed.
+	//
+	bool checkWindowedAllShareIndex()
+	{
+		Checker checker("windowedAllShareIndex");
+		const int TRADES = 30000;
+		const int STOCKS = 300;
+		for (int mode = 0; mode < 4; ++mode)
+		{
+			VirtualClock firstClock(BASE_TIME);
+			VirtualClock behindClock(BASE_TIME);
+			VirtualClock aheadClock(BASE_TIME);
+			VirtualClock* clock = &firstClock;
+			StockGroup stocks((0 == mode) ? 1 : 4);
+			stocks.setClock(*clock);
+			if (2 == mode)
+			{
+				stocks.setIndexThreadCount(3);
+			}
+			if (3 == mode)
+			{
+				stocks.setRetentionPolicy(RetentionPolicy(std::chrono::minutes(4)));
+			}
+
+			std::mt19937 engine(SEED + mode);
+			std::uniform_int_distribution<unsigned int> quantities(1, 100);
+			std::uniform_int_distribution<int> steps(0, 2000);
+			std::uniform_int_distribution<int> delays(0, 600000);
+			std::uniform_int_distribution<int> picks(0, STOCKS - 1);
+			std::uniform_real_distribution<double> prices(50.0, 150.0);
+			for (int s = 0; s < STOCKS; ++s)
+			{
+				stocks.addStock(StockSymbol(("S" + std::to_string(s)).c_str()), COMMON_STOCK, 1.0, 100.0);
+			}
+
+			for (int t = 0; t < TRADES; ++t)
+			{
+				clock->advance(std::chrono::milliseconds(steps(engine)));
+				const StockId id = picks(engine) % stocks.getStockCount();
+				const TimeStamp timeStamp = clock->now() - std::chrono::milliseconds((0 == t % 5) ? delays(engine) : 0);
+				stocks.addTrade(id, quantities(engine), (t % 2) ? BUY_TYPE : SELL_TYPE, prices(engine), timeStamp);
+
+				if (10000 == t)
+				{
+					for (int s = 0; s < 5; ++s)
+					{
+						stocks.addStock(StockSymbol(("T" + std::to_string(s)).c_str()), COMMON_STOCK, 1.0, 100.0);
+					}
+				}
+				else if (15000 == t)
+				{
+					behindClock.setTime(clock->now() - std::chrono::minutes(3));
+					clock = &behindClock;
+					stocks.setClock(*clock);
+				}
+				else if (25000 == t)
+				{
+					aheadClock.setTime(clock->now() + std::chrono::minutes(2));
+					clock = &aheadClock;
+					stocks.setClock(*clock);
+				}
+				else if (27000 == t && 1 == mode)
+				{
+					stocks.setMemoryBudget(1);
+				}
+
+				if (0 == t % 7)
+				{
+					for (int minutes : { 1, 3, 7, 15, 30 })
+					{
+						if (7 == minutes && 0 != t % 1001)
+						{
+							continue;
+						}
+						const std::chrono::minutes window(minutes);
+						checker.expectNear(stocks.calculateAllShareIndexWithin(window),
+							bruteForceAllShareIndex(stocks, window), 1e-9,
+							"mode " + std::to_string(mode) + " trade " + std::to_string(t)
+							+ " window " + std::to_string(minutes));
+					}
+					if (0 == t % 2000)
+					{
+						stocks.calculateAllShareIndex();
+					}
+				}
+			}
+		}
+
+		// A stock whose only change is trades leaving the window must still be recomputed
+		VirtualClock clock(BASE_TIME);
+		StockGroup stocks;
+		stocks.setClock(clock);
+		stocks.addStock(StockSymbol("A"), COMMON_STOCK, 1.0, 100.0);
+		stocks.addStock(StockSymbol("B"), COMMON_STOCK, 1.0, 100.0);
+		stocks.addTrade(0, 10, BUY_TYPE, 100.0);
+		stocks.addTrade(1, 10, BUY_TYPE, 200.0);
+		clock.advance(std::chrono::seconds(30));
+		stocks.addTrade(0, 10, BUY_TYPE, 400.0);
+		stocks.addTrade(1, 10, BUY_TYPE, 200.0);
+		clock.advance(std::chrono::seconds(10));
+		checker.expectNear(stocks.calculateAllShareIndexWithin(std::chrono::minutes(1)),
+			std::sqrt(250.0 * 200.0), 1e-12, "before expiry");
+		clock.advance(std::chrono::seconds(30));
+		checker.expectNear(stocks.calculateAllShareIndexWithin(std::chrono::minutes(1)),
+			std::sqrt(400.0 * 200.0), 1e-12, "after expiry");
+
+		return checker.finish();
+	}
+
+	// Queries stocks' prices and order flow through the group while other threads add
+	// trades to the same stocks, checking every price lies within the range of prices
+	// traded, and that once the trades are in the group's windowed prices match each
+	// stock's record queried alone. Races here are for a thread sanitizer to find.
+	//
+	bool checkConcurrentQueries()
+	{
+		Checker checker("concurrentQueries");
+		const StockId STOCKS = 8;
+		const int TRADES_PER_THREAD = 20000;
+		StockGroup stocks(2);
+		for (StockId id = 0; id < STOCKS; ++id)
+		{
+			stocks.addStock(StockSymbol(("S" + std::to_string(id)).c_str()), COMMON_STOCK, 1.0, 100.0);
+		}
+		std::atomic<bool> adding(true);
+		std::vector<std::thread> threads;
+		for (unsigned int writer = 0; writer < 2; ++writer)
+		{
+			threads.emplace_back([&, writer]()
+			{
+				std::mt19937 engine(SEED + writer);
+				std::uniform_int_distribution<StockId> picks(0, STOCKS - 1);
+				for (int t = 0; t < TRADES_PER_THREAD; ++t)
+				{
+					stocks.addTrade(picks(engine), 1 + t % 10, (t % 2) ? BUY_TYPE : SELL_TYPE, 100.0 + t % 7);
+				}
+			});
+		}
+		std::vector<std::size_t> outOfRange(2, 0);
+		for (unsigned int reader = 0; reader < 2; ++reader)
+		{
+			threads.emplace_back([&, reader]()
+			{
+				std::vector<HorizonPrice> horizonPrices;
+				for (StockId id = 0; adding.load(); id = (id + 1) % STOCKS)
+				{
+					bool foundTrades;
+					const double price = stocks.calculateVolumeWeightedStockPriceWithin(id, foundTrades, std::chrono::minutes(1 + reader));
+					const OrderFlow flow = stocks.calculateOrderFlowWithin(id, std::chrono::minutes(5));
+					stocks.calculateHorizonPrices(id, horizonPrices);
+					if ((foundTrades && (price < 100.0 || price > 106.0))
+						|| (flow.buyQuantity > 0 && (flow.buyVolumeWeightedPrice < 100.0 || flow.buyVolumeWeightedPrice > 106.0)))
+					{
+						++outOfRange[reader];
+					}
+				}
+			});
+		}
+		threads[0].join();
+		threads[1].join();
+		adding = false;
+		threads[2].join();
+		threads[3].join();
+		checker.expect(0 == outOfRange[0] + outOfRange[1],
+			std::to_string(outOfRange[0] + outOfRange[1]) + " prices outside those traded");
+
+		for (StockId id = 0; id < STOCKS; ++id)
+		{
+			bool foundGroup;
+			bool foundRecord;
+			const double price = stocks.calculateVolumeWeightedStockPriceWithin(id, foundGroup, std::chrono::minutes(5));
+			checker.expectNear(price, stocks.accessStock(id).accessTradeRecord()
+				.calculateVolumeWeightedStockPriceWithin(foundRecord, std::chrono::minutes(5)),
+				1e-12, "stock " + std::to_string(id));
+		}
+		return checker.finish();
+	}
+
+	// Compares the Volume Weighted Stock Price between two times, which TradeRecord finds
+	// from running totals, against the same price summed directly over the trades in the
+	// range, after a long history of larger prices that would swamp the range's sums if
+	// they were taken as the difference of totals since the first trade.
+	//
+	bool checkRangeSums()
+	{
+		Checker checker("rangeSums");
+		const std::size_t HISTORY = 100000;
+		const std::size_t RECENT = 20000;
+		TradeRecord record;
+		std::vector<Trade> recent;
+		std::mt19937 engine(SEED);
+		std::uniform_int_distribution<unsigned int> quantities(1, 100);
+		std::uniform_real_distribution<double> prices(1.0, 2.0);
+		for (std::size_t t = 0; t < HISTORY + RECENT; ++t)
+		{
+			const double price = (t < HISTORY) ? 1.0e3 * prices(engine) : prices(engine);
+			const Trade trade(quantities(engine), (0 == t % 2) ? BUY_TYPE : SELL_TYPE, price,
+				BASE_TIME + std::chrono::milliseconds(t));
+			record.addTrade(trade);
+			if (t >= HISTORY)
+			{
+				recent.push_back(trade);
+			}
+		}
+
+		std::uniform_int_distribution<std::size_t> positions(0, RECENT - 1);
+		for (int query = 0; query < 1000; ++query)
+		{
+			std::size_t first = positions(engine);
+			std::size_t last = (query % 2) ? std::min(RECENT - 1, first + query % 50) : positions(engine);
+			if (last < first)
+			{
+				std::swap(first, last);
+			}
+			double priceAndQuantity = 0.0;
+			std::uint64_t quantity = 0;
+			for (std::size_t t = first; t <= last; ++t)
+			{
+				priceAndQuantity += recent[t].getPrice() * recent[t].getQuantity();
+				quantity += recent[t].getQuantity();
+			}
+			bool foundTrades;
+			checker.expectNear(record.calculateVolumeWeightedStockPriceBetween(foundTrades,
+				recent[first].getTimeStamp(), recent[last].getTimeStamp()),
+				priceAndQuantity / quantity, 1e-10,
+				"trades " + std::to_string(first) + " to " + std::to_string(last));
+		}
+		return checker.finish();
+	}
+
+	// Compares sums in ticks, which are exact whatever order trades arrive in, between a
+	// record given trades one by one, a record given the same trades shuffled in one
+	// batch and a record without a tick size, and compares each side's order flow,
+	// which is taken from per-chunk buy totals, against brute-force sums in ticks.
+	// Also checks that non-finite prices are rejected.
+	//
+	bool checkTickSums()
+	{
+		Checker checker("tickSums");
+		const double TICK_SIZE = 0.01;
+		const int TRADES = 50000;
+		std::mt19937 engine(SEED);
+		std::uniform_int_distribution<int> ticks(1, 100000);
+		std::uniform_int_distribution<unsigned int> quantities(1, 1000);
+		std::uniform_int_distribution<int> offsets(0, 600000);
+		std::vector<Trade> trades;
+		for (int t = 0; t < TRADES; ++t)
+		{
+			trades.push_back(Trade(quantities(engine), (0 == t % 3) ? SELL_TYPE : BUY_TYPE,
+				ticks(engine) * TICK_SIZE, BASE_TIME + std::chrono::milliseconds(offsets(engine))));
+		}
+
+		VirtualClock clock(BASE_TIME + std::chrono::minutes(10));
+		TradeRecord oneByOne;
+		TradeRecord batched;
+		TradeRecord unticked;
+		oneByOne.setClock(clock);
+		batched.setClock(clock);
+		unticked.setClock(clock);
+		oneByOne.setTickSize(TICK_SIZE);
+		batched.setTickSize(TICK_SIZE);
+		for (const Trade& trade : trades)
+		{
+			oneByOne.addTrade(trade);
+			unticked.addTrade(trade);
+		}
+		std::vector<Trade> shuffled = trades;
+		std::shuffle(shuffled.begin(), shuffled.end(), engine);
+		batched.addTrades(shuffled.data(), shuffled.size());
+
+		for (int query = 0; query < 200; ++query)
+		{
+			const TimeStamp start = BASE_TIME + std::chrono::milliseconds(offsets(engine));
+			const TimeStamp end = start + std::chrono::milliseconds(offsets(engine));
+			bool foundOneByOne;
+			bool foundBatched;
+			bool foundUnticked;
+			const double price = oneByOne.calculateVolumeWeightedStockPriceBetween(foundOneByOne, start, end);
+			const std::string context = "range " + std::to_string(query);
+			checker.expect(price == batched.calculateVolumeWeightedStockPriceBetween(foundBatched, start, end)
+				&& foundOneByOne == foundBatched, context + " differs by arrival order");
+			checker.expectNear(price, unticked.calculateVolumeWeightedStockPriceBetween(foundUnticked, start, end),
+				1e-9, context + " against floating point sums");
+		}
+
+		for (int step = 0; step < 12; ++step)
+		{
+			for (int minutes : { 5, 7 })
+			{
+				const std::chrono::minutes window(minutes);
+				const TimeStamp start = clock.now() - window;
+				std::uint64_t quantity[2] = { 0, 0 };
+				std::uint64_t ticksAndQuantity[2] = { 0, 0 };
+				for (const Trade& trade : trades)
+				{
+					if (trade.getTimeStamp() >= start)
+					{
+						const int side = (BUY_TYPE == trade.getBuyOrSellType()) ? 0 : 1;
+						quantity[side] += trade.getQuantity();
+						ticksAndQuantity[side] += static_cast<std::uint64_t>(std::llround(trade.getPrice() / TICK_SIZE)) * trade.getQuantity();
+					}
+				}
+				const OrderFlow flow = oneByOne.calculateOrderFlowWithin(window);
+				const std::string context = "step " + std::to_string(step) + " window " + std::to_string(minutes);
+				checker.expect(quantity[0] == flow.buyQuantity && quantity[1] == flow.sellQuantity,
+					context + " quantities");
+				checker.expectNear(flow.buyVolumeWeightedPrice,
+					(0 == quantity[0]) ? 0.0 : static_cast<double>(ticksAndQuantity[0]) / quantity[0] * TICK_SIZE,
+					1e-12, context + " buys");
+				checker.expectNear(flow.sellVolumeWeightedPrice,
+					(0 == quantity[1]) ? 0.0 : static_cast<double>(ticksAndQuantity[1]) / quantity[1] * TICK_SIZE,
+					1e-12, context + " sells");
+			}
+			clock.advance(std::chrono::seconds(37));
+		}
+
+		for (double price : { std::nan(""), HUGE_VAL, -HUGE_VAL })
+		{
+			bool rejected = false;
+			try
+			{
+				Trade trade(1, BUY_TYPE, price, BASE_TIME);
+			}
+			catch (std::invalid_argument&)
+			{
+				rejected = true;
+			}
+			checker.expect(rejected, "price " + std::to_string(price) + " accepted");
+		}
+		return checker.finish();
+	}
+
+	// Compares summarizeBars, which covers a period from bars of several resolutions and
+	// the trades themselves at its unaligned ends, against the same summary found from
+	// every trade in the period, for periods of random length and alignment. Trades have
+	// distinct times and arrive out of order.
+	//
+	bool checkBarSummaries()
+	{
+		Checker checker("barSummaries");
+		const int TRADES = 20000;
+		const int SPAN_MILLISECONDS = 3 * 60 * 60 * 1000;
+		std::mt19937 engine(SEED);
+		std::uniform_int_distribution<int> ticks(1, 10000);
+		std::uniform_int_distribution<unsigned int> quantities(1, 100);
+		std::vector<Trade> trades;
+		for (int t = 0; t < TRADES; ++t)
+		{
+			trades.push_back(Trade(quantities(engine), BUY_TYPE, ticks(engine) * 0.01,
+				BASE_TIME + std::chrono::milliseconds(static_cast<long long>(t) * SPAN_MILLISECONDS / TRADES)));
+		}
+		std::shuffle(trades.begin(), trades.end(), engine);
+
+		for (double tickSize : { 0.0, 0.01 })
+		{
+			VirtualClock clock(BASE_TIME + std::chrono::milliseconds(SPAN_MILLISECONDS));
+			TradeRecord record;
+			record.setClock(clock);
+			record.setTickSize(tickSize);
+			record.addBarSeries(std::chrono::seconds(60));
+			record.addBarSeries(std::chrono::seconds(900));
+			record.addBarSeries(std::chrono::seconds(3600));
+			for (const Trade& trade : trades)
+			{
+				record.addTrade(trade);
+			}
+
+			std::uniform_int_distribution<int> offsets(-60000, SPAN_MILLISECONDS + 60000);
+			for (int query = 0; query < 500; ++query)
+			{
+				int first = offsets(engine);
+				int last = (query % 3) ? offsets(engine) : first + offsets(engine) % 200000;
+				if (last < first)
+				{
+					std::swap(first, last);
+				}
+				const TimeStamp start = BASE_TIME + std::chrono::milliseconds(first);
+				const TimeStamp end = BASE_TIME + std::chrono::milliseconds(last);
+
+				Bar expected = Bar();
+				expected.tickSize = tickSize;
+				for (const Trade& trade : trades)
+				{
+					if (trade.getTimeStamp() >= start && trade.getTimeStamp() < end)
+					{
+						expected.add(tickSize > 0.0 ? record.accessTradeStore().roundToTick(trade) : trade);
+					}
+				}
+				Bar summary = Bar();
+				const bool found = record.summarizeBars(start, end, summary);
+				const std::string context = "tick size " + std::to_string(tickSize) + " period "
+					+ std::to_string(first) + " to " + std::to_string(last) + " ms";
+				checker.expect(found == (0 != expected.tradeCount), context + " found trades");
+				if (found)
+				{
+					checker.expect(summary.tradeCount == expected.tradeCount && summary.volume == expected.volume,
+						context + " counts " + std::to_string(summary.tradeCount) + " trades against " + std::to_string(expected.tradeCount));
+					checker.expect(summary.open == expected.open && summary.close == expected.close
+						&& summary.high == expected.high && summary.low == expected.low,
+						context + " prices");
+					checker.expectNear(summary.getVolumeWeightedPrice(), expected.getVolumeWeightedPrice(),
+						1e-12, context + " volume weighted price");
+				}
+			}
+		}
+		return checker.finish();
+	}
+
+	// Adds a trade a minute to records with a retention policy's maxAge, too slowly for
+	// the chunks to fill quickly, and checks after every trade that the oldest chunk
+	// holds a trade within maxAge or the window, and that the windowed price matches
+	// a record keeping every trade.
+	//
+	bool checkRetentionAge()
+	{
+		Checker checker("retentionAge");
+		const std::chrono::minutes MAX_AGE(10);
+		VirtualClock clock(BASE_TIME);
+		TradeRecord retained;
+		TradeRecord everything;
+		retained.setClock(clock);
+		everything.setClock(clock);
+		retained.setRetentionPolicy(RetentionPolicy(MAX_AGE));
+		std::mt19937 engine(SEED);
+		std::uniform_int_distribution<unsigned int> quantities(1, 100);
+		std::uniform_real_distribution<double> prices(50.0, 150.0);
+		for (int minute = 0; minute < 600; ++minute)
+		{
+			clock.advance(std::chrono::minutes(1));
+			const Trade trade(quantities(engine), BUY_TYPE, prices(engine), clock.now());
+			retained.addTrade(trade);
+			everything.addTrade(trade);
+
+			const TradeStore& store = retained.accessTradeStore();
+			const TimeStamp oldest = store.getChunkNewestTimeStamp(0);
+			checker.expect(oldest >= clock.now() - std::max(MAX_AGE, retained.getWindow()),
+				"minute " + std::to_string(minute) + " keeps a chunk ending "
+				+ std::to_string(std::chrono::duration_cast<std::chrono::minutes>(clock.now() - oldest).count())
+				+ " minutes ago");
+			bool foundRetained;
+			bool foundEverything;
+			checker.expectNear(retained.calculateVolumeWeightedStockPriceWithin(foundRetained, std::chrono::minutes(5)),
+				everything.calculateVolumeWeightedStockPriceWithin(foundEverything, std::chrono::minutes(5)),
+				1e-12, "minute " + std::to_string(minute) + " windowed price");
+		}
+		return checker.finish();
+	}
+
+	// Allocates and frees blocks of several sizes and alignments from a PoolAllocator at
+	// random, filling each block with a pattern of its own, and compares every block's
+	// contents and alignment when it is freed, so that blocks handed out twice or
+	// overlapping are found. Then checks the pool returns its memory to the heap once
+	// every block is freed, keeping no more than one slab of each size, and repeats the
+	// random allocations from several threads at once.
+	//
+	bool checkPoolAllocator()
+	{
+		Checker checker("poolAllocator");
+		const std::size_t SLAB_SIZE = 1 << 16;
+		const std::size_t sizes[] = { 1, 24, 100, 1000, 4096, 20000, 70000 };
+		const std::size_t alignments[] = { 8, 16, 64 };
+
+		struct Block
+		{
+			unsigned char* memory;
+			std::size_t size;
+			std::size_t alignment;
+			unsigned char pattern;
+		};
+
+		auto run = [&](PoolAllocator& pool, unsigned int seed, int operations, std::vector<Block>& blocks, std::vector<std::string>& failures)
+		{
+			std::mt19937 engine(seed);
+			std::uniform_int_distribution<std::size_t> sizeChoices(0, sizeof(sizes) / sizeof(sizes[0]) - 1);
+			std::uniform_int_distribution<std::size_t> alignmentChoices(0, sizeof(alignments) / sizeof(alignments[0]) - 1);
+			std::uniform_int_distribution<int> percent(0, 99);
+			for (int operation = 0; operation < operations; ++operation)
+			{
+				// allocate more often than free for the first half, then the other way round
+				const int allocatePercent = (operation < operations / 2) ? 60 : 40;
+				if (blocks.empty() || percent(engine) < allocatePercent)
+				{
+					Block block;
+					block.size = sizes[sizeChoices(engine)];
+					block.alignment = alignments[alignmentChoices(engine)];
+					block.pattern = static_cast<unsigned char>(engine());
+					block.memory = static_cast<unsigned char*>(pool.allocate(block.size, block.alignment));
+					std::memset(block.memory, block.pattern, block.size);
+					blocks.push_back(block);
+				}
+				else
+				{
+					std::uniform_int_distribution<std::size_t> picks(0, blocks.size() - 1);
+					const std::size_t pick = picks(engine);
+					const Block block = blocks[pick];
+					blocks[pick] = blocks.back();
+					blocks.pop_back();
+					const bool aligned = 0 == reinterpret_cast<std::uintptr_t>(block.memory) % block.alignment;
+					const bool intact = std::all_of(block.memory, block.memory + block.size,
+						[&block](unsigned char byte) { return byte == block.pattern; });
+					if (!aligned || !intact)
+					{
+						failures.push_back("block of " + std::to_string(block.size) + " bytes "
+							+ (aligned ? "overwritten" : "misaligned"));
+					}
+					pool.deallocate(block.memory, block.size, block.alignment);
+				}
+			}
+		};
+
+		PoolAllocator pool(SLAB_SIZE);
+		std::vector<Block> blocks;
+		std::vector<std::string> failures;
+		run(pool, SEED, 200000, blocks, failures);
+		checker.expect(failures.empty(), failures.empty() ? std::string() : failures.front());
+		const std::size_t peak = pool.getMemoryReserved();
+		for (const Block& block : blocks)
+		{
+			pool.deallocate(block.memory, block.size, block.alignment);
+		}
+		const std::size_t classes = (sizeof(sizes) / sizeof(sizes[0])) * (sizeof(alignments) / sizeof(alignments[0]));
+		checker.expect(pool.getMemoryReserved() <= classes * SLAB_SIZE,
+			"still holding " + std::to_string(pool.getMemoryReserved()) + " bytes of a peak of "
+			+ std::to_string(peak) + " with every block freed");
+
+		PoolAllocator sharedPool(SLAB_SIZE);
+		std::vector<std::vector<Block>> threadBlocks(4);
+		std::vector<std::vector<std::string>> threadFailures(4);
+		std::vector<std::thread> threads;
+		for (std::size_t t = 0; t < threadBlocks.size(); ++t)
+		{
+			threads.emplace_back([&, t]()
+			{
+				run(sharedPool, SEED + static_cast<unsigned int>(t), 50000, threadBlocks[t], threadFailures[t]);
+				for (const Block& block : threadBlocks[t])
+				{
+					sharedPool.deallocate(block.memory, block.size, block.alignment);
+				}
+			});
+		}
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		for (const std::vector<std::string>& failed : threadFailures)
+		{
+			checker.expect(failed.empty(), failed.empty() ? std::string() : "from a thread: " + failed.front());
+		}
+		checker.expect(sharedPool.getMemoryReserved() <= classes * SLAB_SIZE,
+			"shared pool still holding " + std::to_string(sharedPool.getMemoryReserved()) + " bytes with every block freed");
+		return checker.finish();
+	}
+
+	// Opens an empty file as a journal, as a crash just after creating one leaves, then
+	// adds trades through a group journalling them, one at a time and in batches, along
+	// with trades the group refuses, and checks that replaying the journal into a fresh
+	// group gives the same trades and prices, and that no refused trade was journalled.
+	//
+	bool checkJournal()
+	{
+		Checker checker("journal");
+		const char* const PATH = "Checks.journal";
+		const StockId STOCKS = 4;
+		std::FILE* empty = std::fopen(PATH, "wb");
+		checker.expect(nullptr != empty, "cannot create an empty file");
+		if (nullptr != empty)
+		{
+			std::fclose(empty);
+		}
+		checker.expect(0 == TradeJournal::replay(PATH, [](const StockTrade*, std::size_t) {}),
+			"empty file replays as trades");
+
+		auto makeGroup = [](StockGroup& stocks, VirtualClock& clock)
+		{
+			stocks.setClock(clock);
+			for (StockId id = 0; id < STOCKS; ++id)
+			{
+				stocks.addStock(StockSymbol(("S" + std::to_string(id)).c_str()), COMMON_STOCK, 1.0, 100.0);
+			}
+			stocks.setTickSize(1, 0.01);
+		};
+
+		VirtualClock clock(BASE_TIME);
+		StockGroup written(2);
+		makeGroup(written, clock);
+		std::size_t refused = 0;
+		{
+			TradeJournal journal(PATH);
+			written.setJournal(&journal);
+			std::mt19937 engine(SEED);
+			std::uniform_int_distribution<unsigned int> quantities(1, 100);
+			std::uniform_int_distribution<StockId> picks(0, STOCKS - 1);
+			std::uniform_real_distribution<double> prices(50.0, 150.0);
+			for (int t = 0; t < 2000; ++t)
+			{
+				clock.advance(std::chrono::milliseconds(100));
+				if (0 == t % 4)
+				{
+					std::vector<StockTrade> batch;
+					for (int b = 0; b < 8; ++b)
+					{
+						const StockTrade stockTrade = { picks(engine), Trade(quantities(engine), BUY_TYPE, prices(engine), clock.now()) };
+						batch.push_back(stockTrade);
+					}
+					written.addTrades(batch.data(), batch.size());
+				}
+				else
+				{
+					written.addTrade(picks(engine), quantities(engine), SELL_TYPE, prices(engine));
+				}
+				if (0 == t % 100)
+				{
+					// too many ticks to sum exactly, so the group refuses these
+					try
+					{
+						written.addTrade(1, 2000000000, BUY_TYPE, 1e9);
+					}
+					catch (std::invalid_argument&)
+					{
+						++refused;
+					}
+					try
+					{
+						const StockTrade batch[] = { { 0, Trade(10, BUY_TYPE, 100.0, clock.now()) },
+							{ 1, Trade(4000000000u, BUY_TYPE, 1e9, clock.now()) } };
+						written.addTrades(batch, 2);
+					}
+					catch (std::invalid_argument&)
+					{
+						++refused;
+					}
+				}
+			}
+			journal.sync();
+			written.setJournal(nullptr);
+		}
+		checker.expect(40 == refused, std::to_string(refused) + " of 40 bad trades refused");
+
+		StockGroup replayed(3);
+		makeGroup(replayed, clock);
+		const std::size_t count = replayed.replayJournal(PATH);
+		std::size_t expected = 0;
+		for (StockId id = 0; id < STOCKS; ++id)
+		{
+			const std::size_t writtenCount = written.accessStock(id).accessTradeRecord().getTradeCount();
+			expected += writtenCount;
+			checker.expect(writtenCount == replayed.accessStock(id).accessTradeRecord().getTradeCount(),
+				"stock " + std::to_string(id) + " trade count");
+			bool foundWritten;
+			bool foundReplayed;
+			checker.expectNear(replayed.calculateVolumeWeightedStockPriceWithin(id, foundReplayed, std::chrono::minutes(1)),
+				written.calculateVolumeWeightedStockPriceWithin(id, foundWritten, std::chrono::minutes(1)),
+				1e-12, "stock " + std::to_string(id) + " windowed price");
+		}
+		checker.expect(expected == count, std::to_string(count) + " trades replayed of " + std::to_string(expected));
+		std::remove(PATH);
+		return checker.finish();
+	}
+
+	// Compares every stock's definition and every trade held by two groups, reporting
+	// mismatches under 'context'
+	//
+	void compareGroups(Checker& checker, StockGroup& expected, StockGroup& actual, const std::string& context)
+	{
+		checker.expect(expected.getStockCount() == actual.getStockCount(), context + " stock count");
+		for (StockId id = 0; id < std::min(expected.getStockCount(), actual.getStockCount()); ++id)
+		{
+			const Stock& expectedStock = expected.accessStock(id);
+			const Stock& actualStock = actual.accessStock(id);
+			const std::string stockContext = context + " stock " + std::to_string(id);
+			checker.expect(expectedStock.getStockSymbol() == actualStock.getStockSymbol()
+				&& expectedStock.getStockType() == actualStock.getStockType()
+				&& expectedStock.getLastDividend() == actualStock.getLastDividend()
+				&& expectedStock.getParValue() == actualStock.getParValue()
+				&& expectedStock.hasFixedDividend() == actualStock.hasFixedDividend()
+				&& expectedStock.accessTradeRecord().getTickSize() == actualStock.accessTradeRecord().getTickSize(),
+				stockContext + " definition");
+			const TradeStore& expectedTrades = expectedStock.accessTradeRecord().accessTradeStore();
+			const TradeStore& actualTrades = actualStock.accessTradeRecord().accessTradeStore();
+			checker.expect(expectedTrades.size() == actualTrades.size(), stockContext + " trade count");
+			std::size_t mismatched = 0;
+			auto actualTrade = actualTrades.begin();
+			for (auto expectedTrade = expectedTrades.begin(); expectedTrade != expectedTrades.end() && actualTrade != actualTrades.end(); ++expectedTrade, ++actualTrade)
+			{
+				const Trade a = *expectedTrade;
+				const Trade b = *actualTrade;
+				mismatched += (a.getTimeStamp() != b.getTimeStamp() || a.getPrice() != b.getPrice()
+					|| a.getQuantity() != b.getQuantity() || a.getBuyOrSellType() != b.getBuyOrSellType()) ? 1 : 0;
+			}
+			checker.expect(0 == mismatched, stockContext + " has " + std::to_string(mismatched) + " trades differing");
+		}
+	}
+
+	// Reads the whole of the file at 'path'
+	//
+	std::string readFile(const char* path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	// Writes 'contents' to the file at 'path', replacing it
+	//
+	void writeFile(const char* path, const std::string& contents)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+	}
+
+	// Writes a snapshot of a group holding common and preferred stocks, one priced in
+	// ticks and one without trades, whose trades arrived out of order, and checks that
+	// loading it gives the same stocks and trades, including once a second snapshot has
+	// replaced the first. Then checks that snapshots with a bad quantity, price or side
+	// in one row, or a repeated symbol, are refused and leave the loading group empty.
+	//
+	bool checkSnapshot()
+	{
+		Checker checker("snapshot");
+		const char* const PATH = "Checks.snapshot";
+		const char* const BAD_PATH = "Checks.bad.snapshot";
+		VirtualClock clock(BASE_TIME);
+		StockGroup written(2);
+		written.setClock(clock);
+		written.addStock(StockSymbol("TEA"), COMMON_STOCK, 0.0, 100.0);
+		written.addStock(StockSymbol("GIN"), PREFERRED_STOCK, 8.0, 100.0, 0.02);
+		written.addStock(StockSymbol("ALE"), COMMON_STOCK, 23.0, 60.0);
+		written.addStock(StockSymbol("POP"), COMMON_STOCK, 8.0, 100.0);
+		written.setTickSize(2, 0.05);
+
+		std::mt19937 engine(SEED);
+		std::uniform_int_distribution<int> quantities(1, 1000);
+		std::uniform_int_distribution<StockId> picks(0, 2);
+		std::uniform_int_distribution<int> delays(0, 60000);
+		std::uniform_real_distribution<double> prices(50.0, 150.0);
+		auto addTrades = [&](int count)
+		{
+			for (int t = 0; t < count; ++t)
+			{
+				clock.advance(std::chrono::milliseconds(250));
+				written.addTrade(picks(engine), quantities(engine), (t % 3) ? BUY_TYPE : SELL_TYPE, prices(engine),
+					clock.now() - std::chrono::milliseconds((0 == t % 4) ? delays(engine) : 0));
+			}
+		};
+
+		addTrades(5000);
+		written.writeSnapshot(PATH);
+		StockGroup loaded(3);
+		loaded.setClock(clock);
+		loaded.loadSnapshot(PATH);
+		compareGroups(checker, written, loaded, "first snapshot");
+		bool threw = false;
+		try
+		{
+			loaded.loadSnapshot(PATH);
+		}
+		catch (InvalidOperation&)
+		{
+			threw = true;
+		}
+		checker.expect(threw, "loading into a group holding stocks");
+
+		addTrades(3000);
+		written.writeSnapshot(PATH);
+		StockGroup reloaded;
+		reloaded.setClock(clock);
+		reloaded.loadSnapshot(PATH);
+		compareGroups(checker, written, reloaded, "replacing snapshot");
+		checker.expect(!std::ifstream(std::string(PATH) + ".tmp"), "temporary file left behind");
+
+		// the first stock's columns, to spoil one row at a time
+		const std::string good = readFile(PATH);
+		SnapshotStock entry;
+		std::memcpy(&entry, good.data() + sizeof(SnapshotHeader), sizeof(entry));
+		const std::size_t row = static_cast<std::size_t>(entry.tradeCount / 2);
+		const std::size_t priceColumn = static_cast<std::size_t>(entry.tradesOffset + entry.tradeCount * sizeof(std::int64_t));
+		const std::size_t quantityColumn = priceColumn + static_cast<std::size_t>(entry.tradeCount * sizeof(double));
+		const std::size_t sides = quantityColumn + static_cast<std::size_t>(entry.tradeCount * sizeof(std::uint32_t));
+		auto spoil = [&](std::size_t offset, const void* value, std::size_t bytes, const std::string& context)
+		{
+			std::string bad = good;
+			std::memcpy(&bad[offset], value, bytes);
+			writeFile(BAD_PATH, bad);
+			StockGroup refusing;
+			bool refused = false;
+			try
+			{
+				refusing.loadSnapshot(BAD_PATH);
+			}
+			catch (std::runtime_error&)
+			{
+				refused = true;
+			}
+			checker.expect(refused, context + " loaded");
+			checker.expect(0 == refusing.getStockCount(), context + " left " + std::to_string(refusing.getStockCount()) + " stocks");
+		};
+		const std::uint32_t zero = 0;
+		const double negative = -1.0;
+		const double notANumber = std::nan("");
+		const unsigned char side = 7;
+		spoil(quantityColumn + row * sizeof(std::uint32_t), &zero, sizeof(zero), "zero quantity");
+		spoil(priceColumn + row * sizeof(double), &negative, sizeof(negative), "negative price");
+		spoil(priceColumn + row * sizeof(double), &notANumber, sizeof(notANumber), "NaN price");
+		spoil(sides + row, &side, sizeof(side), "bad side");
+		spoil(static_cast<std::size_t>(entry.symbolOffset) + 3, "ALE", 3, "repeated symbol");
+
+		std::remove(PATH);
+		std::remove(BAD_PATH);
+		return checker.finish();
+	}
+
+	// Writes trades as CSV rows, with a header, blank lines, Windows line endings, spaced
+	// fields, sides spelt several ways and a row for an unknown stock, and checks that
+	// loading them in small batches gives the same trades as adding them directly, and
+	// that a malformed row is refused.
+	//
+	bool checkCsvLoader()
+	{
+		Checker checker("csvLoader");
+		VirtualClock clock(BASE_TIME);
+		StockGroup direct;
+		StockGroup loaded(2);
+		for (StockGroup* stocks : { &direct, &loaded })
+		{
+			stocks->setClock(clock);
+			stocks->addStock(StockSymbol("TEA"), COMMON_STOCK, 0.0, 100.0);
+			stocks->addStock(StockSymbol("POP"), COMMON_STOCK, 8.0, 100.0);
+			stocks->addStock(StockSymbol("ALE"), COMMON_STOCK, 23.0, 60.0);
+		}
+		const char* const symbols[] = { "TEA", "POP", "ALE" };
+		const char* const buys[] = { "B", "Buy", "BUY" };
+		const char* const sells[] = { "S", "Sell", "s" };
+
+		std::mt19937 engine(SEED);
+		std::uniform_int_distribution<int> quantities(1, 1000);
+		std::uniform_int_distribution<int> picks(0, 2);
+		std::uniform_int_distribution<int> cents(100, 99999);
+		std::uniform_int_distribution<int> steps(0, 999);
+		const std::int64_t BASE_SECONDS = std::chrono::duration_cast<std::chrono::seconds>(BASE_TIME.time_since_epoch()).count();
+		std::int64_t milliseconds = 0;
+		std::string text = "symbol,quantity,side,price,timeStamp\r\n";
+		for (int t = 0; t < 3000; ++t)
+		{
+			milliseconds += steps(engine);
+			const int pick = picks(engine);
+			const int quantity = quantities(engine);
+			const int price = cents(engine);
+			const BuyOrSellType type = (t % 2) ? BUY_TYPE : SELL_TYPE;
+			const TimeStamp timeStamp = BASE_TIME + std::chrono::milliseconds(milliseconds);
+			direct.addTrade(pick, quantity, type, price / 100.0, timeStamp);
+			char fraction[8];
+			std::snprintf(fraction, sizeof(fraction), "%03d", static_cast<int>(milliseconds % 1000));
+			text += std::string((0 == t % 5) ? " " : "") + symbols[pick] + "," + std::to_string(quantity) + ", "
+				+ ((BUY_TYPE == type) ? buys[t % 3] : sells[t % 3]) + "," + std::to_string(price / 100) + "."
+				+ ((price % 100 < 10) ? "0" : "") + std::to_string(price % 100) + ","
+				+ std::to_string(BASE_SECONDS + milliseconds / 1000) + "." + fraction
+				+ ((0 == t % 7) ? "\n" : "\r\n");
+			if (0 == t % 500)
+			{
+				text += "\r\nGIN,10,B,100.00," + std::to_string(BASE_SECONDS) + "\r\n";
+			}
+		}
+
+		CsvTradeLoader loader(loaded, 256);
+		checker.expect(3000 == loader.loadBuffer(text.data(), text.size()), "trades loaded");
+		checker.expect(6 == loader.getUnknownSymbolRows(), std::to_string(loader.getUnknownSymbolRows()) + " unknown rows counted");
+		compareGroups(checker, direct, loaded, "loaded");
+
+		const std::string malformed = "TEA,10,B,1x0.00," + std::to_string(BASE_SECONDS) + "\n";
+		bool refused = false;
+		try
+		{
+			CsvTradeLoader(loaded).loadBuffer(malformed.data(), malformed.size());
+		}
+		catch (std::runtime_error&)
+		{
+			refused = true;
+		}
+		checker.expect(refused, "malformed price loaded");
+
+		// fractions beyond a nanosecond round on their tenth digit
+		const std::pair<const char*, std::int64_t> fractions[] = { { ".0000000004", 0 }, { ".0000000005", 1 },
+			{ ".00000000049", 0 }, { ".0000000019", 2 }, { ".9999999996", 1000000000 } };
+		for (const auto& fraction : fractions)
+		{
+			const std::string row = "TEA,10,B,1.00," + std::to_string(BASE_SECONDS) + fraction.first + "\n";
+			TimeStamp timeStamp;
+			CsvTradeLoader(loaded, [&timeStamp](const StockTrade* trades, std::size_t)
+			{
+				timeStamp = trades[0].trade.getTimeStamp();
+			}).loadBuffer(row.data(), row.size());
+			const TimeStamp expected(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+				std::chrono::seconds(BASE_SECONDS) + std::chrono::nanoseconds(fraction.second)));
+			checker.expect(expected == timeStamp, std::string("fraction ") + fraction.first);
+		}
+		return checker.finish();
+	}
+
+	// Adds trades, all at the same moment, from several threads at once through a group
+	// journalling them, some in batches and some one at a time, and checks that replaying
+	// the journal gives every stock the same trades in the same order, so that ties are
+	// broken as they were when the trades were added.
+	//
+	bool checkConcurrentJournal()
+	{
+		Checker checker("concurrentJournal");
+		const char* const PATH = "Checks.concurrent.journal";
+		const StockId STOCKS = 6;
+		const int THREADS = 4;
+		std::remove(PATH);
+		VirtualClock clock(BASE_TIME);
+		auto makeGroup = [&clock](StockGroup& stocks)
+		{
+			stocks.setClock(clock);
+			for (StockId id = 0; id < STOCKS; ++id)
+			{
+				stocks.addStock(StockSymbol(("S" + std::to_string(id)).c_str()), COMMON_STOCK, 1.0, 100.0);
+			}
+		};
+
+		StockGroup written(3);
+		makeGroup(written);
+		{
+			TradeJournal journal(PATH);
+			written.setJournal(&journal);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < THREADS; ++t)
+			{
+				threads.emplace_back([&written, &clock, t]()
+				{
+					std::mt19937 engine(SEED + t);
+					std::uniform_int_distribution<StockId> picks(0, STOCKS - 1);
+					std::uniform_real_distribution<double> prices(50.0, 150.0);
+					for (int b = 0; b < 2000; ++b)
+					{
+						if (0 == b % 2)
+						{
+							std::vector<StockTrade> batch;
+							for (int s = 0; s < 6; ++s)
+							{
+								const StockTrade stockTrade = { picks(engine), Trade(1 + t, BUY_TYPE, prices(engine), clock.now()) };
+								batch.push_back(stockTrade);
+							}
+							written.addTrades(batch.data(), batch.size());
+						}
+						else
+						{
+							written.addTrade(picks(engine), 1 + t, SELL_TYPE, prices(engine), clock.now());
+						}
+					}
+				});
+			}
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+			journal.sync();
+			written.setJournal(nullptr);
+		}
+
+		StockGroup replayed(2);
+		makeGroup(replayed);
+		replayed.replayJournal(PATH);
+		compareGroups(checker, written, replayed, "replayed");
+		for (StockId id = 0; id < STOCKS; ++id)
+		{
+			checker.expect(written.accessStock(id).accessTradeRecord().getSnapshot().lastPrice
+				== replayed.accessStock(id).accessTradeRecord().getSnapshot().lastPrice,
+				"stock " + std::to_string(id) + " last price");
+		}
+		std::remove(PATH);
+		return checker.finish();
+	}
+
+	// Subscribes to a stock's windowed price and the All Share Index while the oldest
+	// trade in the window is about to leave it, then adds nothing more, and checks that
+	// both subscriptions are told of the new values once it has left, by the system clock.
+	//
+	bool checkSubscriptionExpiry()
+	{
+		Checker checker("subscriptionExpiry");
+		StockGroup stocks;
+		stocks.addStock(StockSymbol("TEA"), COMMON_STOCK, 0.0, 100.0);
+		stocks.addStock(StockSymbol("POP"), COMMON_STOCK, 8.0, 100.0);
+		const TimeStamp now = SystemClock::getInstance().now();
+		const auto leaving = now - TradeRecord::DEFAULT_WINDOW + std::chrono::milliseconds(200);
+		stocks.addTrade(0, 10, BUY_TYPE, 100.0, leaving);
+		stocks.addTrade(0, 10, BUY_TYPE, 200.0, now);
+		stocks.addTrade(1, 10, BUY_TYPE, 50.0, now);
+
+		std::mutex mutex;
+		double price = 0.0;
+		double index = 0.0;
+		stocks.subscribe(VOLUME_WEIGHTED_STOCK_PRICE, 0, 0.0, [&](const ValueChange* changes, std::size_t count)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			price = changes[count - 1].value;
+		});
+		stocks.subscribe(ALL_SHARE_INDEX, EVERY_STOCK, 0.0, [&](const ValueChange* changes, std::size_t count)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			index = changes[count - 1].value;
+		});
+
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		bool delivered = false;
+		while (!delivered && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			std::lock_guard<std::mutex> lock(mutex);
+			delivered = 200.0 == price && 0.0 != index;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		checker.expectNear(price, 200.0, 1e-12, "windowed price once the oldest trade left");
+		checker.expectNear(index, std::sqrt(200.0 * 50.0), 1e-12, "index once the oldest trade left");
+		return checker.finish();
+	}
+
+	// Runs loops in which some tasks throw on pools of one thread and of several, and
+	// checks that every other task still runs and the first exception is rethrown
+	//
+	bool checkWorkerPoolFailures()
+	{
+		Checker checker("workerPoolFailures");
+		const std::size_t TASKS = 50;
+		for (std::size_t threads : { 1, 4 })
+		{
+			WorkerPool pool(threads);
+			std::vector<std::atomic<int>> ran(TASKS);
+			for (auto& count : ran)
+			{
+				count.store(0);
+			}
+			std::string thrown;
+			try
+			{
+				pool.run(TASKS, [&ran](std::size_t t)
+				{
+					++ran[t];
+					if (0 == t % 7)
+					{
+						throw std::runtime_error("task " + std::to_string(t));
+					}
+				});
+			}
+			catch (std::runtime_error& exception)
+			{
+				thrown = exception.what();
+			}
+			const std::string context = std::to_string(threads) + " threads";
+			checker.expect(!thrown.empty(), context + " rethrew nothing");
+			checker.expect(1 == threads ? "task 0" == thrown : 0 == thrown.find("task "), context + " rethrew '" + thrown + "'");
+			checker.expect(std::all_of(ran.begin(), ran.end(), [](const std::atomic<int>& count) { return 1 == count.load(); }),
+				context + " did not run every task once");
+		}
+		return checker.finish();
+	}
+}
+
+int main()
+{
+	try
+	{
+		int failures = 0;
+		failures += checkWindowedAllShareIndex() ? 0 : 1;
+		failures += checkConcurrentQueries() ? 0 : 1;
+		failures += checkRangeSums() ? 0 : 1;
+		failures += checkTickSums() ? 0 : 1;
+		failures += checkBarSummaries() ? 0 : 1;
+		failures += checkRetentionAge() ? 0 : 1;
+		failures += checkPoolAllocator() ? 0 : 1;
+		failures += checkJournal() ? 0 : 1;
+		failures += checkSnapshot() ? 0 : 1;
+		failures += checkCsvLoader() ? 0 : 1;
+		failures += checkConcurrentJournal() ? 0 : 1;
+		failures += checkSubscriptionExpiry() ? 0 : 1;
+		failures += checkWorkerPoolFailures() ? 0 : 1;
+		return std::min(failures, 255);
+	}
+	catch (std::exception& exception)
+	{
+		std::cerr << exception.what() << "\n";
+		return 255;
+	}
+}
@@ -0,0 +1,93 @@
+#include"stdafx.h"
+#include"Clock.h"
+#include"Exceptions.h"
+#include<stdexcept>
+
+// Returns the SystemClock shared by everything not given a Clock of its own
+//
+SystemClock& SystemClock::getInstance()
+{
+	static SystemClock instance;
+	return instance;
+}
+
+const std::chrono::microseconds CoarseClock::DEFAULT_RESOLUTION(1000);
+
+// Build a CoarseClock reading the system clock every 'resolutionIn' and start its
+// ticker thread. The resolution must be positive or an invalid_argument is thrown.
+//
+CoarseClock::CoarseClock(std::chrono::microseconds resolutionIn) :
+	ticks(std::chrono::system_clock::now().time_since_epoch().count()),
+	resolution(resolutionIn),
+	stopping(false)
+{
+	if (resolution <= std::chrono::microseconds::zero())
+	{
+		throw std::invalid_argument("CoarseClock::CoarseClock:\tresolutionIn must be positive.");
+	}
+	ticker = std::thread(&CoarseClock::tick, this);
+}
+
+// Stops and joins the ticker thread
+//
+CoarseClock::~CoarseClock()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	stopRequested.notify_one();
+	ticker.join();
+}
+
+// Internal utility; the ticker thread's loop, taking a reading every resolution
+// until stopping is set
+//
+void CoarseClock::tick()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopRequested.wait_for(lock, resolution, [this] { return stopping; }))
+	{
+		const TimeStamp::rep reading = std::chrono::system_clock::now().time_since_epoch().count();
+		if (reading > ticks.load(std::memory_order_relaxed))
+		{
+			ticks.store(reading, std::memory_order_relaxed);
+		}
+	}
+}
+
+// Build a VirtualClock starting at startIn
+//
+VirtualClock::VirtualClock(TimeStamp startIn) :
+	ticks(startIn.time_since_epoch().count())
+{
+	// done //
+}
+
+// Moves the clock to timeStamp. Time only moves forwards: an InvalidTimeError is
+// thrown if timeStamp is before the present moment of this clock.
+//
+void VirtualClock::setTime(TimeStamp timeStamp)
+{
+	const TimeStamp::rep target = timeStamp.time_since_epoch().count();
+	TimeStamp::rep present = ticks.load(std::memory_order_relaxed);
+	do
+	{
+		if (target < present)
+		{
+			throw InvalidTimeError("VirtualClock::setTime:\ttime cannot move backwards.");
+		}
+	} while (!ticks.compare_exchange_weak(present, target, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// Moves the clock forwards by 'duration', which must not be negative or an
+// invalid_argument is thrown.
+//
+void VirtualClock::advance(TimeStamp::duration duration)
+{
+	if (duration < TimeStamp::duration::zero())
+	{
+		throw std::invalid_argument("VirtualClock::advance:\tduration cannot be negative.");
+	}
+	ticks.fetch_add(duration.count(), std::memory_order_release);
+}
@@ -0,0 +1,136 @@
+/*
+* Clock.h
+*
+*	A Clock tells TradeRecords and StockGroups what time it is now: when trades given
+*	no time stamp took place, and where the windows of recent trades end.
+*
+*	SystemClock reads the system clock on every call.
+*	CoarseClock reads the system clock on a ticker thread of its own, once per
+*	resolution, so that asking it the time is only a load of the latest reading.
+*	VirtualClock only moves when told to, so that history can be replayed through
+*	a StockGroup as though it were happening now.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_CLOCK
+#define SUPERSIMPLESTOCKS_CLOCK
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<mutex>
+#include<thread>
+
+typedef std::chrono::time_point<std::chrono::system_clock> TimeStamp;
+
+class Clock
+{
+public:
+
+	virtual ~Clock()
+	{
+		// done //
+	}
+
+	// Returns the present moment according to this clock
+	//
+	virtual TimeStamp now()const = 0;
+};
+
+class SystemClock : public Clock
+{
+public:
+
+	// Returns the SystemClock shared by everything not given a Clock of its own
+	//
+	static SystemClock& getInstance();
+
+	TimeStamp now()const override
+	{
+		return std::chrono::system_clock::now();
+	}
+};
+
+class CoarseClock : public Clock
+{
+	// The latest reading, in ticks of the system clock since its epoch. Readings never
+	// go backwards, even if the system clock is set back.
+	//
+	std::atomic<TimeStamp::rep> ticks;
+
+	std::chrono::microseconds resolution;
+
+	// Guards stopping, which tells the ticker thread to finish
+	//
+	std::mutex mutex;
+	std::condition_variable stopRequested;
+	bool stopping;
+
+	std::thread ticker;
+
+	CoarseClock(const CoarseClock&) = delete;
+	CoarseClock& operator=(const CoarseClock&) = delete;
+
+	// Internal utility; the ticker thread's loop, taking a reading every resolution
+	// until stopping is set
+	//
+	void tick();
+
+public:
+
+	static const std::chrono::microseconds DEFAULT_RESOLUTION;
+
+	// Build a CoarseClock reading the system clock every 'resolutionIn' and start its
+	// ticker thread. The resolution must be positive or an invalid_argument is thrown.
+	//
+	explicit CoarseClock(std::chrono::microseconds resolutionIn = DEFAULT_RESOLUTION);
+
+	// Stops and joins the ticker thread
+	//
+	~CoarseClock();
+
+	// Returns the latest reading, which is at most about one resolution behind the system clock
+	//
+	TimeStamp now()const override
+	{
+		return TimeStamp(TimeStamp::duration(ticks.load(std::memory_order_relaxed)));
+	}
+
+	// Returns how often the system clock is read
+	//
+	std::chrono::microseconds getResolution()const
+	{
+		return resolution;
+	}
+};
+
+class VirtualClock : public Clock
+{
+	// The present moment, in ticks of the system clock since its epoch
+	//
+	std::atomic<TimeStamp::rep> ticks;
+
+	VirtualClock(const VirtualClock&) = delete;
+	VirtualClock& operator=(const VirtualClock&) = delete;
+
+public:
+
+	// Build a VirtualClock starting at startIn
+	//
+	explicit VirtualClock(TimeStamp startIn = TimeStamp());
+
+	TimeStamp now()const override
+	{
+		return TimeStamp(TimeStamp::duration(ticks.load(std::memory_order_acquire)));
+	}
+
+	// Moves the clock to timeStamp. Time only moves forwards: an InvalidTimeError is
+	// thrown if timeStamp is before the present moment of this clock.
+	//
+	void setTime(TimeStamp timeStamp);
+
+	// Moves the clock forwards by 'duration', which must not be negative or an
+	// invalid_argument is thrown.
+	//
+	void advance(TimeStamp::duration duration);
+};
+
+#endif
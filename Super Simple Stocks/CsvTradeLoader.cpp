@@ -0,0 +1,341 @@
+#include"stdafx.h"
+#include"CsvTradeLoader.h"
+#include"MappedFile.h"
+#include<cstdint>
+#include<cstdlib>
+#include<cstring>
+#include<limits>
+#include<stdexcept>
+
+namespace
+{
+	// Returns the range with spaces and tabs removed from both ends
+	//
+	void trim(const char*& begin, const char*& end)
+	{
+		while (begin < end && (' ' == *begin || '\t' == *begin))
+		{
+			++begin;
+		}
+		while (end > begin && (' ' == end[-1] || '\t' == end[-1] || '\r' == end[-1]))
+		{
+			--end;
+		}
+	}
+
+	bool isDigit(char character)
+	{
+		return character >= '0' && character <= '9';
+	}
+
+	// Parses a run of digits into 'value', advancing 'begin' past them. Returns false if
+	// there are no digits or the value overflows.
+	//
+	bool parseDigits(const char*& begin, const char* end, std::uint64_t& value, std::size_t& digitCount)
+	{
+		value = 0;
+		digitCount = 0;
+		for (; begin < end && isDigit(*begin); ++begin, ++digitCount)
+		{
+			const unsigned digit = *begin - '0';
+			if (value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10)
+			{
+				return false;
+			}
+			value = value * 10 + digit;
+		}
+		return digitCount > 0;
+	}
+
+	// Parses the whole range as an unsigned integer no greater than 'maximum'
+	//
+	bool parseUnsigned(const char* begin, const char* end, std::uint64_t maximum, std::uint64_t& value)
+	{
+		std::size_t digitCount;
+		return parseDigits(begin, end, value, digitCount) && begin == end && value <= maximum;
+	}
+
+	// Parses the whole range as a non-negative decimal such as 123.45. Up to fifteen
+	// significant digits are converted exactly, as an integer divided by a power of ten;
+	// longer numbers fall back to strtod.
+	//
+	bool parseDecimal(const char* begin, const char* end, double& value)
+	{
+		static const double POWERS_OF_TEN[] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		static const std::uint64_t MAX_EXACT_MANTISSA = 1ull << 53;
+
+		const char* position = begin;
+		std::uint64_t mantissa = 0;
+		std::size_t integerDigits = 0;
+		std::size_t fractionDigits = 0;
+		bool exact = true;
+		for (; position < end && isDigit(*position); ++position, ++integerDigits)
+		{
+			exact = exact && mantissa < MAX_EXACT_MANTISSA / 10;
+			mantissa = mantissa * 10 + (*position - '0');
+		}
+		if (position < end && '.' == *position)
+		{
+			for (++position; position < end && isDigit(*position); ++position, ++fractionDigits)
+			{
+				exact = exact && mantissa < MAX_EXACT_MANTISSA / 10;
+				mantissa = mantissa * 10 + (*position - '0');
+			}
+		}
+		if (position != end || 0 == integerDigits + fractionDigits)
+		{
+			return false;
+		}
+		if (exact && fractionDigits < sizeof(POWERS_OF_TEN) / sizeof(POWERS_OF_TEN[0]))
+		{
+			value = mantissa / POWERS_OF_TEN[fractionDigits];
+			return true;
+		}
+
+		char buffer[64];
+		const std::size_t length = end - begin;
+		if (length >= sizeof(buffer))
+		{
+			return false;
+		}
+		std::memcpy(buffer, begin, length);
+		buffer[length] = '\0';
+		value = std::strtod(buffer, nullptr);
+		return true;
+	}
+
+	// Parses the whole range as seconds since the epoch with an optional fraction, to
+	// the nearest nanosecond: the tenth digit of the fraction rounds, and any digits
+	// after it are ignored
+	//
+	bool parseTimeStamp(const char* begin, const char* end, TimeStamp& timeStamp)
+	{
+		static const std::uint64_t MAX_SECONDS = std::numeric_limits<std::int64_t>::max() / 1000000000 - 1;
+
+		std::uint64_t seconds;
+		std::size_t digitCount;
+		if (!parseDigits(begin, end, seconds, digitCount) || seconds > MAX_SECONDS)
+		{
+			return false;
+		}
+		std::uint64_t nanoseconds = 0;
+		if (begin < end && '.' == *begin)
+		{
+			std::uint64_t scale = 100000000;
+			std::size_t fractionDigits = 0;
+			for (++begin; begin < end && isDigit(*begin); ++begin)
+			{
+				if (++fractionDigits <= 9)
+				{
+					nanoseconds += (*begin - '0') * scale;
+					scale /= 10;
+				}
+				else if (10 == fractionDigits && *begin >= '5')
+				{
+					// rounds on the tenth digit; a fraction rounding up to a whole
+					// second is carried into the seconds by the sum below
+					++nanoseconds;
+				}
+			}
+		}
+		if (begin != end)
+		{
+			return false;
+		}
+		const std::chrono::nanoseconds sinceEpoch(static_cast<std::int64_t>(seconds * 1000000000 + nanoseconds));
+		timeStamp = TimeStamp(std::chrono::duration_cast<std::chrono::system_clock::duration>(sinceEpoch));
+		return true;
+	}
+
+	// Returns the start of the next field and sets 'fieldEnd' to the end of this one
+	//
+	const char* nextField(const char* begin, const char* end, const char*& fieldEnd)
+	{
+		const char* comma = static_cast<const char*>(std::memchr(begin, ',', end - begin));
+		fieldEnd = (nullptr == comma) ? end : comma;
+		return (nullptr == comma) ? end : comma + 1;
+	}
+}
+
+// Build a loader adding trades to groupIn, 'batchSizeIn' trades at a time.
+// The batch size must be positive or an invalid_argument is thrown.
+//
+CsvTradeLoader::CsvTradeLoader(StockGroup& groupIn, std::size_t batchSizeIn) :
+	group(groupIn),
+	batchSize(batchSizeIn),
+	lastSymbol(nullptr),
+	lastSymbolLength(0),
+	lastStockId(0),
+	tradesLoaded(0),
+	unknownSymbolRows(0)
+{
+	if (0 == batchSize)
+	{
+		throw std::invalid_argument("CsvTradeLoader::CsvTradeLoader:\tbatchSizeIn must be positive.");
+	}
+}
+
+// Build a loader resolving symbols through groupIn but passing each batch of trades
+// to batchHandlerIn(stockTrades, count) rather than adding them to the group.
+// The batch size must be positive or an invalid_argument is thrown.
+//
+CsvTradeLoader::CsvTradeLoader(StockGroup& groupIn,
+	const std::function<void(const StockTrade*, std::size_t)>& batchHandlerIn,
+	std::size_t batchSizeIn) :
+	CsvTradeLoader(groupIn, batchSizeIn)
+{
+	batchHandler = batchHandlerIn;
+}
+
+// Loads every trade in the file at 'path', returning the number of trades loaded.
+// Rows naming stocks not in the group are skipped and counted.
+// Throws a runtime_error if the file cannot be read or a row is malformed, naming
+// the line; trades from earlier batches will already have been added.
+//
+std::size_t CsvTradeLoader::loadFile(const std::string& path)
+{
+	const MappedFile file(path);
+	return loadBuffer(reinterpret_cast<const char*>(file.getData()), file.getSize());
+}
+
+// Loads every trade in the 'size' characters at 'data', as for loadFile
+//
+std::size_t CsvTradeLoader::loadBuffer(const char* data, std::size_t size)
+{
+	const std::size_t loadedBefore = tradesLoaded;
+	const char* const end = data + size;
+	const char* lineBegin = data;
+	std::size_t lineNumber = 0;
+	bool firstLine = true;
+	batch.reserve(batchSize);
+	lastSymbol = nullptr;
+
+	try
+	{
+		while (lineBegin < end)
+		{
+			const char* newline = static_cast<const char*>(std::memchr(lineBegin, '\n', end - lineBegin));
+			const char* lineEnd = (nullptr == newline) ? end : newline;
+			++lineNumber;
+
+			const char* contentBegin = lineBegin;
+			const char* contentEnd = lineEnd;
+			trim(contentBegin, contentEnd);
+			if (contentBegin < contentEnd)
+			{
+				// a header line is one whose quantity field does not start with a digit
+				const char* symbolEnd;
+				const char* quantityBegin = nextField(contentBegin, contentEnd, symbolEnd);
+				while (quantityBegin < contentEnd && ' ' == *quantityBegin)
+				{
+					++quantityBegin;
+				}
+				const bool header = firstLine && (quantityBegin == contentEnd || !isDigit(*quantityBegin));
+				firstLine = false;
+				if (!header)
+				{
+					if (parseLine(contentBegin, contentEnd, lineNumber))
+					{
+						if (batch.size() >= batchSize)
+						{
+							flushBatch();
+						}
+					}
+					else
+					{
+						++unknownSymbolRows;
+					}
+				}
+			}
+			lineBegin = lineEnd + 1;
+		}
+		flushBatch();
+	}
+	catch (...)
+	{
+		batch.clear();
+		lastSymbol = nullptr;
+		throw;
+	}
+	lastSymbol = nullptr;
+	return tradesLoaded - loadedBefore;
+}
+
+// Internal utility; parses one line, adding its trade to the batch. Returns false,
+// adding nothing, if the line names a stock not in the group.
+// Throws a runtime_error if the line is malformed.
+//
+bool CsvTradeLoader::parseLine(const char* begin, const char* end, std::size_t lineNumber)
+{
+	const char* fields[5][2];
+	const char* position = begin;
+	for (int t = 0; t < 5; ++t)
+	{
+		if (position == end && t > 0)
+		{
+			throw std::runtime_error("CsvTradeLoader::parseLine:\tline " + std::to_string(lineNumber) + " has too few fields.");
+		}
+		fields[t][0] = position;
+		position = nextField(position, end, fields[t][1]);
+		trim(fields[t][0], fields[t][1]);
+	}
+	if (position != end || ',' == end[-1])
+	{
+		throw std::runtime_error("CsvTradeLoader::parseLine:\tline " + std::to_string(lineNumber) + " has too many fields.");
+	}
+
+	const char* symbol = fields[0][0];
+	const std::size_t symbolLength = fields[0][1] - fields[0][0];
+	if (nullptr == lastSymbol || symbolLength != lastSymbolLength || 0 != std::memcmp(symbol, lastSymbol, symbolLength))
+	{
+		StockId id;
+		if (!group.findStockId(symbol, symbolLength, id))
+		{
+			return false;
+		}
+		lastSymbol = symbol;
+		lastSymbolLength = symbolLength;
+		lastStockId = id;
+	}
+
+	std::uint64_t quantity;
+	double price;
+	TimeStamp timeStamp;
+	const char side = (fields[2][0] < fields[2][1]) ? *fields[2][0] : '\0';
+	if (!parseUnsigned(fields[1][0], fields[1][1], std::numeric_limits<unsigned int>::max(), quantity)
+		|| 0 == quantity
+		|| !('B' == side || 'b' == side || 'S' == side || 's' == side)
+		|| !parseDecimal(fields[3][0], fields[3][1], price)
+		|| !parseTimeStamp(fields[4][0], fields[4][1], timeStamp))
+	{
+		throw std::runtime_error("CsvTradeLoader::parseLine:\tline " + std::to_string(lineNumber) + " is malformed.");
+	}
+
+	const BuyOrSellType buyOrSellType = ('B' == side || 'b' == side) ? BUY_TYPE : SELL_TYPE;
+	const StockTrade stockTrade = { lastStockId, Trade(static_cast<unsigned int>(quantity), buyOrSellType, price, timeStamp) };
+	batch.push_back(stockTrade);
+	return true;
+}
+
+// Internal utility; passes the batch to the batch handler, or else the group, and empties it
+//
+void CsvTradeLoader::flushBatch()
+{
+	if (!batch.empty())
+	{
+		if (batchHandler)
+		{
+			batchHandler(batch.data(), batch.size());
+		}
+		else
+		{
+			group.addTrades(batch.data(), batch.size());
+		}
+		tradesLoaded += batch.size();
+		batch.clear();
+	}
+}
@@ -0,0 +1,107 @@
+/*
+* CsvTradeLoader.h
+*
+*	A CsvTradeLoader bulk loads historical trades from comma separated text into a
+*	StockGroup. Each line holds one trade:
+*
+*		symbol,quantity,side,price,timeStamp
+*
+*	side is B or S (or any word starting with one of those letters, such as Buy or
+*	Sell), price is a plain decimal such as 123.45, and timeStamp is seconds since the
+*	epoch of the system clock with an optional fraction, such as 1457000000.250.
+*	Spaces around fields, blank lines, a header line and Windows line endings are
+*	allowed; quoted fields are not.
+*	Files are mapped into memory and parsed in place: symbols are resolved to StockIds
+*	straight from the text and numbers are parsed by hand, so no string is built for
+*	any row. Parsed trades are gathered into batches for StockGroup::addTrades, or for
+*	a batch handler given in the group's place.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_CSV_TRADE_LOADER
+#define SUPERSIMPLESTOCKS_CSV_TRADE_LOADER
+#include"StockGroup.h"
+#include<cstddef>
+#include<functional>
+#include<string>
+#include<vector>
+
+class CsvTradeLoader
+{
+	StockGroup& group;
+
+	// Trades parsed but not yet passed to the group
+	//
+	std::vector<StockTrade> batch;
+	std::size_t batchSize;
+
+	// Called with each batch in place of StockGroup::addTrades, if set
+	//
+	std::function<void(const StockTrade*, std::size_t)> batchHandler;
+
+	// The symbol of the previous row and its id, so runs of rows for one stock need
+	// only compare characters rather than look the symbol up
+	//
+	const char* lastSymbol;
+	std::size_t lastSymbolLength;
+	StockId lastStockId;
+
+	std::size_t tradesLoaded;
+	std::size_t unknownSymbolRows;
+
+	CsvTradeLoader(const CsvTradeLoader&) = delete;
+	CsvTradeLoader& operator=(const CsvTradeLoader&) = delete;
+
+	// Internal utility; parses one line, adding its trade to the batch. Returns false,
+	// adding nothing, if the line names a stock not in the group.
+	// Throws a runtime_error if the line is malformed.
+	//
+	bool parseLine(const char* begin, const char* end, std::size_t lineNumber);
+
+	// Internal utility; passes the batch to the batch handler, or else the group, and empties it
+	//
+	void flushBatch();
+
+public:
+
+	static const std::size_t DEFAULT_BATCH_SIZE = 65536;
+
+	// Build a loader adding trades to groupIn, 'batchSizeIn' trades at a time.
+	// The batch size must be positive or an invalid_argument is thrown.
+	//
+	explicit CsvTradeLoader(StockGroup& groupIn, std::size_t batchSizeIn = DEFAULT_BATCH_SIZE);
+
+	// Build a loader resolving symbols through groupIn but passing each batch of trades
+	// to batchHandlerIn(stockTrades, count) rather than adding them to the group.
+	// The batch size must be positive or an invalid_argument is thrown.
+	//
+	CsvTradeLoader(StockGroup& groupIn,
+		const std::function<void(const StockTrade*, std::size_t)>& batchHandlerIn,
+		std::size_t batchSizeIn = DEFAULT_BATCH_SIZE);
+
+	// Loads every trade in the file at 'path', returning the number of trades loaded.
+	// Rows naming stocks not in the group are skipped and counted.
+	// Throws a runtime_error if the file cannot be read or a row is malformed, naming
+	// the line; trades from earlier batches will already have been added.
+	//
+	std::size_t loadFile(const std::string& path);
+
+	// Loads every trade in the 'size' characters at 'data', as for loadFile
+	//
+	std::size_t loadBuffer(const char* data, std::size_t size);
+
+	// Returns the number of trades loaded so far, including those passed to a batch handler
+	//
+	std::size_t getTradesLoaded()const
+	{
+		return tradesLoaded;
+	}
+
+	// Returns the number of rows skipped so far because their stock is not in the group
+	//
+	std::size_t getUnknownSymbolRows()const
+	{
+		return unknownSymbolRows;
+	}
+};
+
+#endif
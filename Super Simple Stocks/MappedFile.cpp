@@ -0,0 +1,175 @@
+#include"stdafx.h"
+#include"MappedFile.h"
+#include<stdexcept>
+#ifdef _WIN32
+#include<io.h>
+#include<windows.h>
+#else
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#endif
+
+#ifdef _WIN32
+
+// Maps the file at 'path' into memory.
+// Throws a runtime_error if the file cannot be opened or mapped.
+//
+MappedFile::MappedFile(const std::string& path) :
+	data(nullptr),
+	size(0),
+	fileHandle(INVALID_HANDLE_VALUE),
+	mappingHandle(nullptr)
+{
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == fileHandle)
+	{
+		throw std::runtime_error("MappedFile::MappedFile:\tcould not open " + path + ".");
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize))
+	{
+		close();
+		throw std::runtime_error("MappedFile::MappedFile:\tcould not read the size of " + path + ".");
+	}
+	size = static_cast<std::size_t>(fileSize.QuadPart);
+	if (0 == size)
+	{
+		return;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (nullptr != mappingHandle)
+	{
+		data = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (nullptr == data)
+	{
+		close();
+		throw std::runtime_error("MappedFile::MappedFile:\tcould not map " + path + ".");
+	}
+}
+
+// Internal utility; releases the mapping and the file
+//
+void MappedFile::close()
+{
+	if (nullptr != data)
+	{
+		UnmapViewOfFile(data);
+		data = nullptr;
+	}
+	if (nullptr != mappingHandle)
+	{
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+	}
+	if (INVALID_HANDLE_VALUE != fileHandle)
+	{
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+}
+
+#else
+
+// Maps the file at 'path' into memory.
+// Throws a runtime_error if the file cannot be opened or mapped.
+//
+MappedFile::MappedFile(const std::string& path) :
+	data(nullptr),
+	size(0),
+	fileDescriptor(-1)
+{
+	fileDescriptor = open(path.c_str(), O_RDONLY);
+	if (-1 == fileDescriptor)
+	{
+		throw std::runtime_error("MappedFile::MappedFile:\tcould not open " + path + ".");
+	}
+	struct stat status;
+	if (0 != fstat(fileDescriptor, &status))
+	{
+		close();
+		throw std::runtime_error("MappedFile::MappedFile:\tcould not read the size of " + path + ".");
+	}
+	size = static_cast<std::size_t>(status.st_size);
+	if (0 == size)
+	{
+		return;
+	}
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	if (MAP_FAILED == mapping)
+	{
+		close();
+		throw std::runtime_error("MappedFile::MappedFile:\tcould not map " + path + ".");
+	}
+	data = static_cast<const unsigned char*>(mapping);
+}
+
+// Internal utility; releases the mapping and the file
+//
+void MappedFile::close()
+{
+	if (nullptr != data)
+	{
+		munmap(const_cast<unsigned char*>(data), size);
+		data = nullptr;
+	}
+	if (-1 != fileDescriptor)
+	{
+		::close(fileDescriptor);
+		fileDescriptor = -1;
+	}
+}
+
+#endif
+
+//
+//
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+// Flushes the file's buffers and asks the operating system to put its contents on disk.
+// Returns false if either fails.
+//
+bool syncFile(std::FILE* file)
+{
+	if (0 != std::fflush(file))
+	{
+		return false;
+	}
+#ifdef _WIN32
+	return 0 == _commit(_fileno(file));
+#else
+	return 0 == fsync(fileno(file));
+#endif
+}
+
+// Replaces the file at 'path', if any, with the file at 'from' in one step, so that
+// 'path' names either the old file or the new whenever it is opened, then puts the
+// change on disk. Returns false if the file could not be replaced.
+//
+bool replaceFile(const std::string& from, const std::string& path)
+{
+#ifdef _WIN32
+	return 0 != MoveFileExA(from.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	if (0 != std::rename(from.c_str(), path.c_str()))
+	{
+		return false;
+	}
+	// the new name is on disk once the directory holding it is
+	const std::size_t slash = path.find_last_of('/');
+	const std::string directory = (std::string::npos == slash) ? "." : path.substr(0, slash + 1);
+	const int descriptor = open(directory.c_str(), O_RDONLY);
+	if (descriptor < 0)
+	{
+		return false;
+	}
+	const bool synced = 0 == fsync(descriptor);
+	::close(descriptor);
+	return synced;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+* MappedFile.h
+*
+*	A MappedFile maps the whole of a file into memory, read only, for as long as the
+*	MappedFile exists. Its contents can then be read in place, with pages loaded by
+*	the operating system as they are touched, rather than copied through a buffer.
+*	Alongside it are the helpers files written for durability share, so that the
+*	platform calls for putting them on disk live in one place.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_MAPPED_FILE
+#define SUPERSIMPLESTOCKS_MAPPED_FILE
+#include<cstddef>
+#include<cstdio>
+#include<string>
+
+class MappedFile
+{
+	const unsigned char* data;
+	std::size_t size;
+
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fileDescriptor;
+#endif
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Internal utility; releases the mapping and the file
+	//
+	void close();
+
+public:
+
+	// Maps the file at 'path' into memory.
+	// Throws a runtime_error if the file cannot be opened or mapped.
+	//
+	explicit MappedFile(const std::string& path);
+
+	~MappedFile();
+
+	// Returns the start of the file's contents, which is aligned to at least a page,
+	// or nullptr if the file is empty
+	//
+	const unsigned char* getData()const
+	{
+		return data;
+	}
+
+	// Returns the size of the file in bytes
+	//
+	std::size_t getSize()const
+	{
+		return size;
+	}
+};
+
+// Flushes the file's buffers and asks the operating system to put its contents on disk.
+// Returns false if either fails.
+//
+bool syncFile(std::FILE* file);
+
+// Replaces the file at 'path', if any, with the file at 'from' in one step, so that
+// 'path' names either the old file or the new whenever it is opened, then puts the
+// change on disk. Returns false if the file could not be replaced.
+//
+bool replaceFile(const std::string& from, const std::string& path);
+
+#endif
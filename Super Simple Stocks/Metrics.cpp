@@ -0,0 +1,386 @@
+#include"stdafx.h"
+#include"Metrics.h"
+#include<algorithm>
+#include<cmath>
+#include<iomanip>
+#include<limits>
+#include<ostream>
+#include<stdexcept>
+#ifdef SUPERSIMPLESTOCKS_METRICS
+#include<atomic>
+#include<memory>
+#include<mutex>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include<intrin.h>
+#endif
+
+namespace
+{
+	const std::size_t SUB_BUCKET_BITS = 5;
+
+	// Returns the index of the highest bit set in value, which must not be zero
+	//
+	unsigned highestBit(std::uint64_t value)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return index;
+#elif defined(__GNUC__)
+		return 63 - __builtin_clzll(value);
+#else
+		unsigned index = 0;
+		while (value >>= 1)
+		{
+			++index;
+		}
+		return index;
+#endif
+	}
+
+	const char* const HISTOGRAM_NAMES[HISTOGRAM_METRIC_COUNT] =
+	{
+		"addTrade (ns)",
+		"accessStock (ns)",
+		"VWSP query (ns)",
+		"calculateAllShareIndexWithin (ns)",
+		"trades scanned per VWSP query"
+	};
+
+	const char* const COUNTER_NAMES[COUNTER_METRIC_COUNT] =
+	{
+		"trades ingested",
+		"trades scanned",
+		"trade bytes held",
+		"index stocks recomputed"
+	};
+}
+
+// Returns the bucket 'value' is recorded in
+//
+std::size_t Metrics::getBucket(std::uint64_t value)
+{
+	if (value < SUB_BUCKET_COUNT)
+	{
+		return static_cast<std::size_t>(value);
+	}
+	const unsigned shift = highestBit(value) - SUB_BUCKET_BITS;
+	return SUB_BUCKET_COUNT * (shift + 1) + static_cast<std::size_t>(value >> shift) - SUB_BUCKET_COUNT;
+}
+
+// Returns the lowest and highest values recorded in the given bucket
+//
+std::uint64_t Metrics::getBucketLowest(std::size_t bucket)
+{
+	if (bucket < SUB_BUCKET_COUNT)
+	{
+		return bucket;
+	}
+	const std::size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+	return static_cast<std::uint64_t>(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+}
+
+std::uint64_t Metrics::getBucketHighest(std::size_t bucket)
+{
+	if (bucket < SUB_BUCKET_COUNT)
+	{
+		return bucket;
+	}
+	const std::size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+	return getBucketLowest(bucket) + ((static_cast<std::uint64_t>(1) << shift) - 1);
+}
+
+// Returns the name of a histogram or counter, as used by printTo
+//
+const char* Metrics::getName(HistogramMetric histogram)
+{
+	return HISTOGRAM_NAMES[histogram];
+}
+
+const char* Metrics::getName(CounterMetric counter)
+{
+	return COUNTER_NAMES[counter];
+}
+
+// Returns the mean of the values recorded, or 0.0 if there are none
+//
+double HistogramSnapshot::getMean()const
+{
+	if (0 == count)
+	{
+		return 0.0;
+	}
+	return static_cast<double>(sum) / count;
+}
+
+// Returns the value which 'percentile' percent of the values recorded are at or
+// below, to within the precision of its bucket, or 0 if there are none.
+// Throws an invalid_argument if percentile is not from 0.0 to 100.0.
+//
+std::uint64_t HistogramSnapshot::getValueAtPercentile(double percentile)const
+{
+	if (!(percentile >= 0.0 && percentile <= 100.0))
+	{
+		throw std::invalid_argument("HistogramSnapshot::getValueAtPercentile:\tpercentile must be from 0.0 to 100.0.");
+	}
+	if (0 == count)
+	{
+		return 0;
+	}
+
+	const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(percentile / 100.0 * count)));
+	std::uint64_t seen = 0;
+	for (std::size_t bucket = 0; bucket < bucketCounts.size(); ++bucket)
+	{
+		seen += bucketCounts[bucket];
+		if (seen >= rank)
+		{
+			return std::max(min, std::min(max, Metrics::getBucketHighest(bucket)));
+		}
+	}
+	return max;
+}
+
+// Outputs every histogram and counter to the given output stream as a text formatted table
+//
+void MetricsSnapshot::printTo(std::ostream& out)const
+{
+	if (!enabled)
+	{
+		out << "\tMetrics were not compiled in; define SUPERSIMPLESTOCKS_METRICS to enable them.\n";
+		return;
+	}
+
+	const std::streamsize precision = out.precision();
+	out << "\tMetrics\n"
+		<< "-------------------------------------------------------------------------------\n"
+		<< std::left << std::setw(36) << "histogram" << std::right
+		<< std::setw(10) << "count" << std::setw(11) << "mean"
+		<< std::setw(8) << "p50" << std::setw(8) << "p99" << std::setw(10) << "p99.9" << std::setw(12) << "max" << '\n';
+	for (std::size_t h = 0; h < HISTOGRAM_METRIC_COUNT; ++h)
+	{
+		const HistogramSnapshot& histogram = histograms[h];
+		out << std::left << std::setw(36) << Metrics::getName(static_cast<HistogramMetric>(h)) << std::right
+			<< std::setw(10) << histogram.count
+			<< std::setw(11) << std::fixed << std::setprecision(1) << histogram.getMean() << std::defaultfloat
+			<< std::setw(8) << histogram.getValueAtPercentile(50.0)
+			<< std::setw(8) << histogram.getValueAtPercentile(99.0)
+			<< std::setw(10) << histogram.getValueAtPercentile(99.9)
+			<< std::setw(12) << histogram.max << '\n';
+	}
+	out << '\n';
+	for (std::size_t c = 0; c < COUNTER_METRIC_COUNT; ++c)
+	{
+		out << std::left << std::setw(36) << Metrics::getName(static_cast<CounterMetric>(c)) << std::right
+			<< std::setw(10) << counters[c] << '\n';
+	}
+	out.precision(precision);
+}
+
+#ifdef SUPERSIMPLESTOCKS_METRICS
+
+namespace
+{
+	// The histograms and counters recorded by one thread. Only that thread writes
+	// them, so each update is a relaxed load and store rather than a locked
+	// read-modify-write; they are atomic only so that snapshots can read them.
+	//
+	struct ThreadMetrics
+	{
+		struct Histogram
+		{
+			std::atomic<std::uint64_t> bucketCounts[Metrics::BUCKET_COUNT];
+			std::atomic<std::uint64_t> sum;
+			std::atomic<std::uint64_t> min;
+			std::atomic<std::uint64_t> max;
+		};
+
+		Histogram histograms[HISTOGRAM_METRIC_COUNT];
+		std::atomic<std::int64_t> counters[COUNTER_METRIC_COUNT];
+
+		ThreadMetrics()
+		{
+			for (auto& histogram : histograms)
+			{
+				for (auto& bucketCount : histogram.bucketCounts)
+				{
+					bucketCount.store(0, std::memory_order_relaxed);
+				}
+				histogram.sum.store(0, std::memory_order_relaxed);
+				histogram.min.store(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+				histogram.max.store(0, std::memory_order_relaxed);
+			}
+			for (auto& counter : counters)
+			{
+				counter.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	template<typename T>
+	void addTo(std::atomic<T>& value, T amount)
+	{
+		value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// Every ThreadMetrics ever handed out. Those of finished threads are kept, so that
+	// their values stay in snapshots, and handed out again to new threads.
+	//
+	class Registry
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadMetrics>> all;
+		std::vector<ThreadMetrics*> unused;
+
+	public:
+
+		ThreadMetrics* acquire()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!unused.empty())
+			{
+				ThreadMetrics* metrics = unused.back();
+				unused.pop_back();
+				return metrics;
+			}
+			all.emplace_back(new ThreadMetrics());
+			return all.back().get();
+		}
+
+		void release(ThreadMetrics* metrics)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			unused.push_back(metrics);
+		}
+
+		template<typename Function>
+		void forEach(Function function)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const auto& metrics : all)
+			{
+				function(*metrics);
+			}
+		}
+	};
+
+	// Never destroyed, so that threads finishing during static destruction can still
+	// release their metrics
+	//
+	Registry& accessRegistry()
+	{
+		static Registry* registry = new Registry;
+		return *registry;
+	}
+
+	// Holds the calling thread's metrics from its first recording until it finishes
+	//
+	struct ThreadMetricsHolder
+	{
+		ThreadMetrics* metrics;
+
+		ThreadMetricsHolder() :
+			metrics(accessRegistry().acquire())
+		{
+			// done //
+		}
+
+		~ThreadMetricsHolder()
+		{
+			accessRegistry().release(metrics);
+		}
+	};
+
+	ThreadMetrics& accessThreadMetrics()
+	{
+		thread_local ThreadMetricsHolder holder;
+		return *holder.metrics;
+	}
+}
+
+// Records 'value' in the calling thread's copy of the given histogram
+//
+void Metrics::record(HistogramMetric histogram, std::uint64_t value)
+{
+	ThreadMetrics::Histogram& threadHistogram = accessThreadMetrics().histograms[histogram];
+	addTo<std::uint64_t>(threadHistogram.bucketCounts[getBucket(value)], 1);
+	addTo(threadHistogram.sum, value);
+	if (value < threadHistogram.min.load(std::memory_order_relaxed))
+	{
+		threadHistogram.min.store(value, std::memory_order_relaxed);
+	}
+	if (value > threadHistogram.max.load(std::memory_order_relaxed))
+	{
+		threadHistogram.max.store(value, std::memory_order_relaxed);
+	}
+}
+
+// Adds 'amount', which may be negative, to the calling thread's copy of the given counter
+//
+void Metrics::count(CounterMetric counter, std::int64_t amount)
+{
+	addTo(accessThreadMetrics().counters[counter], amount);
+}
+
+// Returns the calling thread's copy of the given counter
+//
+std::int64_t Metrics::getThreadCount(CounterMetric counter)
+{
+	return accessThreadMetrics().counters[counter].load(std::memory_order_relaxed);
+}
+
+#endif
+
+// Returns the sum of every thread's histograms and counters so far. Values being
+// recorded at the same time on other threads may or may not be included.
+//
+MetricsSnapshot Metrics::takeSnapshot()
+{
+	MetricsSnapshot snapshot;
+	for (auto& histogram : snapshot.histograms)
+	{
+		histogram.count = 0;
+		histogram.sum = 0;
+		histogram.min = std::numeric_limits<std::uint64_t>::max();
+		histogram.max = 0;
+		histogram.bucketCounts.assign(BUCKET_COUNT, 0);
+	}
+	std::fill(std::begin(snapshot.counters), std::end(snapshot.counters), 0);
+
+#ifdef SUPERSIMPLESTOCKS_METRICS
+	snapshot.enabled = true;
+	accessRegistry().forEach([&](const ThreadMetrics& metrics)
+	{
+		for (std::size_t h = 0; h < HISTOGRAM_METRIC_COUNT; ++h)
+		{
+			const ThreadMetrics::Histogram& threadHistogram = metrics.histograms[h];
+			HistogramSnapshot& histogram = snapshot.histograms[h];
+			for (std::size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+			{
+				const std::uint64_t bucketCount = threadHistogram.bucketCounts[bucket].load(std::memory_order_relaxed);
+				histogram.bucketCounts[bucket] += bucketCount;
+				histogram.count += bucketCount;
+			}
+			histogram.sum += threadHistogram.sum.load(std::memory_order_relaxed);
+			histogram.min = std::min(histogram.min, threadHistogram.min.load(std::memory_order_relaxed));
+			histogram.max = std::max(histogram.max, threadHistogram.max.load(std::memory_order_relaxed));
+		}
+		for (std::size_t c = 0; c < COUNTER_METRIC_COUNT; ++c)
+		{
+			snapshot.counters[c] += metrics.counters[c].load(std::memory_order_relaxed);
+		}
+	});
+#else
+	snapshot.enabled = false;
+#endif
+
+	for (auto& histogram : snapshot.histograms)
+	{
+		if (0 == histogram.count)
+		{
+			histogram.min = 0;
+		}
+	}
+	return snapshot;
+}
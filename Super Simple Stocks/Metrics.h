@@ -0,0 +1,203 @@
+/*
+* Metrics.h
+*
+*	Optional instrumentation of the ingest and query hot paths, for finding out where
+*	time goes in production: how long addTrade, accessStock, Volume Weighted Stock
+*	Price queries and calculateAllShareIndexWithin take, how many trades have been
+*	added, how many trades are walked one by one to maintain and answer the windows,
+*	and how many bytes of trades are held.
+*
+*	Instrumentation is only compiled in when SUPERSIMPLESTOCKS_METRICS is defined for
+*	every file of the build. Otherwise the SUPERSIMPLESTOCKS_METRICS_* macros below
+*	expand to nothing and the hot paths are exactly as they would be without them;
+*	Metrics::takeSnapshot is still available, and returns a snapshot marked disabled.
+*
+*	Each thread records into histograms and counters of its own, so recording never
+*	contends with other threads: each value is a few plain stores. The histograms are
+*	log-linear, in the manner of an HDR histogram: values below 32 are held exactly,
+*	and every power of two above that is split into 32 buckets, so any value is known
+*	to within about 3%. A snapshot adds up every thread's histograms and counters,
+*	including those of threads which have since finished.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_METRICS_H
+#define SUPERSIMPLESTOCKS_METRICS_H
+#include<chrono>
+#include<cstddef>
+#include<cstdint>
+#include<iosfwd>
+#include<vector>
+
+enum HistogramMetric
+{
+	ADD_TRADE_NANOSECONDS = 0,
+	ACCESS_STOCK_NANOSECONDS,
+	VWSP_QUERY_NANOSECONDS,
+	ALL_SHARE_INDEX_WITHIN_NANOSECONDS,
+	TRADES_SCANNED_PER_VWSP_QUERY,
+	HISTOGRAM_METRIC_COUNT
+};
+
+enum CounterMetric
+{
+	TRADES_INGESTED = 0,
+	TRADES_SCANNED,
+	TRADE_BYTES_HELD,
+	INDEX_STOCKS_RECOMPUTED,
+	COUNTER_METRIC_COUNT
+};
+
+// The values recorded in one histogram, over every thread
+//
+struct HistogramSnapshot
+{
+	std::uint64_t count;
+	std::uint64_t sum;
+	std::uint64_t min;
+	std::uint64_t max;
+
+	// bucketCounts[b] is the number of values recorded in bucket b; see Metrics::getBucketLowest
+	//
+	std::vector<std::uint64_t> bucketCounts;
+
+	// Returns the mean of the values recorded, or 0.0 if there are none
+	//
+	double getMean()const;
+
+	// Returns the value which 'percentile' percent of the values recorded are at or
+	// below, to within the precision of its bucket, or 0 if there are none.
+	// Throws an invalid_argument if percentile is not from 0.0 to 100.0.
+	//
+	std::uint64_t getValueAtPercentile(double percentile)const;
+};
+
+struct MetricsSnapshot
+{
+	// False if this build was made without SUPERSIMPLESTOCKS_METRICS, in which case
+	// everything else is zero
+	//
+	bool enabled;
+
+	HistogramSnapshot histograms[HISTOGRAM_METRIC_COUNT];
+	std::int64_t counters[COUNTER_METRIC_COUNT];
+
+	// Outputs every histogram and counter to the given output stream as a text formatted table
+	//
+	void printTo(std::ostream& out)const;
+};
+
+class Metrics
+{
+	Metrics() = delete;
+
+public:
+
+	// Values below SUB_BUCKET_COUNT have a bucket each; each power of two above that
+	// is split into SUB_BUCKET_COUNT buckets.
+	//
+	static const std::size_t SUB_BUCKET_COUNT = 32;
+	static const std::size_t BUCKET_COUNT = SUB_BUCKET_COUNT * 60;
+
+	// Returns the bucket 'value' is recorded in
+	//
+	static std::size_t getBucket(std::uint64_t value);
+
+	// Returns the lowest and highest values recorded in the given bucket
+	//
+	static std::uint64_t getBucketLowest(std::size_t bucket);
+	static std::uint64_t getBucketHighest(std::size_t bucket);
+
+	// Returns the name of a histogram or counter, as used by printTo
+	//
+	static const char* getName(HistogramMetric histogram);
+	static const char* getName(CounterMetric counter);
+
+	// Returns the sum of every thread's histograms and counters so far. Values being
+	// recorded at the same time on other threads may or may not be included.
+	//
+	static MetricsSnapshot takeSnapshot();
+
+#ifdef SUPERSIMPLESTOCKS_METRICS
+
+	// Records 'value' in the calling thread's copy of the given histogram
+	//
+	static void record(HistogramMetric histogram, std::uint64_t value);
+
+	// Adds 'amount', which may be negative, to the calling thread's copy of the given counter
+	//
+	static void count(CounterMetric counter, std::int64_t amount);
+
+	// Returns the calling thread's copy of the given counter
+	//
+	static std::int64_t getThreadCount(CounterMetric counter);
+
+#endif
+};
+
+#ifdef SUPERSIMPLESTOCKS_METRICS
+
+// Records the nanoseconds from its construction to its destruction in a histogram
+//
+class ScopedLatency
+{
+	HistogramMetric histogram;
+	std::chrono::steady_clock::time_point start;
+
+	ScopedLatency(const ScopedLatency&) = delete;
+	ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+public:
+
+	explicit ScopedLatency(HistogramMetric histogramIn) :
+		histogram(histogramIn),
+		start(std::chrono::steady_clock::now())
+	{
+		// done //
+	}
+
+	~ScopedLatency()
+	{
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		Metrics::record(histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+};
+
+// As ScopedLatency, also recording in TRADES_SCANNED_PER_VWSP_QUERY how many trades
+// the calling thread scanned in the meantime
+//
+class ScopedQuery
+{
+	ScopedLatency latency;
+	std::int64_t scannedAtStart;
+
+	ScopedQuery(const ScopedQuery&) = delete;
+	ScopedQuery& operator=(const ScopedQuery&) = delete;
+
+public:
+
+	explicit ScopedQuery(HistogramMetric histogramIn) :
+		latency(histogramIn),
+		scannedAtStart(Metrics::getThreadCount(TRADES_SCANNED))
+	{
+		// done //
+	}
+
+	~ScopedQuery()
+	{
+		Metrics::record(TRADES_SCANNED_PER_VWSP_QUERY, Metrics::getThreadCount(TRADES_SCANNED) - scannedAtStart);
+	}
+};
+
+#define SUPERSIMPLESTOCKS_METRICS_TIME(histogram) const ScopedLatency scopedLatency(histogram)
+#define SUPERSIMPLESTOCKS_METRICS_TIME_QUERY(histogram) const ScopedQuery scopedQuery(histogram)
+#define SUPERSIMPLESTOCKS_METRICS_COUNT(counter, amount) Metrics::count(counter, static_cast<std::int64_t>(amount))
+
+#else
+
+#define SUPERSIMPLESTOCKS_METRICS_TIME(histogram)
+#define SUPERSIMPLESTOCKS_METRICS_TIME_QUERY(histogram)
+#define SUPERSIMPLESTOCKS_METRICS_COUNT(counter, amount)
+
+#endif
+
+#endif
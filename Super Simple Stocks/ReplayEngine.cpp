@@ -0,0 +1,187 @@
+#include"stdafx.h"
+#include"ReplayEngine.h"
+#include"CsvTradeLoader.h"
+#include"TradeJournal.h"
+#include<algorithm>
+#include<cstdint>
+#include<iomanip>
+#include<ostream>
+#include<stdexcept>
+
+// Build a ReplayEngine replaying trades into groupIn, sampling every sampleIntervalIn.
+// clockIn is given to the group, and both must outlive the engine. The group should
+// not be given trades by anything else while a replay is running.
+// The interval must be positive or an invalid_argument is thrown.
+//
+ReplayEngine::ReplayEngine(StockGroup& groupIn, VirtualClock& clockIn, TimeStamp::duration sampleIntervalIn) :
+	group(groupIn),
+	clock(clockIn),
+	sampleInterval(sampleIntervalIn),
+	started(false),
+	stocksPerSample(0),
+	tradesReplayed(0),
+	lateTrades(0)
+{
+	if (sampleInterval <= TimeStamp::duration::zero())
+	{
+		throw std::invalid_argument("ReplayEngine::ReplayEngine:\tsampleIntervalIn must be positive.");
+	}
+	if (&group.getClock() != &clock)
+	{
+		group.setClock(clock);
+	}
+}
+
+// Replays 'count' trades, taking every sample due before the last of them.
+// Trades after the last sample time are held until a later sample or finish.
+//
+void ReplayEngine::replay(const StockTrade* trades, std::size_t count)
+{
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		const TimeStamp timeStamp = trades[t].trade.getTimeStamp();
+		if (!started)
+		{
+			// samples fall on whole multiples of the interval, the first at or after both
+			// the first trade and the clock's present moment
+			const TimeStamp::duration from = std::max(timeStamp, clock.now()).time_since_epoch();
+			TimeStamp::rep intervals = from / sampleInterval;
+			if (intervals * sampleInterval < from)
+			{
+				++intervals;
+			}
+			nextSampleTime = TimeStamp(intervals * sampleInterval);
+			started = true;
+		}
+		while (timeStamp > nextSampleTime)
+		{
+			takeSample();
+		}
+		if (!samples.empty() && timeStamp <= samples.back().time)
+		{
+			++lateTrades;
+		}
+		pending.push_back(trades[t]);
+	}
+}
+
+// Adds any trades still held and takes the sample covering them. Replaying can
+// continue afterwards.
+//
+void ReplayEngine::finish()
+{
+	if (!pending.empty())
+	{
+		takeSample();
+	}
+}
+
+// Internal utility; moves the clock to nextSampleTime, adds the pending trades to the
+// group and takes a sample, then moves nextSampleTime on by one interval.
+//
+void ReplayEngine::takeSample()
+{
+	clock.setTime(nextSampleTime);
+	if (!pending.empty())
+	{
+		group.addTrades(pending.data(), pending.size());
+		tradesReplayed += pending.size();
+		pending.clear();
+	}
+	if (samples.empty())
+	{
+		stocksPerSample = group.getStockCount();
+	}
+
+	ReplaySample sample;
+	sample.time = nextSampleTime;
+	sample.allShareIndex = group.calculateAllShareIndex();
+	sample.tradesReplayed = tradesReplayed;
+
+	const std::chrono::minutes window = group.getIndexWindow();
+	for (StockId id = 0; id < stocksPerSample; ++id)
+	{
+		Stock& stock = group.accessStock(id);
+		ReplayStockSample stockSample;
+		stockSample.volumeWeightedStockPrice = group.calculateVolumeWeightedStockPriceWithin(id, stockSample.foundTrades, window);
+		stockSample.dividendYield = 0.0;
+		stockSample.peRatio = 0.0;
+		if (stockSample.volumeWeightedStockPrice > 0.0)
+		{
+			stockSample.dividendYield = stock.calculateDividendYield(stockSample.volumeWeightedStockPrice);
+			stockSample.peRatio = stock.calculatePERatio(stockSample.volumeWeightedStockPrice);
+		}
+		stockSamples.push_back(stockSample);
+	}
+	samples.push_back(sample);
+	nextSampleTime += sampleInterval;
+}
+
+// Replays every trade in the journal at 'path', then finishes, returning the number
+// of trades read. See TradeJournal::replay for exceptions.
+//
+std::size_t ReplayEngine::replayJournal(const std::string& path)
+{
+	const std::size_t tradesRead = TradeJournal::replay(path, [this](const StockTrade* trades, std::size_t count)
+	{
+		replay(trades, count);
+	});
+	finish();
+	return tradesRead;
+}
+
+// Replays every trade in the CSV file at 'path', then finishes, returning the number
+// of trades read. Rows naming stocks not in the group are skipped.
+// See CsvTradeLoader::loadFile for exceptions.
+//
+std::size_t ReplayEngine::replayCsv(const std::string& path)
+{
+	CsvTradeLoader loader(group, [this](const StockTrade* trades, std::size_t count)
+	{
+		replay(trades, count);
+	});
+	const std::size_t tradesRead = loader.loadFile(path);
+	finish();
+	return tradesRead;
+}
+
+// Returns the given stock at the given sample.
+// Throws an invalid_argument if either does not exist.
+//
+const ReplayStockSample& ReplayEngine::getStockSample(std::size_t sample, StockId id)const
+{
+	if (sample >= samples.size())
+	{
+		throw std::invalid_argument("ReplayEngine::getStockSample:\tsample does not exist.");
+	}
+	if (id >= stocksPerSample)
+	{
+		throw std::invalid_argument("ReplayEngine::getStockSample:\tstock id was not sampled.");
+	}
+	return stockSamples[sample * stocksPerSample + id];
+}
+
+// Writes the samples as CSV, one line per stock per sample:
+//	time,symbol,vwsp,dividendYield,peRatio,allShareIndex
+// with time in seconds since the epoch of the system clock.
+//
+void ReplayEngine::writeSamples(std::ostream& out)const
+{
+	const std::streamsize precision = out.precision(12);
+	out << "time,symbol,vwsp,dividendYield,peRatio,allShareIndex\n";
+	for (std::size_t s = 0; s < samples.size(); ++s)
+	{
+		const std::int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(samples[s].time.time_since_epoch()).count();
+		for (StockId id = 0; id < stocksPerSample; ++id)
+		{
+			const ReplayStockSample& stockSample = stockSamples[s * stocksPerSample + id];
+			out << nanoseconds / 1000000000 << '.' << std::setw(9) << std::setfill('0') << nanoseconds % 1000000000 << std::setfill(' ')
+				<< ',' << group.accessStock(id).getStockSymbol()
+				<< ',' << stockSample.volumeWeightedStockPrice
+				<< ',' << stockSample.dividendYield
+				<< ',' << stockSample.peRatio
+				<< ',' << samples[s].allShareIndex << '\n';
+		}
+	}
+	out.precision(precision);
+}
@@ -0,0 +1,139 @@
+/*
+* ReplayEngine.h
+*
+*	A ReplayEngine reruns recorded trades through a StockGroup under a VirtualClock,
+*	so that the group's Volume Weighted Stock Prices and All Share Index evolve just
+*	as they did live, but as fast as the trades can be added.
+*	Trades are streamed in batches, from a trade journal, a CSV file or the caller,
+*	and should be in time order. The engine cuts the stream at every multiple of the
+*	sample interval: it moves the clock to that moment, adds the trades up to it to
+*	the group in one batch, then samples each stock's Volume Weighted Stock Price,
+*	dividend yield and P/E ratio, and the All Share Index, into a time series.
+*	A trade arriving after a later sample has already been taken is still added, at
+*	the next sample, and counted as late; samples already taken do not include it.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_REPLAY_ENGINE
+#define SUPERSIMPLESTOCKS_REPLAY_ENGINE
+#include"Clock.h"
+#include"StockGroup.h"
+#include<cstddef>
+#include<iosfwd>
+#include<string>
+#include<vector>
+
+// The group as a whole at one sample time
+//
+struct ReplaySample
+{
+	TimeStamp time;
+	double allShareIndex;
+	std::size_t tradesReplayed;
+};
+
+// One stock at one sample time. The dividend yield and P/E ratio are for the Volume
+// Weighted Stock Price, and are 0.0 when the stock had no trades in the window.
+//
+struct ReplayStockSample
+{
+	double volumeWeightedStockPrice;
+	double dividendYield;
+	double peRatio;
+	bool foundTrades;
+};
+
+class ReplayEngine
+{
+	StockGroup& group;
+	VirtualClock& clock;
+	TimeStamp::duration sampleInterval;
+
+	// Trades up to nextSampleTime, waiting to be added to the group when it is reached
+	//
+	std::vector<StockTrade> pending;
+	TimeStamp nextSampleTime;
+	bool started;
+
+	// samples[s] is the group at sample s; stockSamples holds the stocks of each sample
+	// in turn, stocksPerSample of them each in StockId order. stocksPerSample is the
+	// number of stocks in the group at the first sample; stocks added later are not sampled.
+	//
+	std::vector<ReplaySample> samples;
+	std::vector<ReplayStockSample> stockSamples;
+	std::size_t stocksPerSample;
+
+	std::size_t tradesReplayed;
+	std::size_t lateTrades;
+
+	ReplayEngine(const ReplayEngine&) = delete;
+	ReplayEngine& operator=(const ReplayEngine&) = delete;
+
+	// Internal utility; moves the clock to nextSampleTime, adds the pending trades to the
+	// group and takes a sample, then moves nextSampleTime on by one interval.
+	//
+	void takeSample();
+
+public:
+
+	// Build a ReplayEngine replaying trades into groupIn, sampling every sampleIntervalIn.
+	// clockIn is given to the group, and both must outlive the engine. The group should
+	// not be given trades by anything else while a replay is running.
+	// The interval must be positive or an invalid_argument is thrown.
+	//
+	ReplayEngine(StockGroup& groupIn, VirtualClock& clockIn, TimeStamp::duration sampleIntervalIn);
+
+	// Replays 'count' trades, taking every sample due before the last of them.
+	// Trades after the last sample time are held until a later sample or finish.
+	//
+	void replay(const StockTrade* trades, std::size_t count);
+
+	// Adds any trades still held and takes the sample covering them. Replaying can
+	// continue afterwards.
+	//
+	void finish();
+
+	// Replays every trade in the journal at 'path', then finishes, returning the number
+	// of trades read. See TradeJournal::replay for exceptions.
+	//
+	std::size_t replayJournal(const std::string& path);
+
+	// Replays every trade in the CSV file at 'path', then finishes, returning the number
+	// of trades read. Rows naming stocks not in the group are skipped.
+	// See CsvTradeLoader::loadFile for exceptions.
+	//
+	std::size_t replayCsv(const std::string& path);
+
+	// Returns the samples taken so far, oldest first
+	//
+	const std::vector<ReplaySample>& getSamples()const
+	{
+		return samples;
+	}
+
+	// Returns the given stock at the given sample.
+	// Throws an invalid_argument if either does not exist.
+	//
+	const ReplayStockSample& getStockSample(std::size_t sample, StockId id)const;
+
+	// Returns the number of trades added to the group so far
+	//
+	std::size_t getTradesReplayed()const
+	{
+		return tradesReplayed;
+	}
+
+	// Returns the number of trades which arrived after a later sample had been taken
+	//
+	std::size_t getLateTrades()const
+	{
+		return lateTrades;
+	}
+
+	// Writes the samples as CSV, one line per stock per sample:
+	//	time,symbol,vwsp,dividendYield,peRatio,allShareIndex
+	// with time in seconds since the epoch of the system clock.
+	//
+	void writeSamples(std::ostream& out)const;
+};
+
+#endif
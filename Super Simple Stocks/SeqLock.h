@@ -0,0 +1,91 @@
+/*
+* SeqLock.h
+*
+*	A SeqLock publishes a small value from a single writer thread to any number of
+*	reader threads without either side taking a lock. The writer never waits; a
+*	reader copies the value and checks a sequence number, retrying only if a write
+*	overlapped its copy, so readers always see a value exactly as it was stored.
+*	The value is held in atomic words so that overlapping copies are not data races.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_SEQ_LOCK
+#define SUPERSIMPLESTOCKS_SEQ_LOCK
+#include<atomic>
+#include<cstddef>
+#include<cstdint>
+#include<cstring>
+#include<type_traits>
+
+template<typename T>
+class SeqLock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SeqLock:\tT must be trivially copyable.");
+
+	static const std::size_t WORD_COUNT = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+	// Odd while a store is in progress; advanced by two for every store
+	//
+	std::atomic<std::uint32_t> sequence;
+	std::atomic<std::uint64_t> words[WORD_COUNT];
+
+	SeqLock(const SeqLock&) = delete;
+	SeqLock& operator=(const SeqLock&) = delete;
+
+public:
+
+	explicit SeqLock(const T& value = T()) :
+		sequence(0)
+	{
+		for (auto& word : words)
+		{
+			word.store(0, std::memory_order_relaxed);
+		}
+		store(value);
+	}
+
+	// Publishes a new value. Only one thread may store at a time.
+	//
+	void store(const T& value)
+	{
+		std::uint64_t buffer[WORD_COUNT] = {};
+		std::memcpy(buffer, &value, sizeof(T));
+
+		const std::uint32_t start = sequence.load(std::memory_order_relaxed);
+		sequence.store(start + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (std::size_t t = 0; t < WORD_COUNT; ++t)
+		{
+			words[t].store(buffer[t], std::memory_order_relaxed);
+		}
+		sequence.store(start + 2, std::memory_order_release);
+	}
+
+	// Returns the most recently published value. Safe to call from any thread.
+	//
+	T load()const
+	{
+		std::uint64_t buffer[WORD_COUNT];
+		for (;;)
+		{
+			const std::uint32_t start = sequence.load(std::memory_order_acquire);
+			if (start & 1)
+			{
+				continue;
+			}
+			for (std::size_t t = 0; t < WORD_COUNT; ++t)
+			{
+				buffer[t] = words[t].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == start)
+			{
+				break;
+			}
+		}
+		T value;
+		std::memcpy(&value, buffer, sizeof(T));
+		return value;
+	}
+};
+
+#endif
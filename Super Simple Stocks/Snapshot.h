@@ -0,0 +1,64 @@
+/*
+* Snapshot.h
+*
+*	The layout of a StockGroup snapshot file, as written by StockGroup::writeSnapshot
+*	and read back by StockGroup::loadSnapshot.
+*	The file starts with a SnapshotHeader, followed by a SnapshotStock for each stock
+*	in StockId order, then every stock's symbol, then every stock's trades. Each stock's
+*	trades are stored as columns matching those of a TradeStore chunk: time stamps,
+*	prices, quantities and buy/sell types, one after another. Every column and table
+*	starts at a multiple of eight bytes, so a mapped file can be copied from in place.
+*	All values are in the byte order of the machine which wrote the snapshot.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_SNAPSHOT
+#define SUPERSIMPLESTOCKS_SNAPSHOT
+#include<cstddef>
+#include<cstdint>
+
+const char SNAPSHOT_MAGIC[8] = { 'S', 'S', 'S', 'S', 'N', 'A', 'P', '\0' };
+const std::uint32_t SNAPSHOT_VERSION = 2;
+
+// Time stamps are stored as ticks since the epoch of the system clock; the tick period
+// is recorded so that a snapshot can be loaded where the clock's period differs.
+// fileSize allows a truncated snapshot to be detected before anything is read.
+//
+struct SnapshotHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t stockCount;
+	std::int64_t tickPeriodNumerator;
+	std::int64_t tickPeriodDenominator;
+	std::uint64_t fileSize;
+};
+
+// One stock's definition and the position of its symbol and trades within the file.
+// tickSize is zero for a stock whose prices are not held in ticks.
+//
+struct SnapshotStock
+{
+	std::uint64_t symbolOffset;
+	std::uint64_t tradesOffset;
+	std::uint64_t tradeCount;
+	double lastDividend;
+	double parValue;
+	double fixedDividend;
+	double tickSize;
+	std::uint32_t symbolLength;
+	std::uint32_t type;
+};
+
+// Number of bytes each trade takes across the four columns
+//
+const std::uint64_t SNAPSHOT_TRADE_SIZE = sizeof(std::int64_t) + sizeof(double) + sizeof(std::uint32_t) + sizeof(std::uint8_t);
+
+// Returns the number of bytes taken by the trade columns of 'tradeCount' trades,
+// including padding to the next multiple of eight bytes
+//
+inline std::uint64_t getSnapshotTradesSize(std::uint64_t tradeCount)
+{
+	return (tradeCount * SNAPSHOT_TRADE_SIZE + 7) / 8 * 8;
+}
+
+#endif
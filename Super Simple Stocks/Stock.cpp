@@ -37,16 +37,19 @@ const double Stock::NO_FIXED_DIVIDEND = 0.0;
 // Build a Stock with the given fields
 // Throws an invalid argument if either of the following are negative:
 //		lastDividendIn, parValueIn or fixedDividendIn
+// The stock's trades are stored in memory from allocatorIn, which must outlive it.
 Stock::Stock(StockSymbol symbolIn,
 	StockType typeIn,
 	double lastDividendIn,
 	double parValueIn,
-	double fixedDividendIn) :
+	double fixedDividendIn,
+	Allocator& allocatorIn) :
 	symbol(symbolIn),
 	type(typeIn),
 	lastDividend(lastDividendIn),
 	parValue(parValueIn),
-	fixedDividend(fixedDividendIn)
+	fixedDividend(fixedDividendIn),
+	trades(TradeRecord::DEFAULT_WINDOW, allocatorIn)
 {
 	if (lastDividendIn < 0.0)
 	{
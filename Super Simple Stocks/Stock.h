@@ -21,6 +21,8 @@
 *	characters), then this could be optimized to storing in an int or long int, or a struct
 *	containing an array with defined sorting operands reinterpreting the contents as int or
 *	long int
+*	Hot paths can avoid handling the strings altogether by interning symbols as dense
+*	StockIds; see SymbolTable.h.
 */
 
 typedef std::string StockSymbol;
@@ -72,11 +74,13 @@ public:
 	// Build a Stock with the given fields
 	// Throws an invalid argument if either of the following are negative:
 	//		lastDividendIn, parValueIn or fixedDividendIn
+	// The stock's trades are stored in memory from allocatorIn, which must outlive it.
 	Stock(StockSymbol symbolIn,
 		StockType typeIn,
 		double lastDividendIn,
 		double parValueIn,
-		double fixedDividendIn = NO_FIXED_DIVIDEND);
+		double fixedDividendIn = NO_FIXED_DIVIDEND,
+		Allocator& allocatorIn = HeapAllocator::getInstance());
 
 	// Returns this stocks symbol
 	StockSymbol getStockSymbol()const
@@ -124,6 +128,24 @@ public:
 		return trades;
 	}
 
+	// Starts keeping OHLCV bars of the given resolution for this stock, such as one second,
+	// one minute or one hour, keeping at most maxBars of them (zero for no limit).
+	// See TradeRecord::addBarSeries.
+	//
+	void addBarResolution(std::chrono::seconds resolution, std::size_t maxBars = 0)
+	{
+		trades.addBarSeries(resolution, maxBars);
+	}
+
+	// Summarizes this stock's trades in [startTimeStamp, endTimeStamp) from its bars: open,
+	// high, low, close, volume and Volume Weighted price.
+	// Returns false if there were no trades in the period. See TradeRecord::summarizeBars.
+	//
+	bool summarizeTrades(TimeStamp startTimeStamp, TimeStamp endTimeStamp, Bar& summary)const
+	{
+		return trades.summarizeBars(startTimeStamp, endTimeStamp, summary);
+	}
+
 	// Returns a DividendYield on this Stock for the given price.
 	// Throws an invalid_argument for zero or negative prices
 	double calculateDividendYield(double price);
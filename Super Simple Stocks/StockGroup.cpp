@@ -1,54 +1,174 @@
 #include"stdafx.h"
 #include"StockGroup.h"
 #include"Exceptions.h"
+#include"MappedFile.h"
+#include"Metrics.h"
+#include"Snapshot.h"
+#include"TradeJournal.h"
+#include<algorithm>
+#include<cstdio>
+#include<cstring>
+#include<functional>
+#include<memory>
+#include<new>
+#include<numeric>
+
+typedef std::shared_lock<std::shared_timed_mutex> SharedStocksLock;
+typedef std::unique_lock<std::shared_timed_mutex> ExclusiveStocksLock;
+
+const std::chrono::microseconds StockGroup::MIN_EXPIRY_WAIT(1000);
+
+StockGroup::Shard::Shard() :
+	sumOfLogPrices(0.0),
+	pricedCount(0),
+	updatesSinceRebuild(0),
+	memoryUsage(0),
+	enforcingMemoryBudget(false)
+{
+	// done //
+}
+
+// Build an empty StockGroup with the given number of shards, which must be at least
+// one or an invalid_argument is thrown. More shards allow more threads to add trades
+// at once; around the number of ingesting threads is a reasonable choice.
+// Stocks and their trades are held in memory from allocatorIn, which must outlive the
+// group; if it is null the group makes a PoolAllocator of its own.
+//
+StockGroup::StockGroup(std::size_t shardCount, Allocator* allocatorIn) :
+	allocator(allocatorIn),
+	indexWindow(TradeRecord::DEFAULT_WINDOW),
+	memoryBudget(0),
+	journal(nullptr),
+	clock(&SystemClock::getInstance()),
+	dispatcher(new ChangeDispatcher([this](std::vector<StockValues>& changed, std::chrono::microseconds& untilNextChange)
+	{
+		return collectChanges(changed, untilNextChange);
+	})),
+	windowedIndexCalls(0)
+{
+	if (0 == shardCount)
+	{
+		throw std::invalid_argument("StockGroup::StockGroup:\tshardCount must be at least one.");
+	}
+	for (std::size_t t = 0; t < shardCount; ++t)
+	{
+		shards.emplace_back(new Shard);
+	}
+	if (nullptr == allocator)
+	{
+		ownedAllocator.reset(new PoolAllocator);
+		allocator = ownedAllocator.get();
+	}
+}
 
 // 
 //
 StockGroup::~StockGroup()
 {
-	for (auto itr : stocks)
+	dispatcher.reset();
+	const StockDeleter deleter = { allocator };
+	for (Stock* stock : stocks)
+	{
+		deleter(stock);
+	}
+}
+
+// Internal utility; locks every shard, in order.
+//
+std::vector<std::unique_lock<std::mutex>> StockGroup::lockAllShards()const
+{
+	std::vector<std::unique_lock<std::mutex>> locks;
+	locks.reserve(shards.size());
+	for (const auto& shard : shards)
+	{
+		locks.emplace_back(shard->mutex);
+	}
+	return locks;
+}
+
+// Sets the number of threads used to calculate the All Share Index, counting the
+// calling thread; one calculates on the calling thread alone, and zero uses one
+// thread per core. Results are identical whatever the number of threads.
+//
+void StockGroup::setIndexThreadCount(std::size_t threadCount)
+{
+	ExclusiveStocksLock lock(stocksMutex);
+	workerPool.reset();
+	if (1 != threadCount)
 	{
-		delete itr.second;
+		workerPool.reset(new WorkerPool(threadCount));
 	}
 }
 
+// Returns the number of threads used to calculate the All Share Index
+//
+std::size_t StockGroup::getIndexThreadCount()const
+{
+	SharedStocksLock lock(stocksMutex);
+	return workerPool ? workerPool->getThreadCount() : 1;
+}
+
 // Returns true if a stock with the given symbol is in the StockGroup
 //
-bool StockGroup::hasStock(StockSymbol symbol)const
+bool StockGroup::hasStock(const StockSymbol& symbol)const
+{
+	SharedStocksLock lock(stocksMutex);
+	StockId id;
+	return symbols.find(symbol, id);
+}
+
+// Returns the id of the stock with the given symbol.
+// Throws an invalid_argument if the stock does not exist.
+//
+StockId StockGroup::getStockId(const StockSymbol& symbol)const
 {
-	auto itr = stocks.find(symbol);
-	return itr != stocks.end();
+	SUPERSIMPLESTOCKS_METRICS_TIME(ACCESS_STOCK_NANOSECONDS);
+	SharedStocksLock lock(stocksMutex);
+	StockId id;
+	if (!symbols.find(symbol, id))
+	{
+		throw std::invalid_argument("StockGroup::getStockId:\tstock does not exist");
+	}
+	return id;
 }
 
 // Returns non-modifiable access to a stock with the given symbol.
 // Throws an invalid_argument if the stock does not exist.
+// Queries of the stock's TradeRecord through the returned reference are not locked, and
+// must not run while other threads add trades; see calculateVolumeWeightedStockPriceWithin.
 //
-const Stock& StockGroup::accessStock(StockSymbol symbol) const
+const Stock& StockGroup::accessStock(const StockSymbol& symbol) const
 {
-	auto itr = stocks.find(symbol);
-	if (itr == stocks.end())
+	SUPERSIMPLESTOCKS_METRICS_TIME(ACCESS_STOCK_NANOSECONDS);
+	SharedStocksLock lock(stocksMutex);
+	StockId id;
+	if (!symbols.find(symbol, id))
 	{
 		throw std::invalid_argument("StockGroup::accessStock:\tstock does not exist");
 	}
 	else
 	{
-		return *itr->second;
+		return *stocks[id];
 	}
 }
 
 // Returns modifiable direct access to a stock with the given symbol.
 // Throws an invalid_argument if the stock does not exist.
+// Queries of the stock's TradeRecord through the returned reference are not locked, and
+// must not run while other threads add trades; see calculateVolumeWeightedStockPriceWithin.
 //
-Stock& StockGroup::accessStock(StockSymbol symbol)
+Stock& StockGroup::accessStock(const StockSymbol& symbol)
 {
-	auto itr = stocks.find(symbol);
-	if (itr == stocks.end())
+	SUPERSIMPLESTOCKS_METRICS_TIME(ACCESS_STOCK_NANOSECONDS);
+	SharedStocksLock lock(stocksMutex);
+	StockId id;
+	if (!symbols.find(symbol, id))
 	{
 		throw std::invalid_argument("StockGroup::accessStock:\tstock does not exist");
 	}
 	else
 	{
-		return *itr->second;
+		return *stocks[id];
 	}
 }
 
@@ -75,43 +195,1233 @@ Stock& StockGroup::accessStock(StockSymbol symbol)
 }
 */
 
-// Add a stock to the StockGroup.
+// Add a stock to the StockGroup, returning its StockId.
 // If a stock of that symbol already exists in the group, an InvalidOperation is thrown.
-// This method allocates a Stock object internally using the given fields.
+// This method builds a Stock object in the group's allocator using the given fields.
 // See Stock's constructor for potential exceptions when supplying these fields.
 //
-void StockGroup::addStock(StockSymbol symbolIn,
+StockId StockGroup::addStock(StockSymbol symbolIn,
 	StockType typeIn,
 	double lastDividendIn,
 	double parValueIn,
 	double fixedDividendIn)
 {
-	auto itr = stocks.find(symbolIn);
-	if (itr != stocks.end())
+	std::unique_ptr<Stock, StockDeleter> stock = makeStock(symbolIn, typeIn, lastDividendIn, parValueIn, fixedDividendIn);
+	ExclusiveStocksLock lock(stocksMutex);
+	return insertStock(std::move(stock));
+}
+
+// Internal utility; builds a Stock in the group's allocator using the given fields.
+// See Stock's constructor for potential exceptions when supplying these fields.
+//
+std::unique_ptr<Stock, StockGroup::StockDeleter> StockGroup::makeStock(StockSymbol symbolIn,
+	StockType typeIn,
+	double lastDividendIn,
+	double parValueIn,
+	double fixedDividendIn)
+{
+	void* memory = allocator->allocate(sizeof(Stock), alignof(Stock));
+	try
+	{
+		return std::unique_ptr<Stock, StockDeleter>(
+			new (memory) Stock(symbolIn, typeIn, lastDividendIn, parValueIn, fixedDividendIn, *allocator),
+			StockDeleter{ allocator });
+	}
+	catch (...)
+	{
+		allocator->deallocate(memory, sizeof(Stock), alignof(Stock));
+		throw;
+	}
+}
+
+// Internal utility; gives the stock's TradeRecord the group's clock, window and
+// retention policy. The caller must hold stocksMutex exclusively.
+//
+void StockGroup::configureTradeRecord(TradeRecord& tradeRecord)
+{
+	if (&tradeRecord.getClock() != clock.load())
+	{
+		tradeRecord.setClock(*clock.load());
+	}
+	if (tradeRecord.getWindow() != indexWindow)
+	{
+		tradeRecord.setWindow(indexWindow);
+	}
+	if (retention.isLimited())
+	{
+		tradeRecord.setRetentionPolicy(retention);
+	}
+}
+
+// Internal utility; adds a stock built by makeStock to the group, returning its
+// StockId. If a stock of that symbol already exists in the group, an InvalidOperation
+// is thrown. The caller must hold stocksMutex exclusively.
+//
+StockId StockGroup::insertStock(std::unique_ptr<Stock, StockDeleter> stock)
+{
+	StockId existing;
+	if (symbols.find(stock->getStockSymbol(), existing))
 	{
 		throw InvalidOperation("StockSet::addStock:\tStock already exists.");
 	}
-	stocks.insert(std::make_pair(symbolIn,
-		new Stock(symbolIn, typeIn, lastDividendIn, parValueIn, fixedDividendIn)));
+	stocks.reserve(stocks.size() + 1);
+	constituents.reserve(constituents.size() + 1);
+	pricingParameters.reserve(stocks.size() + 1);
+	const StockId id = static_cast<StockId>(stocks.size());
+	Shard& shard = accessShard(id);
+	std::lock_guard<std::mutex> shardLock(shard.mutex);
+	shard.members.reserve(shard.members.size() + 1);
+	symbols.add(stock->getStockSymbol());
+	pricingParameters.add(stock->getLastDividend(),
+		stock->getParValue(),
+		stock->hasFixedDividend() ? stock->getFixedDividend() : Stock::NO_FIXED_DIVIDEND);
+	stocks.push_back(stock.release());
+	shard.members.push_back(id);
+	publishIndex(shard);
+
+	IndexConstituent constituent;
+	constituent.price = 0.0;
+	constituent.logPrice = 0.0;
+	constituent.hasPrice = false;
+	constituent.changed = false;
+	constituent.expiryTime = TimeStamp::max();
+	constituent.memoryUsage = 0;
+	constituents.push_back(constituent);
+
+	TradeRecord& tradeRecord = stocks[id]->accessTradeRecord();
+	configureTradeRecord(tradeRecord);
+	tradeRecord.setListener(this, id);
+	if (0 != tradeRecord.getTradeCount())
+	{
+		refreshConstituent(id);
+	}
+	return id;
+}
+
+// Sets the retention policy of every stock's TradeRecord, including stocks added later.
+// See RetentionPolicy.
+//
+void StockGroup::setRetentionPolicy(const RetentionPolicy& retentionIn)
+{
+	ExclusiveStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+	retention = retentionIn;
+	for (StockId id = 0; id < stocks.size(); ++id)
+	{
+		stocks[id]->accessTradeRecord().setRetentionPolicy(retention);
+		refreshConstituent(id);
+	}
+}
+
+// Sets a limit on the memory held for trades across the whole group, releasing the
+// oldest trades of any stock first when it is exceeded; each stock keeps at least its
+// newest chunk of trades. Zero removes the limit.
+//
+void StockGroup::setMemoryBudget(std::size_t bytes)
+{
+	ExclusiveStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+	memoryBudget = bytes;
+	for (auto& shard : shards)
+	{
+		if (memoryBudget > 0 && shard->memoryUsage > memoryBudget / shards.size())
+		{
+			enforceMemoryBudget(*shard);
+		}
+	}
+}
+
+// Returns the memory held for trades across the whole group
+//
+std::size_t StockGroup::getMemoryUsage()const
+{
+	SharedStocksLock lock(stocksMutex);
+	std::size_t memoryUsage = 0;
+	for (const auto& shard : shards)
+	{
+		std::lock_guard<std::mutex> shardLock(shard->mutex);
+		memoryUsage += shard->memoryUsage;
+	}
+	return memoryUsage;
+}
+
+// Internal utility; releases the oldest chunks of trades across the shard, oldest
+// first, until its memory usage is back below 90% of its share of the budget.
+// Leaving headroom means the budget is enforced rarely and its cost is amortized
+// across many inserts. The shard must be locked.
+//
+void StockGroup::enforceMemoryBudget(Shard& shard)
+{
+	shard.enforcingMemoryBudget = true;
+	const std::size_t shardBudget = memoryBudget / shards.size();
+	const std::size_t target = shardBudget - shardBudget / 10;
+
+	ExpiryQueue oldestChunks;
+	for (StockId id : shard.members)
+	{
+		const TradeRecord& tradeRecord = stocks[id]->accessTradeRecord();
+		if (tradeRecord.getChunkCount() > 1)
+		{
+			oldestChunks.push(ExpiryEntry(tradeRecord.getOldestChunkTimeStamp(), id));
+		}
+	}
+
+	while (shard.memoryUsage > target && !oldestChunks.empty())
+	{
+		const StockId id = static_cast<StockId>(oldestChunks.top().second);
+		oldestChunks.pop();
+		TradeRecord& tradeRecord = stocks[id]->accessTradeRecord();
+		tradeRecord.evictOldestChunks(1);
+		refreshConstituent(id);
+		if (tradeRecord.getChunkCount() > 1)
+		{
+			oldestChunks.push(ExpiryEntry(tradeRecord.getOldestChunkTimeStamp(), id));
+		}
+	}
+	shard.enforcingMemoryBudget = false;
+}
+
+// Calculates the dividend yield and P/E ratio of the stocks with ids from 0 to
+// stockCount - 1 at each of a grid of prices, as Stock::calculateDividendYield and
+// Stock::calculatePERatio would, but many prices at a time. 'prices' is a matrix of
+// stockCount rows, one per stock in StockId order, of pricesPerStock prices each,
+// stored row after row. dividendYields, peRatios and errors are filled in the same
+// layout, the latter with the PricingError flags of each price: a price which is not
+// positive is flagged rather than throwing. See BatchPricing.h.
+// Returns the number of prices flagged PRICE_NOT_POSITIVE.
+// Throws an invalid_argument if stockCount is more than the number of stocks.
+//
+std::size_t StockGroup::calculatePricing(const double* prices,
+	std::size_t stockCount,
+	std::size_t pricesPerStock,
+	double* dividendYields,
+	double* peRatios,
+	unsigned char* errors)const
+{
+	SharedStocksLock lock(stocksMutex);
+	if (stockCount > stocks.size())
+	{
+		throw std::invalid_argument("StockGroup::calculatePricing:\tmore rows than stocks.");
+	}
+	return ::calculatePricing(pricingParameters, stockCount, prices, pricesPerStock, dividendYields, peRatios, errors);
+}
+
+// Sets the smallest step the given stock's prices move in, under the lock of its shard,
+// so that its prices are held in whole ticks and summed exactly; zero for none.
+// Throws an invalid_argument if the stock does not exist.
+// See TradeRecord::setTickSize for other exceptions.
+//
+void StockGroup::setTickSize(StockId id, double tickSize)
+{
+	SharedStocksLock lock(stocksMutex);
+	Stock& stock = accessStockUnlocked(id);
+	std::lock_guard<std::mutex> shardLock(accessShard(id).mutex);
+	stock.accessTradeRecord().setTickSize(tickSize);
+}
+
+// Returns the given stock's Volume Weighted Stock Price over the last "min" minutes,
+// as TradeRecord::calculateVolumeWeightedStockPriceWithin, under the lock of the
+// stock's shard. Unlike queries of the stock's TradeRecord itself, this and the group's
+// other per-stock queries below are safe to call while other threads add trades.
+// Throws an invalid_argument if the stock does not exist.
+//
+double StockGroup::calculateVolumeWeightedStockPriceWithin(StockId id, bool& foundTrades, std::chrono::minutes min)const
+{
+	return queryTradeRecord(id, [&](const TradeRecord& record)
+	{
+		return record.calculateVolumeWeightedStockPriceWithin(foundTrades, min);
+	});
+}
+
+// Returns the given stock's Volume Weighted Stock Price over trades from startTimeStamp
+// to endTimeStamp inclusive, as TradeRecord::calculateVolumeWeightedStockPriceBetween,
+// under the lock of the stock's shard.
+// Throws an invalid_argument if the stock does not exist.
+//
+double StockGroup::calculateVolumeWeightedStockPriceBetween(StockId id,
+	bool& foundTrades,
+	TimeStamp startTimeStamp,
+	TimeStamp endTimeStamp)const
+{
+	return queryTradeRecord(id, [&](const TradeRecord& record)
+	{
+		return record.calculateVolumeWeightedStockPriceBetween(foundTrades, startTimeStamp, endTimeStamp);
+	});
+}
+
+// Returns the given stock's buy and sell order flow over the last "min" minutes, as
+// TradeRecord::calculateOrderFlowWithin, under the lock of the stock's shard.
+// Throws an invalid_argument if the stock does not exist.
+//
+OrderFlow StockGroup::calculateOrderFlowWithin(StockId id, std::chrono::minutes min)const
+{
+	return queryTradeRecord(id, [&](const TradeRecord& record)
+	{
+		return record.calculateOrderFlowWithin(min);
+	});
+}
+
+// Fills 'prices' with the given stock's Volume Weighted Stock Price over each of its
+// horizons, as TradeRecord::calculateHorizonPrices, under the lock of the stock's shard.
+// Throws an invalid_argument if the stock does not exist.
+//
+void StockGroup::calculateHorizonPrices(StockId id, std::vector<HorizonPrice>& prices)const
+{
+	queryTradeRecord(id, [&](const TradeRecord& record)
+	{
+		record.calculateHorizonPrices(prices);
+	});
+}
+
+// Adds a Trade to the given stock, using the present moment of the group's clock as its
+// timeStamp, under the lock of the stock's shard. The trade is recorded in the journal,
+// if any, before it is added, so that no trade is held which the journal does not have.
+// Throws an invalid_argument if the stock does not exist, and a runtime_error without
+// adding the trade if an earlier write to the journal failed.
+// See TradeRecord::addTrade for other exceptions.
+//
+void StockGroup::addTrade(StockId id, int quantity, BuyOrSellType buyOrSellType, double price)
+{
+	const StockTrade stockTrade = { id, Trade(quantity, buyOrSellType, price, *clock.load()) };
+	addStockTrade(stockTrade);
+}
+
+// Adds a Trade to the given stock, using the given time as its timeStamp, under the
+// lock of the stock's shard. The trade is recorded in the journal, if any, before it
+// is added. Throws an invalid_argument if the stock does not exist, and a runtime_error
+// without adding the trade if an earlier write to the journal failed.
+// See TradeRecord::addTrade for other exceptions.
+//
+void StockGroup::addTrade(StockId id, int quantity, BuyOrSellType buyOrSellType, double price, TimeStamp timeStamp)
+{
+	const StockTrade stockTrade = { id, Trade(quantity, buyOrSellType, price, timeStamp) };
+	addStockTrade(stockTrade);
+}
+
+// Internal utility; under the lock of the stock's shard, checks the trade can be added,
+// records it in the journal, if any, then adds it.
+//
+void StockGroup::addStockTrade(const StockTrade& stockTrade)
+{
+	SharedStocksLock lock(stocksMutex);
+	TradeRecord& record = accessStockUnlocked(stockTrade.stockId).accessTradeRecord();
+	std::lock_guard<std::mutex> shardLock(accessShard(stockTrade.stockId).mutex);
+	if (nullptr != journal)
+	{
+		// throws as addTrade would for a trade the record cannot take, before journalling it
+		record.accessTradeStore().roundToTick(stockTrade.trade);
+		journal->append(&stockTrade, 1);
+	}
+	record.addTrade(stockTrade.trade);
+}
+
+// Adds a batch of trades, possibly for many stocks, to the group.
+// Every stockId in the batch is checked first; if any does not exist an invalid_argument
+// is thrown and no trades are added. With a journal, every trade is also checked against
+// its stock's tick size, and the batch is recorded in the journal before any is added;
+// if an earlier write to the journal failed a runtime_error is thrown and no trades are
+// added. The batch is then grouped by stock and each stock's trades are merged into its
+// TradeRecord in one pass, under the lock of the stock's shard. With a journal, the
+// shards are held from the check until the merge, so that replaying the journal adds
+// trades in the order they were added, ties included, whatever other threads do.
+//
+void StockGroup::addTrades(const StockTrade* trades, std::size_t count)
+{
+	SharedStocksLock lock(stocksMutex);
+	mergeTrades(trades, count, true);
+}
+
+// Internal utility; checks every stockId in the batch, then merges each stock's trades
+// into its TradeRecord under the lock of the stock's shard. If 'journalling' and the
+// group has a journal, every trade is checked against its stock's tick size and the
+// batch recorded in the journal before any is merged, with every shard the batch
+// touches locked throughout. The caller must hold stocksMutex.
+//
+void StockGroup::mergeTrades(const StockTrade* trades, std::size_t count, bool journalling)
+{
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		if (trades[t].stockId >= stocks.size())
+		{
+			throw std::invalid_argument("StockGroup::mergeTrades:\tstock id does not exist");
+		}
+	}
+
+	// Group the batch by stock, keeping each stock's trades in their original order, as
+	// TradeRecord::addTrades puts each stock's run into time order itself. Batches at
+	// least as large as the group are grouped by a counting sort on StockId.
+	std::vector<std::size_t> order(count);
+	if (count >= stocks.size())
+	{
+		std::vector<std::size_t> nextPosition(stocks.size() + 1, 0);
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			++nextPosition[trades[t].stockId + 1];
+		}
+		std::partial_sum(nextPosition.begin(), nextPosition.end(), nextPosition.begin());
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			order[nextPosition[trades[t].stockId]++] = t;
+		}
+	}
+	else
+	{
+		std::iota(order.begin(), order.end(), std::size_t(0));
+		std::stable_sort(order.begin(), order.end(), [trades](std::size_t a, std::size_t b)
+		{
+			return trades[a].stockId < trades[b].stockId;
+		});
+	}
+
+	// Journalled batches hold every shard they touch, in shard order as lockAllShards
+	// does, from checking the trades until they are merged, so that batches and single
+	// trades for the same stocks are applied in the order the journal records them.
+	std::vector<std::unique_lock<std::mutex>> batchLocks;
+	const bool journalled = journalling && nullptr != journal;
+	if (journalled)
+	{
+		std::vector<bool> touched(shards.size(), false);
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			touched[trades[t].stockId % shards.size()] = true;
+		}
+		for (std::size_t s = 0; s < shards.size(); ++s)
+		{
+			if (touched[s])
+			{
+				batchLocks.emplace_back(shards[s]->mutex);
+			}
+		}
+	}
+
+	// Calls function(id, runStart, runEnd) for each stock's run [runStart, runEnd) of
+	// 'order', under the lock of the stock's shard
+	auto forEachRun = [&](const std::function<void(StockId, std::size_t, std::size_t)>& function)
+	{
+		std::size_t runStart = 0;
+		while (runStart < count)
+		{
+			const StockId id = trades[order[runStart]].stockId;
+			std::size_t runEnd = runStart;
+			while (runEnd < count && trades[order[runEnd]].stockId == id)
+			{
+				++runEnd;
+			}
+			std::unique_lock<std::mutex> shardLock(accessShard(id).mutex, std::defer_lock);
+			if (!journalled)
+			{
+				shardLock.lock();
+			}
+			function(id, runStart, runEnd);
+			runStart = runEnd;
+		}
+	};
+
+	if (journalled)
+	{
+		// throws as addTrades would for a trade a record cannot take, before journalling any
+		forEachRun([&](StockId id, std::size_t runStart, std::size_t runEnd)
+		{
+			const TradeStore& store = stocks[id]->accessTradeRecord().accessTradeStore();
+			for (std::size_t t = runStart; t < runEnd; ++t)
+			{
+				store.roundToTick(trades[order[t]].trade);
+			}
+		});
+		journal->append(trades, count);
+	}
+
+	forEachRun([&](StockId id, std::size_t runStart, std::size_t runEnd)
+	{
+		Shard& shard = accessShard(id);
+		shard.batchRun.clear();
+		for (std::size_t t = runStart; t < runEnd; ++t)
+		{
+			shard.batchRun.push_back(trades[order[t]].trade);
+		}
+		stocks[id]->accessTradeRecord().addTrades(shard.batchRun.data(), shard.batchRun.size());
+	});
+}
+
+// Records every trade added through addTrade and addTrades in the given journal from
+// now on; nullptr stops journalling. The journal is not owned by the group and must
+// outlive its use here.
+//
+void StockGroup::setJournal(TradeJournal* journalIn)
+{
+	ExclusiveStocksLock lock(stocksMutex);
+	journal = journalIn;
+}
+
+// Adds every trade recorded in the journal at 'path' to the group, as when rebuilding
+// the group's trades at startup, returning the number of trades replayed. The stocks
+// must already have been added, in the same order as when the journal was written.
+// Replayed trades are not journalled again.
+// Throws a runtime_error if the journal cannot be read, and an invalid_argument if it
+// names a stock which does not exist.
+//
+std::size_t StockGroup::replayJournal(const std::string& path)
+{
+	SharedStocksLock lock(stocksMutex);
+	return TradeJournal::replay(path, [this](const StockTrade* trades, std::size_t count)
+	{
+		mergeTrades(trades, count, false);
+	});
+}
+
+// Writes every stock's definition and trades to a snapshot file at 'path'. The snapshot
+// is written beside it and put on disk first, then replaces any existing file in one
+// step, so that 'path' holds either the old snapshot or the new. Trades are written as
+// the columns they are held in, so this costs little more than copying them.
+// See Snapshot.h for the layout.
+// Throws a runtime_error if the file cannot be written.
+//
+void StockGroup::writeSnapshot(const std::string& path)const
+{
+	SharedStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+
+	// lay out the file before writing any of it
+	std::vector<SnapshotStock> entries(stocks.size());
+	std::uint64_t offset = sizeof(SnapshotHeader) + entries.size() * sizeof(SnapshotStock);
+	for (StockId id = 0; id < stocks.size(); ++id)
+	{
+		const Stock& stock = *stocks[id];
+		SnapshotStock& entry = entries[id];
+		entry.symbolOffset = offset;
+		entry.symbolLength = static_cast<std::uint32_t>(stock.getStockSymbol().size());
+		entry.type = static_cast<std::uint32_t>(stock.getStockType());
+		entry.lastDividend = stock.getLastDividend();
+		entry.parValue = stock.getParValue();
+		entry.fixedDividend = stock.hasFixedDividend() ? stock.getFixedDividend() : Stock::NO_FIXED_DIVIDEND;
+		entry.tickSize = stock.accessTradeRecord().getTickSize();
+		entry.tradeCount = stock.accessTradeRecord().getTradeCount();
+		offset += entry.symbolLength;
+	}
+	offset = (offset + 7) / 8 * 8;
+	for (auto& entry : entries)
+	{
+		entry.tradesOffset = offset;
+		offset += getSnapshotTradesSize(entry.tradeCount);
+	}
+
+	SnapshotHeader header;
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.stockCount = static_cast<std::uint32_t>(stocks.size());
+	header.tickPeriodNumerator = std::chrono::system_clock::period::num;
+	header.tickPeriodDenominator = std::chrono::system_clock::period::den;
+	header.fileSize = offset;
+
+	const std::string writingPath = path + ".tmp";
+	std::FILE* file = std::fopen(writingPath.c_str(), "wb");
+	if (nullptr == file)
+	{
+		throw std::runtime_error("StockGroup::writeSnapshot:\tcould not open " + writingPath + ".");
+	}
+
+	const char padding[8] = {};
+	std::uint64_t written = 0;
+	auto write = [&](const void* data, std::size_t bytes)
+	{
+		written += std::fwrite(data, 1, bytes, file);
+	};
+	auto pad = [&]()
+	{
+		write(padding, static_cast<std::size_t>((8 - written % 8) % 8));
+	};
+
+	write(&header, sizeof(header));
+	write(entries.data(), entries.size() * sizeof(SnapshotStock));
+	for (const Stock* stock : stocks)
+	{
+		write(stock->getStockSymbol().data(), stock->getStockSymbol().size());
+	}
+	pad();
+	for (const Stock* stock : stocks)
+	{
+		const TradeStore& store = stock->accessTradeRecord().accessTradeStore();
+		store.forEachRun(store.begin(), store.end(), [&](const TradeStore::Chunk& chunk, std::size_t begin, std::size_t end)
+		{
+			write(&chunk.timeStamps[begin], (end - begin) * sizeof(TimeStamp));
+		});
+		store.forEachRun(store.begin(), store.end(), [&](const TradeStore::Chunk& chunk, std::size_t begin, std::size_t end)
+		{
+			write(&chunk.prices[begin], (end - begin) * sizeof(double));
+		});
+		store.forEachRun(store.begin(), store.end(), [&](const TradeStore::Chunk& chunk, std::size_t begin, std::size_t end)
+		{
+			write(&chunk.quantities[begin], (end - begin) * sizeof(unsigned int));
+		});
+		store.forEachRun(store.begin(), store.end(), [&](const TradeStore::Chunk& chunk, std::size_t begin, std::size_t end)
+		{
+			write(&chunk.buyOrSellTypes[begin], (end - begin) * sizeof(unsigned char));
+		});
+		pad();
+	}
+
+	const bool complete = written == header.fileSize && syncFile(file);
+	if (0 != std::fclose(file) || !complete)
+	{
+		std::remove(writingPath.c_str());
+		throw std::runtime_error("StockGroup::writeSnapshot:\tcould not write " + writingPath + ".");
+	}
+	if (!replaceFile(writingPath, path))
+	{
+		std::remove(writingPath.c_str());
+		throw std::runtime_error("StockGroup::writeSnapshot:\tcould not replace " + path + ".");
+	}
+}
+
+// Adds the stocks and trades held in the snapshot file at 'path' to this group,
+// which must be empty. The file is mapped into memory and each stock's trades are
+// copied straight into its TradeRecord a chunk at a time, rather than each being
+// read and inserted as a Trade. Every stock is loaded and checked before any is
+// added, so the group is left empty if the snapshot cannot be loaded.
+// Throws an InvalidOperation if the group already holds stocks, and a runtime_error
+// if the file cannot be read or is not a valid snapshot.
+//
+void StockGroup::loadSnapshot(const std::string& path)
+{
+	ExclusiveStocksLock lock(stocksMutex);
+	if (!stocks.empty())
+	{
+		throw InvalidOperation("StockGroup::loadSnapshot:\tgroup already holds stocks.");
+	}
+
+	const MappedFile file(path);
+	const unsigned char* data = file.getData();
+	const std::uint64_t size = file.getSize();
+	auto invalid = [&path]()
+	{
+		return std::runtime_error("StockGroup::loadSnapshot:\t" + path + " is not a valid snapshot.");
+	};
+
+	SnapshotHeader header;
+	if (size < sizeof(header))
+	{
+		throw invalid();
+	}
+	std::memcpy(&header, data, sizeof(header));
+	if (0 != std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))
+		|| SNAPSHOT_VERSION != header.version
+		|| size != header.fileSize
+		|| header.stockCount > (size - sizeof(header)) / sizeof(SnapshotStock)
+		|| header.tickPeriodNumerator <= 0
+		|| header.tickPeriodDenominator <= 0)
+	{
+		throw invalid();
+	}
+
+	const bool sameTicks = std::chrono::system_clock::period::num == header.tickPeriodNumerator
+		&& std::chrono::system_clock::period::den == header.tickPeriodDenominator;
+	const long double tickScale = static_cast<long double>(header.tickPeriodNumerator) * std::chrono::system_clock::period::den
+		/ (static_cast<long double>(header.tickPeriodDenominator) * std::chrono::system_clock::period::num);
+	std::vector<std::int64_t> convertedTimeStamps;
+
+	// loaded apart from the group, which takes them only once all have loaded
+	std::vector<std::unique_ptr<Stock, StockDeleter>> loaded;
+	loaded.reserve(header.stockCount);
+	SymbolTable loadedSymbols;
+	for (std::uint32_t t = 0; t < header.stockCount; ++t)
+	{
+		SnapshotStock entry;
+		std::memcpy(&entry, data + sizeof(header) + t * sizeof(SnapshotStock), sizeof(entry));
+		if (entry.symbolOffset > size
+			|| entry.symbolLength > size - entry.symbolOffset
+			|| entry.type > PREFERRED_STOCK
+			|| entry.tradesOffset % 8 != 0
+			|| entry.tradesOffset > size
+			|| entry.tradeCount > (size - entry.tradesOffset) / SNAPSHOT_TRADE_SIZE
+			|| getSnapshotTradesSize(entry.tradeCount) > size - entry.tradesOffset)
+		{
+			throw invalid();
+		}
+
+		const StockSymbol symbol(reinterpret_cast<const char*>(data + entry.symbolOffset), entry.symbolLength);
+		StockId existing;
+		if (loadedSymbols.find(symbol, existing))
+		{
+			throw invalid();
+		}
+		loadedSymbols.add(symbol);
+
+		const std::size_t count = static_cast<std::size_t>(entry.tradeCount);
+		const unsigned char* columns = data + entry.tradesOffset;
+		const std::int64_t* timeStamps = reinterpret_cast<const std::int64_t*>(columns);
+		const double* prices = reinterpret_cast<const double*>(columns + count * sizeof(std::int64_t));
+		const unsigned int* quantities = reinterpret_cast<const unsigned int*>(columns + count * (sizeof(std::int64_t) + sizeof(double)));
+		const unsigned char* buyOrSellTypes = columns + count * (sizeof(std::int64_t) + sizeof(double) + sizeof(std::uint32_t));
+		if (!sameTicks)
+		{
+			convertedTimeStamps.resize(count);
+			for (std::size_t trade = 0; trade < count; ++trade)
+			{
+				convertedTimeStamps[trade] = static_cast<std::int64_t>(timeStamps[trade] * tickScale);
+			}
+			timeStamps = convertedTimeStamps.data();
+		}
+
+		try
+		{
+			loaded.push_back(makeStock(symbol,
+				static_cast<StockType>(entry.type),
+				entry.lastDividend,
+				entry.parValue,
+				entry.fixedDividend));
+			TradeRecord& tradeRecord = loaded.back()->accessTradeRecord();
+			configureTradeRecord(tradeRecord);
+			tradeRecord.setTickSize(entry.tickSize);
+			tradeRecord.restoreTrades(timeStamps, prices, quantities, buyOrSellTypes, count);
+		}
+		catch (const std::invalid_argument&)
+		{
+			throw invalid();
+		}
+	}
+
+	for (auto& stock : loaded)
+	{
+		insertStock(std::move(stock));
+	}
+}
+
+// Changes the window over which the All Share Index is maintained, setting the
+// window of every stock's TradeRecord to match. Stocks added later use it too.
+// The window must be positive or an invalid_argument is thrown.
+//
+void StockGroup::setIndexWindow(std::chrono::minutes windowIn)
+{
+	if (windowIn <= std::chrono::minutes::zero())
+	{
+		throw std::invalid_argument("StockGroup::setIndexWindow:\twindow must be positive.");
+	}
+	ExclusiveStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+	indexWindow = windowIn;
+	for (Stock* stock : stocks)
+	{
+		// notifies this group, refreshing the constituent
+		stock->accessTradeRecord().setWindow(indexWindow);
+	}
+}
+
+// Sets the clock the group and every stock's TradeRecord take the present moment from,
+// including stocks added later, and recalculates the index as of that clock's present
+// moment. The clock must outlive the group. The system clock is used until this is called.
+//
+void StockGroup::setClock(const Clock& clockIn)
+{
+	ExclusiveStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+	clock.store(&clockIn);
+	// expiry times from the old clock mean nothing to the new one, so every stock is requeued
+	for (auto& shard : shards)
+	{
+		shard->expiryQueue = decltype(shard->expiryQueue)();
+	}
+	for (StockId id = 0; id < stocks.size(); ++id)
+	{
+		constituents[id].expiryTime = TimeStamp::max();
+		// notifies this group, refreshing the constituent
+		stocks[id]->accessTradeRecord().setClock(clockIn);
+	}
+}
+
+// Internal utility; recalculates a constituent's windowed VWSP and updates its shard's
+// index sums. The stock's shard must be locked.
+//
+void StockGroup::refreshConstituent(StockId id)
+{
+	assert(id < constituents.size());
+	Shard& shard = accessShard(id);
+	IndexConstituent& constituent = constituents[id];
+	const TradeRecord& tradeRecord = stocks[id]->accessTradeRecord();
+
+	bool foundTrades;
+	const double vwsPrice = tradeRecord.calculateVolumeWeightedStockPriceWithin(foundTrades, indexWindow);
+
+	if (constituent.hasPrice)
+	{
+		shard.sumOfLogPrices -= constituent.logPrice;
+		--shard.pricedCount;
+	}
+	constituent.price = vwsPrice;
+	constituent.hasPrice = vwsPrice > 0.0;
+	if (constituent.hasPrice)
+	{
+		constituent.logPrice = std::log(vwsPrice);
+		shard.sumOfLogPrices += constituent.logPrice;
+		++shard.pricedCount;
+	}
+
+	const TimeStamp expiryTime = tradeRecord.getWindowExpiryTime();
+	if (expiryTime != constituent.expiryTime)
+	{
+		constituent.expiryTime = expiryTime;
+		if (TimeStamp::max() != expiryTime)
+		{
+			shard.expiryQueue.push(ExpiryEntry(expiryTime, id));
+		}
+	}
+
+	const std::size_t recordMemoryUsage = tradeRecord.getMemoryUsage();
+	shard.memoryUsage += recordMemoryUsage - constituent.memoryUsage;
+	constituent.memoryUsage = recordMemoryUsage;
+	if (memoryBudget > 0 && shard.memoryUsage > memoryBudget / shards.size() && !shard.enforcingMemoryBudget)
+	{
+		enforceMemoryBudget(shard);
+	}
+
+	if (++shard.updatesSinceRebuild >= shard.members.size())
+	{
+		rebuildIndexSums(shard);
+	}
+	publishIndex(shard);
+
+	for (auto& windowedIndex : windowedIndices)
+	{
+		if (id < windowedIndex->touched.size() && !windowedIndex->touched[id])
+		{
+			windowedIndex->touched[id] = true;
+			windowedIndex->touchedStocks[id % shards.size()].push_back(id);
+		}
+	}
+
+	if (dispatcher->hasSubscriptions() && !constituent.changed)
+	{
+		constituent.changed = true;
+		shard.changedStocks.push_back(id);
+		dispatcher->signal();
+	}
+}
+
+// Internal utility; refreshes every member of the shard whose window has had trades
+// expire by now. The shard must be locked.
+//
+void StockGroup::expireConstituents(Shard& shard, TimeStamp now)
+{
+	while (!shard.expiryQueue.empty() && shard.expiryQueue.top().first < now)
+	{
+		const ExpiryEntry entry = shard.expiryQueue.top();
+		shard.expiryQueue.pop();
+		if (constituents[entry.second].expiryTime == entry.first)
+		{
+			// force the entry to be pushed again if the expiry time is unchanged
+			constituents[entry.second].expiryTime = TimeStamp::max();
+			refreshConstituent(static_cast<StockId>(entry.second));
+		}
+	}
+}
+
+// Internal utility; sums the log prices of the shard's members from scratch.
+// The shard must be locked.
+//
+void StockGroup::rebuildIndexSums(Shard& shard)
+{
+	shard.sumOfLogPrices = 0.0;
+	shard.pricedCount = 0;
+	for (StockId id : shard.members)
+	{
+		if (constituents[id].hasPrice)
+		{
+			shard.sumOfLogPrices += constituents[id].logPrice;
+			++shard.pricedCount;
+		}
+	}
+	shard.updatesSinceRebuild = 0;
+}
+
+// Internal utility; publishes the shard's index sums for getPublishedAllShareIndex.
+// The shard must be locked.
+//
+void StockGroup::publishIndex(Shard& shard)
+{
+	IndexPartial partial;
+	partial.sumOfLogPrices = shard.sumOfLogPrices;
+	partial.pricedCount = shard.pricedCount;
+	partial.memberCount = shard.members.size();
+	shard.publishedIndex.store(partial);
+}
+
+// Internal utility; returns the values of the given stock subscriptions watch.
+// The stock's shard must be locked.
+//
+StockValues StockGroup::readStockValues(StockId id)const
+{
+	StockValues values;
+	values.stockId = id;
+	values.volumeWeightedStockPrice = constituents[id].price;
+	values.lastPrice = stocks[id]->accessTradeRecord().getSnapshot().lastPrice;
+	return values;
+}
+
+// Internal utility; the dispatcher's Collector. Refreshes every stock whose window
+// has had trades expire, then fills 'changed' with the values of every stock in any
+// shard's changedStocks, emptying them, and returns the All Share Index as published.
+// untilNextChange is set to how long until trades next leave any stock's window, by
+// the group's clock, but at least MIN_EXPIRY_WAIT.
+//
+double StockGroup::collectChanges(std::vector<StockValues>& changed, std::chrono::microseconds& untilNextChange)
+{
+	SharedStocksLock lock(stocksMutex);
+	const TimeStamp now = clock.load()->now();
+	TimeStamp nextExpiry = TimeStamp::max();
+	for (auto& shard : shards)
+	{
+		std::lock_guard<std::mutex> shardLock(shard->mutex);
+		expireConstituents(*shard, now);
+		if (!shard->expiryQueue.empty())
+		{
+			nextExpiry = std::min(nextExpiry, shard->expiryQueue.top().first);
+		}
+		for (StockId id : shard->changedStocks)
+		{
+			constituents[id].changed = false;
+			changed.push_back(readStockValues(id));
+		}
+		shard->changedStocks.clear();
+	}
+	untilNextChange = (TimeStamp::max() == nextExpiry)
+		? std::chrono::microseconds::max()
+		: std::max(MIN_EXPIRY_WAIT, std::chrono::duration_cast<std::chrono::microseconds>(nextExpiry - now));
+	return getPublishedAllShareIndex();
+}
+
+// Subscribes to changes in a value, returning the subscription's id. 'callback' is
+//	called on the group's dispatcher thread, with every change to the subscription
+//	since its last call, whenever the value moves by more than 'threshold' from the
+//	value last delivered; a threshold of zero delivers every change.
+//	VOLUME_WEIGHTED_STOCK_PRICE (over the index window) and LAST_PRICE are watched
+//	for the stock stockId, or for every stock, including those added later, when
+//	stockId is EVERY_STOCK; stockId is ignored for ALL_SHARE_INDEX, which is taken
+//	as getPublishedAllShareIndex would be.
+//	Only stocks which have had trades added, or expired from their window or by
+//	retention, since the dispatcher's last pass are looked at, and while there are no
+//	subscriptions adding trades does no extra work. The dispatcher thread wakes by
+//	itself when trades next leave a stock's window, so windowed prices change for
+//	subscribers even while no trades arrive, as the group's clock passes the expiry
+//	time; a clock that only moves when advanced is looked at again no sooner than
+//	MIN_EXPIRY_WAIT later. Trades must be added through the
+//	group, rather than directly to a stock's TradeRecord, while subscriptions exist.
+//	A callback may call the group's methods, other than flushNotifications.
+//	Throws an invalid_argument if the stock does not exist, threshold is negative or
+//	callback is empty.
+//
+SubscriptionId StockGroup::subscribe(SubscribedValue subscribedValue,
+	StockId stockId,
+	double threshold,
+	ChangeCallback callback)
+{
+	const bool allStocks = ALL_SHARE_INDEX == subscribedValue || EVERY_STOCK == stockId;
+	if (!allStocks && !hasStock(stockId))
+	{
+		throw std::invalid_argument("StockGroup::subscribe:\tstock id does not exist.");
+	}
+
+	return dispatcher->subscribe(subscribedValue, stockId, threshold, std::move(callback),
+		[&](std::vector<StockValues>& current, double& currentIndex)
+	{
+		SharedStocksLock lock(stocksMutex);
+		auto shardLocks = lockAllShards();
+		if (ALL_SHARE_INDEX == subscribedValue)
+		{
+			// index subscriptions need no stock values
+		}
+		else if (allStocks)
+		{
+			current.reserve(stocks.size());
+			for (StockId id = 0; id < stocks.size(); ++id)
+			{
+				current.push_back(readStockValues(id));
+			}
+		}
+		else
+		{
+			current.push_back(readStockValues(stockId));
+		}
+		currentIndex = getPublishedAllShareIndex();
+	});
+}
+
+// Removes a subscription. Its callback may still be called by a delivery already
+//	under way; call flushNotifications afterwards to be sure it will not be.
+//	Throws an invalid_argument if there is no such subscription.
+//
+void StockGroup::unsubscribe(SubscriptionId id)
+{
+	dispatcher->unsubscribe(id);
+}
+
+// Sets the shortest time between deliveries to subscribers, so that changes are
+//	gathered into larger batches at the cost of later delivery. Zero, the default,
+//	delivers as soon as the dispatcher thread wakes.
+//
+void StockGroup::setNotificationInterval(std::chrono::microseconds interval)
+{
+	dispatcher->setBatchInterval(interval);
+}
+
+// Waits until every change made before the call has been delivered to subscribers
+//
+void StockGroup::flushNotifications()
+{
+	dispatcher->flush();
+}
+
+// Called by a stock's TradeRecord after trades have been added to it
+//
+void StockGroup::onTradesChanged(std::size_t key)
+{
+	refreshConstituent(static_cast<StockId>(key));
+}
+
+// Returns the incrementally maintained All Share Index, using each stock's Volume
+//	Weighted Stock Price over the index window. This is the geometric mean computed
+//	from a running sum of logarithms, so it costs only the work needed to expire
+//	trades that have left any stock's window since the last call. Each shard's
+//	stocks are expired on one of the index threads.
+//	Returns 0.0 if the group is empty or any stock has no price within the window.
+//
+double StockGroup::calculateAllShareIndex()
+{
+	SharedStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+	const TimeStamp now = clock.load()->now();
+
+	runTasks(shards.size(), [&](std::size_t shard)
+	{
+		expireConstituents(*shards[shard], now);
+	});
+
+	double sumOfLogPrices = 0.0;
+	std::size_t pricedCount = 0;
+	for (const auto& shard : shards)
+	{
+		sumOfLogPrices += shard->sumOfLogPrices;
+		pricedCount += shard->pricedCount;
+	}
+
+	if (constituents.empty() || pricedCount < constituents.size())
+	{
+		return 0.0;
+	}
+	return std::exp(sumOfLogPrices / constituents.size());
+}
+
+// Returns the All Share Index as published after the most recent change to any stock's
+//	windowed Volume Weighted Stock Price, without taking any lock, so that any number
+//	of threads may poll it without ever stalling threads adding trades.
+//	Returns 0.0 if the group is empty or any stock has no price within the window.
+//
+double StockGroup::getPublishedAllShareIndex()const
+{
+	double sumOfLogPrices = 0.0;
+	std::size_t pricedCount = 0;
+	std::size_t memberCount = 0;
+	for (const auto& shard : shards)
+	{
+		const IndexPartial partial = shard->publishedIndex.load();
+		sumOfLogPrices += partial.sumOfLogPrices;
+		pricedCount += partial.pricedCount;
+		memberCount += partial.memberCount;
+	}
+
+	if (0 == memberCount || pricedCount < memberCount)
+	{
+		return 0.0;
+	}
+	return std::exp(sumOfLogPrices / memberCount);
 }
 
 // Returns the All Share Index for the map, using a Volume Weighted Stock Price
 //	based on trades over the last 'min' minutes.
+//	When 'min' is the index window this returns the maintained index. Otherwise the
+//	index over 'min' is kept from one call to the next, for a few recently used
+//	windows, and each call recomputes only the stocks which have had trades added,
+//	or trades leave 'min', since the last, in blocks shared across the index threads
+//	(see setIndexThreadCount). The first call for a window computes every stock.
+//	Other changes to a stock's trades, such as its retention policy, must be made
+//	through the group to be seen.
 //
 double StockGroup::calculateAllShareIndexWithin(std::chrono::minutes min)
 {
-	std::vector<double> vwsPrices;
+	SUPERSIMPLESTOCKS_METRICS_TIME(ALL_SHARE_INDEX_WITHIN_NANOSECONDS);
+	if (min == getIndexWindow())
+	{
+		return calculateAllShareIndex();
+	}
+
+	SharedStocksLock lock(stocksMutex);
+	auto shardLocks = lockAllShards();
+	if (stocks.empty())
+	{
+		return 0.0;
+	}
+	return evaluateWindowedIndex(accessWindowedIndex(min));
+}
+
+// Internal utility; returns the WindowedIndex for 'window', making it if need be.
+// Every shard must be locked.
+//
+StockGroup::WindowedIndex& StockGroup::accessWindowedIndex(std::chrono::minutes window)
+{
+	++windowedIndexCalls;
+	for (auto& windowedIndex : windowedIndices)
+	{
+		if (windowedIndex->window == window)
+		{
+			windowedIndex->lastUsed = windowedIndexCalls;
+			return *windowedIndex;
+		}
+	}
+
+	if (windowedIndices.size() >= MAX_WINDOWED_INDICES)
+	{
+		windowedIndices.erase(std::min_element(windowedIndices.begin(), windowedIndices.end(),
+			[](const std::unique_ptr<WindowedIndex>& a, const std::unique_ptr<WindowedIndex>& b)
+		{
+			return a->lastUsed < b->lastUsed;
+		}));
+	}
+	std::unique_ptr<WindowedIndex> windowedIndex(new WindowedIndex);
+	windowedIndex->window = window;
+	windowedIndex->clock = nullptr;
+	windowedIndex->evaluatedAt = TimeStamp::min();
+	windowedIndex->sumOfLogPrices = 0.0;
+	windowedIndex->pricedCount = 0;
+	windowedIndex->updatesSinceRebuild = 0;
+	windowedIndex->touchedStocks.resize(shards.size());
+	windowedIndex->lastUsed = windowedIndexCalls;
+	windowedIndices.push_back(std::move(windowedIndex));
+	return *windowedIndices.back();
+}
+
+// Internal utility; brings the index up to date as of now and returns its value.
+// Every shard must be locked.
+//
+double StockGroup::evaluateWindowedIndex(WindowedIndex& index)
+{
+	const Clock* const currentClock = clock.load();
+	const TimeStamp now = currentClock->now();
+	if (index.clock != currentClock || now < index.evaluatedAt)
+	{
+		// trades may have re-entered the window, so start again from nothing
+		index.logPrices.clear();
+		index.hasPrices.clear();
+		index.expiryTimes.clear();
+		index.touched.clear();
+		for (auto& touchedStocks : index.touchedStocks)
+		{
+			touchedStocks.clear();
+		}
+		index.expiryQueue = ExpiryQueue();
+		index.sumOfLogPrices = 0.0;
+		index.pricedCount = 0;
+		index.updatesSinceRebuild = 0;
+		index.clock = currentClock;
+	}
+	index.evaluatedAt = now;
+
+	// List the stocks to recompute: those added since the last evaluation, those
+	// refreshed, and those with trades that have since left the window
+	std::vector<StockId>& dirtyStocks = index.dirtyStocks;
+	dirtyStocks.clear();
+	for (StockId id = static_cast<StockId>(index.touched.size()); id < stocks.size(); ++id)
+	{
+		dirtyStocks.push_back(id);
+	}
+	index.logPrices.resize(stocks.size(), 0.0);
+	index.hasPrices.resize(stocks.size(), false);
+	index.expiryTimes.resize(stocks.size(), TimeStamp::max());
+	index.touched.resize(stocks.size(), true);
+	for (auto& touchedStocks : index.touchedStocks)
+	{
+		dirtyStocks.insert(dirtyStocks.end(), touchedStocks.begin(), touchedStocks.end());
+		touchedStocks.clear();
+	}
+	while (!index.expiryQueue.empty() && index.expiryQueue.top().first < now)
+	{
+		const ExpiryEntry entry = index.expiryQueue.top();
+		index.expiryQueue.pop();
+		if (index.expiryTimes[entry.second] == entry.first)
+		{
+			// force the entry to be pushed again if the expiry time is unchanged
+			index.expiryTimes[entry.second] = TimeStamp::max();
+			if (!index.touched[entry.second])
+			{
+				index.touched[entry.second] = true;
+				dirtyStocks.push_back(static_cast<StockId>(entry.second));
+			}
+		}
+	}
+
+	// The dirty stocks are priced in blocks across the index threads, then applied to
+	// the sums in order, so the result does not depend on the thread count
+	index.dirtyPrices.resize(dirtyStocks.size());
+	index.dirtyExpiryTimes.resize(dirtyStocks.size());
+	const std::size_t blockCount = (dirtyStocks.size() + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+	runTasks(blockCount, [&](std::size_t block)
+	{
+		const std::size_t end = std::min(dirtyStocks.size(), (block + 1) * INDEX_BLOCK_SIZE);
+		for (std::size_t d = block * INDEX_BLOCK_SIZE; d < end; ++d)
+		{
+			const TradeRecord& tradeRecord = stocks[dirtyStocks[d]]->accessTradeRecord();
+			// the expiry time is taken first so that a trade leaving the window in between
+			// brings the stock back at the next evaluation rather than being missed
+			index.dirtyExpiryTimes[d] = tradeRecord.getExpiryTimeWithin(index.window);
+			bool foundTrades;
+			index.dirtyPrices[d] = tradeRecord.calculateVolumeWeightedStockPriceWithin(foundTrades, index.window);
+		}
+	});
+
+	for (std::size_t d = 0; d < dirtyStocks.size(); ++d)
+	{
+		const StockId id = dirtyStocks[d];
+		if (index.hasPrices[id])
+		{
+			index.sumOfLogPrices -= index.logPrices[id];
+			--index.pricedCount;
+		}
+		index.hasPrices[id] = index.dirtyPrices[d] > 0.0;
+		if (index.hasPrices[id])
+		{
+			index.logPrices[id] = std::log(index.dirtyPrices[d]);
+			index.sumOfLogPrices += index.logPrices[id];
+			++index.pricedCount;
+		}
+		if (index.dirtyExpiryTimes[d] != index.expiryTimes[id])
+		{
+			index.expiryTimes[id] = index.dirtyExpiryTimes[d];
+			if (TimeStamp::max() != index.dirtyExpiryTimes[d])
+			{
+				index.expiryQueue.push(ExpiryEntry(index.dirtyExpiryTimes[d], id));
+			}
+		}
+		index.touched[id] = false;
+	}
+	SUPERSIMPLESTOCKS_METRICS_COUNT(INDEX_STOCKS_RECOMPUTED, dirtyStocks.size());
 
-	for (auto itr : stocks)
+	index.updatesSinceRebuild += dirtyStocks.size();
+	if (index.updatesSinceRebuild >= stocks.size())
 	{
-		bool foundTrades;
-		vwsPrices.push_back(itr.second->accessTradeRecord().calculateVolumeWeightedStockPriceWithin(foundTrades, min));
+		index.sumOfLogPrices = 0.0;
+		for (StockId id = 0; id < stocks.size(); ++id)
+		{
+			if (index.hasPrices[id])
+			{
+				index.sumOfLogPrices += index.logPrices[id];
+			}
+		}
+		index.updatesSinceRebuild = 0;
 	}
 
-	if (vwsPrices.empty())
+	// The mean is taken over logarithms so that large groups cannot overflow or underflow
+	// a running product. As with the product, any price of zero gives a mean of zero.
+	if (index.pricedCount < stocks.size())
 	{
 		return 0.0;
 	}
-	return calculateGeometricMean(vwsPrices);
+	return std::exp(index.sumOfLogPrices / stocks.size());
 }
 
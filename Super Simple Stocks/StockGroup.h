@@ -3,62 +3,526 @@
 *	
 *	A StockGroup class managed a collection of stocks ordered for fast retrieval via
 *	their StockSymbol, while also providing methods to query the Stocks stored.
+*	Each stock is also given a dense StockId when added, which can be resolved once
+*	and then used to reach the stock without any symbol lookup.
 *	Note that StockGroup maintains memory ownership of the stocks added to it.
 */
 #pragma once
 #ifndef SUPERSIMPLESTOCKS_STOCKGROUP
 #define SUPERSIMPLESTOCKS_STOCKGROUP
+#include"Allocator.h"
+#include"BatchPricing.h"
+#include"ChangeDispatcher.h"
+#include"Clock.h"
+#include"SeqLock.h"
 #include"Stock.h"
-#include<map>
+#include"SymbolTable.h"
+#include"WorkerPool.h"
 #include<vector>
-#include<numeric>
+#include<atomic>
+#include<cmath>
+#include<cstdint>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<queue>
+#include<shared_mutex>
+#include<stdexcept>
+#include<utility>
 #include<cassert>
 
+class TradeJournal;
+
+/* A trade for a particular stock, as passed to StockGroup::addTrades
+*/
+struct StockTrade
+{
+	StockId stockId;
+	Trade trade;
+};
+
 /* Maintains a group of Stocks for efficient lookup.
-*   
+*   The group also maintains the All Share Index incrementally: each stock's windowed
+*	Volume Weighted Stock Price contributes its logarithm to a running sum, which is
+*	updated whenever trades are added to that stock or expire from its window.
+*
+*	Stocks are partitioned into shards by StockId, each shard holding its own lock and
+*	its own part of the index sums. The group's addTrade and addTrades methods, along
+*	with its queries and settings, are safe to call from many threads at once: trades
+*	for stocks in different shards are ingested in parallel, while index calculations
+*	lock every shard to read a consistent view. Adding trades directly through a
+*	stock's TradeRecord bypasses the locks, and is only safe with a single thread.
+*
+*	Changes to each stock's windowed Volume Weighted Stock Price and last price, and to
+*	the All Share Index, can be subscribed to rather than polled for; see subscribe.
+*
+*	Stocks and the chunks holding their trades are allocated from the group's Allocator,
+*	by default a PoolAllocator of the group's own: stocks are packed together in its
+*	slabs, chunks released by retention are reused for new trades, slabs left unused
+*	are returned to the heap, and all of it is returned when the group is destroyed.
 */
-class StockGroup
+class StockGroup : private TradeRecordListener
 {
 protected:
-	std::map<StockSymbol, Stock*> stocks;
+	// Memory for the stocks and their trades. ownedAllocator is set when the group made
+	// its own allocator, and is declared first so that it outlives the stocks.
+	//
+	std::unique_ptr<Allocator> ownedAllocator;
+	Allocator* allocator;
+
+	// Destroys a stock and returns its memory to the allocator
+	//
+	struct StockDeleter
+	{
+		Allocator* allocator;
+
+		void operator()(Stock* stock)const
+		{
+			stock->~Stock();
+			allocator->deallocate(stock, sizeof(Stock), alignof(Stock));
+		}
+	};
+
+	// Interned symbols of the stocks in the group; a stock's StockId indexes 'stocks'.
+	// stocksMutex is held exclusively while stocks are added and group wide settings
+	// change, and shared by everything else.
+	//
+	SymbolTable symbols;
+	std::vector<Stock*> stocks;
+	mutable std::shared_timed_mutex stocksMutex;
+
+	// The dividend fields of every stock, indexed by StockId, for batch pricing.
+	// Stocks' dividends never change, so these are only appended to, as stocks are added.
+	//
+	PricingParameters pricingParameters;
+
+	// A stock's contribution to the incrementally maintained All Share Index.
+	// price is the stock's windowed Volume Weighted Stock Price as last refreshed, and
+	// logPrice its logarithm, only meaningful when hasPrice is true, which is when the
+	// price is positive. expiryTime is when trades next leave the stock's window.
+	// changed is true while the stock is in its shard's changedStocks.
+	//
+	struct IndexConstituent
+	{
+		double price;
+		double logPrice;
+		bool hasPrice;
+		bool changed;
+		TimeStamp expiryTime;
+		std::size_t memoryUsage;
+	};
+
+	typedef std::pair<TimeStamp, std::size_t> ExpiryEntry;
+	typedef std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, std::greater<ExpiryEntry>> ExpiryQueue;
+
+	// One entry per stock, indexed by StockId. The id is also the key a stock's
+	// TradeRecord notifies the group with. An entry is only touched under its shard's lock.
+	//
+	std::vector<IndexConstituent> constituents;
+
+	// A shard's part of the index as published for lock free readers
+	//
+	struct IndexPartial
+	{
+		double sumOfLogPrices;
+		std::size_t pricedCount;
+		std::size_t memberCount;
+	};
+
+	// The stocks whose StockId modulo the shard count is the shard's position, with their
+	// part of the index and memory accounting. Every member is guarded by 'mutex'.
+	//
+	struct Shard
+	{
+		std::mutex mutex;
+		std::vector<StockId> members;
+
+		// Sum of logPrice over members with a price, and the number of such members
+		//
+		double sumOfLogPrices;
+		std::size_t pricedCount;
+
+		// Number of constituent updates since sumOfLogPrices was last summed from scratch.
+		// Rebuilding once this reaches the number of members bounds rounding drift at
+		// amortized constant cost.
+		//
+		std::size_t updatesSinceRebuild;
+
+		// Min-heap of (expiryTime, StockId) for members with trades in their window.
+		// Entries whose time no longer matches the constituent's expiryTime are stale and skipped.
+		//
+		ExpiryQueue expiryQueue;
+
+		// Memory held for trades by the members, as last reported by each constituent
+		//
+		std::size_t memoryUsage;
+
+		// True while enforceMemoryBudget is releasing trades, so that it is not re-entered
+		//
+		bool enforcingMemoryBudget;
+
+		// Reused by addTrades to pass each stock's run of a batch to its TradeRecord
+		//
+		std::vector<Trade> batchRun;
+
+		// Members refreshed since the dispatcher last collected changes, recorded only
+		// while there are subscriptions
+		//
+		std::vector<StockId> changedStocks;
+
+		// The shard's index sums as of its last change. Stored under 'mutex', so only
+		// one thread stores at a time, but loaded without it.
+		//
+		SeqLock<IndexPartial> publishedIndex;
+
+		Shard();
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards;
+
+	// Window used by each stock's TradeRecord and therefore by the maintained index
+	//
+	std::chrono::minutes indexWindow;
+
+	// Retention policy given to every stock's TradeRecord
+	//
+	RetentionPolicy retention;
+
+	// Limit on the memory held for trades across the whole group, zero if unset.
+	// Each shard is held to an equal share of it.
+	//
+	std::size_t memoryBudget;
+
+	// Journal recording every trade added to the group, if any; not owned
+	//
+	TradeJournal* journal;
+
+	// Where the group and its stocks take the present moment from; not owned.
+	// Only changed under an exclusive lock of stocksMutex, but read by addTrade before
+	// any lock is taken.
+	//
+	std::atomic<const Clock*> clock;
+
+	// Internal utility; returns the shard holding the given stock
+	//
+	Shard& accessShard(StockId id)const
+	{
+		return *shards[id % shards.size()];
+	}
+
+	// Internal utility; locks every shard, in order.
+	//
+	std::vector<std::unique_lock<std::mutex>> lockAllShards()const;
+
+	// Internal utility; returns query(record) for the given stock's TradeRecord, called
+	// under the lock of the stock's shard. Throws an invalid_argument if the stock does
+	// not exist.
+	//
+	template<typename Query>
+	auto queryTradeRecord(StockId id, Query query)const -> decltype(query(std::declval<const TradeRecord&>()))
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		const Stock& stock = accessStockUnlocked(id);
+		std::lock_guard<std::mutex> shardLock(accessShard(id).mutex);
+		return query(stock.accessTradeRecord());
+	}
+
+	// Internal utility; releases the oldest chunks of trades across the shard, oldest
+	// first, until its memory usage is back below 90% of its share of the budget.
+	// Leaving headroom means the budget is enforced rarely and its cost is amortized
+	// across many inserts. The shard must be locked.
+	//
+	void enforceMemoryBudget(Shard& shard);
+
+	// Internal utility; recalculates a constituent's windowed VWSP and updates its shard's
+	// index sums. The stock's shard must be locked.
+	//
+	void refreshConstituent(StockId id);
+
+	// Internal utility; refreshes every member of the shard whose window has had trades
+	// expire by now. The shard must be locked.
+	//
+	void expireConstituents(Shard& shard, TimeStamp now);
+
+	// Internal utility; sums the log prices of the shard's members from scratch.
+	// The shard must be locked.
+	//
+	void rebuildIndexSums(Shard& shard);
+
+	// Internal utility; builds a Stock in the group's allocator using the given fields.
+	// See Stock's constructor for potential exceptions when supplying these fields.
+	//
+	std::unique_ptr<Stock, StockDeleter> makeStock(StockSymbol symbolIn,
+		StockType typeIn,
+		double lastDividendIn,
+		double parValueIn,
+		double fixedDividendIn);
+
+	// Internal utility; gives the stock's TradeRecord the group's clock, window and
+	// retention policy. The caller must hold stocksMutex exclusively.
+	//
+	void configureTradeRecord(TradeRecord& tradeRecord);
+
+	// Internal utility; adds a stock built by makeStock to the group, returning its
+	// StockId. If a stock of that symbol already exists in the group, an InvalidOperation
+	// is thrown. The caller must hold stocksMutex exclusively.
+	//
+	StockId insertStock(std::unique_ptr<Stock, StockDeleter> stock);
+
+	// Internal utility; under the lock of the stock's shard, checks the trade can be added,
+	// records it in the journal, if any, then adds it.
+	//
+	void addStockTrade(const StockTrade& stockTrade);
+
+	// Internal utility; checks every stockId in the batch, then merges each stock's trades
+	// into its TradeRecord under the lock of the stock's shard. If 'journalling' and the
+	// group has a journal, every trade is checked against its stock's tick size and the
+	// batch recorded in the journal before any is merged, with every shard the batch
+	// touches locked throughout. The caller must hold stocksMutex.
+	//
+	void mergeTrades(const StockTrade* trades, std::size_t count, bool journalling);
+
+	// Internal utility; publishes the shard's index sums for getPublishedAllShareIndex.
+	// The shard must be locked.
+	//
+	void publishIndex(Shard& shard);
 
-	// Internal utility for calculating the nth root of the given value
+	// Delivers changes to subscribers. Stopped by the destructor before the stocks are
+	// destroyed, as its thread reads them.
 	//
-	static inline double nthRoot(double value, double n)
+	std::unique_ptr<ChangeDispatcher> dispatcher;
+
+	// The shortest time the dispatcher waits for trades to leave a window, so that a clock
+	// standing still at an expiry time is not looked at over and over
+	//
+	static const std::chrono::microseconds MIN_EXPIRY_WAIT;
+
+	// Internal utility; returns the values of the given stock subscriptions watch.
+	// The stock's shard must be locked.
+	//
+	StockValues readStockValues(StockId id)const;
+
+	// Internal utility; the dispatcher's Collector. Refreshes every stock whose window
+	// has had trades expire, then fills 'changed' with the values of every stock in any
+	// shard's changedStocks, emptying them, and returns the All Share Index as published.
+	// untilNextChange is set to how long until trades next leave any stock's window, by
+	// the group's clock, but at least MIN_EXPIRY_WAIT.
+	//
+	double collectChanges(std::vector<StockValues>& changed, std::chrono::microseconds& untilNextChange);
+
+	// Internal utility; looks up a stock by id without locking
+	//
+	Stock& accessStockUnlocked(StockId id)const
 	{
-		assert(n != 0);
-		return std::pow(value, 1.0 / n);
+		if (id >= stocks.size())
+		{
+			throw std::invalid_argument("StockGroup::accessStock:\tstock id does not exist");
+		}
+		return *stocks[id];
 	}
 
-	// Internal utility; calculates the Geometric Mean of the given array of values
+	// Called by a stock's TradeRecord after trades have been added to it
+	//
+	void onTradesChanged(std::size_t key) override;
+
+	// Threads sharing index calculations, or null to calculate on the calling thread
+	//
+	std::unique_ptr<WorkerPool> workerPool;
+
+	// Number of consecutive stocks making up each block of a scanned index calculation.
+	// Blocks are the unit of work shared among the worker pool, and their partial sums
+	// are combined in block order so the result does not depend on the thread count.
+	//
+	static const std::size_t INDEX_BLOCK_SIZE = 256;
+
+	// Internal utility; calls function(t) for each t in [0, taskCount), spread across the
+	// worker pool if there is one.
 	//
-	static double inline calculateGeometricMean(const std::vector<double> &values)
+	void runTasks(std::size_t taskCount, const std::function<void(std::size_t)>& function)const
 	{
-		assert(!values.empty());
-		const double n = values.size();
-		const double product = std::accumulate(std::cbegin(values), std::end(values), 1.0, std::multiplies<double>());
-		return nthRoot(product, n);
+		if (workerPool)
+		{
+			workerPool->run(taskCount, function);
+		}
+		else
+		{
+			for (std::size_t t = 0; t < taskCount; ++t)
+			{
+				function(t);
+			}
+		}
 	}
 
+	// The All Share Index over a window other than the index window, kept between calls
+	// of calculateAllShareIndexWithin for that window so that each call recomputes only
+	// the stocks which have been refreshed, or had trades leave the window, since the
+	// last. refreshConstituent marks a stock in 'touched' and its shard's list of
+	// touchedStocks under the shard's lock; everything else is only used with every
+	// shard locked.
+	//
+	struct WindowedIndex
+	{
+		std::chrono::minutes window;
+
+		// The clock the index was last evaluated by, and its time then. A different clock,
+		// or an earlier time, and every stock is recomputed.
+		//
+		const Clock* clock;
+		TimeStamp evaluatedAt;
+
+		// Each stock's last log price, only meaningful where hasPrices is set, and the time
+		// after which its oldest trade in the window leaves it, indexed by StockId.
+		// Stocks added since the last evaluation are beyond the end of these.
+		//
+		std::vector<double> logPrices;
+		std::vector<char> hasPrices;
+		std::vector<TimeStamp> expiryTimes;
+
+		// Sum of logPrices over stocks with a price, and the number of such stocks, summed
+		// from scratch once there have been as many updates as stocks
+		//
+		double sumOfLogPrices;
+		std::size_t pricedCount;
+		std::size_t updatesSinceRebuild;
+
+		// Min-heap of (expiryTime, StockId); stale entries are skipped as for a Shard's
+		//
+		ExpiryQueue expiryQueue;
+
+		// Set for a stock while it is listed for recomputation, in its shard's touchedStocks
+		// or in dirtyStocks, so that it is listed once
+		//
+		std::vector<char> touched;
+		std::vector<std::vector<StockId>> touchedStocks;
+
+		// Reused by each evaluation for the stocks to recompute and their new values
+		//
+		std::vector<StockId> dirtyStocks;
+		std::vector<double> dirtyPrices;
+		std::vector<TimeStamp> dirtyExpiryTimes;
+
+		// The windowedIndexCalls count when the index was last evaluated
+		//
+		std::uint64_t lastUsed;
+	};
+
+	// Windows are dropped, least recently evaluated first, to keep at most this many
+	//
+	static const std::size_t MAX_WINDOWED_INDICES = 4;
+
+	std::vector<std::unique_ptr<WindowedIndex>> windowedIndices;
+	std::uint64_t windowedIndexCalls;
+
+	// Internal utility; returns the WindowedIndex for 'window', making it if need be.
+	// Every shard must be locked.
+	//
+	WindowedIndex& accessWindowedIndex(std::chrono::minutes window);
+
+	// Internal utility; brings the index up to date as of now and returns its value.
+	// Every shard must be locked.
+	//
+	double evaluateWindowedIndex(WindowedIndex& index);
+
 public:
-	
+
+	// Build an empty StockGroup with the given number of shards, which must be at least
+	// one or an invalid_argument is thrown. More shards allow more threads to add trades
+	// at once; around the number of ingesting threads is a reasonable choice.
+	// Stocks and their trades are held in memory from allocatorIn, which must outlive the
+	// group; if it is null the group makes a PoolAllocator of its own.
+	//
+	explicit StockGroup(std::size_t shardCount = 1, Allocator* allocatorIn = nullptr);
+
 	// Deconstructor: Note that StockGroup maintains memory ownership of the stocks added to it.
 	//
 	virtual ~StockGroup();
 
+	// Returns the number of stocks in the group. StockIds run from 0 to this value - 1.
+	//
+	std::size_t getStockCount()const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return stocks.size();
+	}
+
+	// Returns the number of shards the stocks are partitioned into
+	//
+	std::size_t getShardCount()const
+	{
+		return shards.size();
+	}
+
+	// Sets the number of threads used to calculate the All Share Index, counting the
+	// calling thread; one calculates on the calling thread alone, and zero uses one
+	// thread per core. Results are identical whatever the number of threads.
+	//
+	void setIndexThreadCount(std::size_t threadCount);
+
+	// Returns the number of threads used to calculate the All Share Index
+	//
+	std::size_t getIndexThreadCount()const;
+
 	// Returns true if a stock with the given symbol is in the StockGroup
 	//
-	bool hasStock(StockSymbol symbol)const;
+	bool hasStock(const StockSymbol& symbol)const;
+
+	// Returns true if a stock with the given id is in the StockGroup
+	//
+	bool hasStock(StockId id)const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return id < stocks.size();
+	}
+
+	// Returns the id of the stock with the given symbol.
+	// Throws an invalid_argument if the stock does not exist.
+	//
+	StockId getStockId(const StockSymbol& symbol)const;
+
+	// Sets id to the id of the stock whose symbol is the given characters, returning
+	// false if there is no such stock. No string is constructed.
+	//
+	bool findStockId(const char* symbol, std::size_t length, StockId& id)const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return symbols.find(symbol, length, id);
+	}
 
 	// Returns non-modifiable access to a stock with the given symbol.
 	// Throws an invalid_argument if the stock does not exist.
+	// Queries of the stock's TradeRecord through the returned reference are not locked, and
+	// must not run while other threads add trades; see calculateVolumeWeightedStockPriceWithin.
 	//
-	const Stock& accessStock(StockSymbol symbol) const;
+	const Stock& accessStock(const StockSymbol& symbol) const;
 
 	// Returns modifiable direct access to a stock with the given symbol.
 	// Throws an invalid_argument if the stock does not exist.
+	// Queries of the stock's TradeRecord through the returned reference are not locked, and
+	// must not run while other threads add trades; see calculateVolumeWeightedStockPriceWithin.
+	//
+	Stock& accessStock(const StockSymbol& symbol);
+
+	// Returns non-modifiable access to the stock with the given id.
+	// Throws an invalid_argument if the stock does not exist.
+	// Queries of the stock's TradeRecord through the returned reference are not locked, and
+	// must not run while other threads add trades; see calculateVolumeWeightedStockPriceWithin.
 	//
-	Stock& accessStock(StockSymbol symbol);
+	const Stock& accessStock(StockId id) const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return accessStockUnlocked(id);
+	}
+
+	// Returns modifiable direct access to the stock with the given id.
+	// Throws an invalid_argument if the stock does not exist.
+	// Queries of the stock's TradeRecord through the returned reference are not locked, and
+	// must not run while other threads add trades; see calculateVolumeWeightedStockPriceWithin.
+	//
+	Stock& accessStock(StockId id)
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return accessStockUnlocked(id);
+	}
 
 
 	// Method deprecated: use version below
@@ -68,19 +532,214 @@ public:
 	//
 	//void addStock(Stock*stock);
 
-	// Add a stock to the StockGroup.
+	// Add a stock to the StockGroup, returning its StockId.
 	// If a stock of that symbol already exists in the group, an InvalidOperation is thrown.
-	// This method allocates a Stock object internally using the given fields.
+	// This method builds a Stock object in the group's allocator using the given fields.
 	// See Stock's constructor for potential exceptions when supplying these fields.
 	//
-	void addStock(StockSymbol symbolIn,
+	StockId addStock(StockSymbol symbolIn,
 		StockType typeIn,
 		double lastDividendIn,
 		double parValueIn,
 		double fixedDividendIn = Stock::NO_FIXED_DIVIDEND);
 
+	// Calculates the dividend yield and P/E ratio of the stocks with ids from 0 to
+	// stockCount - 1 at each of a grid of prices, as Stock::calculateDividendYield and
+	// Stock::calculatePERatio would, but many prices at a time. 'prices' is a matrix of
+	// stockCount rows, one per stock in StockId order, of pricesPerStock prices each,
+	// stored row after row. dividendYields, peRatios and errors are filled in the same
+	// layout, the latter with the PricingError flags of each price: a price which is not
+	// positive is flagged rather than throwing. See BatchPricing.h.
+	// Returns the number of prices flagged PRICE_NOT_POSITIVE.
+	// Throws an invalid_argument if stockCount is more than the number of stocks.
+	//
+	std::size_t calculatePricing(const double* prices,
+		std::size_t stockCount,
+		std::size_t pricesPerStock,
+		double* dividendYields,
+		double* peRatios,
+		unsigned char* errors)const;
+
+	// Sets the smallest step the given stock's prices move in, under the lock of its shard,
+	// so that its prices are held in whole ticks and summed exactly; zero for none.
+	// Throws an invalid_argument if the stock does not exist.
+	// See TradeRecord::setTickSize for other exceptions.
+	//
+	void setTickSize(StockId id, double tickSize);
+
+	// Returns the given stock's Volume Weighted Stock Price over the last "min" minutes,
+	// as TradeRecord::calculateVolumeWeightedStockPriceWithin, under the lock of the
+	// stock's shard. Unlike queries of the stock's TradeRecord itself, this and the group's
+	// other per-stock queries below are safe to call while other threads add trades.
+	// Throws an invalid_argument if the stock does not exist.
+	//
+	double calculateVolumeWeightedStockPriceWithin(StockId id, bool& foundTrades, std::chrono::minutes min)const;
+
+	// Returns the given stock's Volume Weighted Stock Price over trades from startTimeStamp
+	// to endTimeStamp inclusive, as TradeRecord::calculateVolumeWeightedStockPriceBetween,
+	// under the lock of the stock's shard.
+	// Throws an invalid_argument if the stock does not exist.
+	//
+	double calculateVolumeWeightedStockPriceBetween(StockId id,
+		bool& foundTrades,
+		TimeStamp startTimeStamp,
+		TimeStamp endTimeStamp)const;
+
+	// Returns the given stock's buy and sell order flow over the last "min" minutes, as
+	// TradeRecord::calculateOrderFlowWithin, under the lock of the stock's shard.
+	// Throws an invalid_argument if the stock does not exist.
+	//
+	OrderFlow calculateOrderFlowWithin(StockId id, std::chrono::minutes min)const;
+
+	// Fills 'prices' with the given stock's Volume Weighted Stock Price over each of its
+	// horizons, as TradeRecord::calculateHorizonPrices, under the lock of the stock's shard.
+	// Throws an invalid_argument if the stock does not exist.
+	//
+	void calculateHorizonPrices(StockId id, std::vector<HorizonPrice>& prices)const;
+
+	// Adds a Trade to the given stock, using the present moment of the group's clock as its
+	// timeStamp, under the lock of the stock's shard. The trade is recorded in the journal,
+	// if any, before it is added, so that no trade is held which the journal does not have.
+	// Throws an invalid_argument if the stock does not exist, and a runtime_error without
+	// adding the trade if an earlier write to the journal failed.
+	// See TradeRecord::addTrade for other exceptions.
+	//
+	void addTrade(StockId id, int quantity, BuyOrSellType buyOrSellType, double price);
+
+	// Adds a Trade to the given stock, using the given time as its timeStamp, under the
+	// lock of the stock's shard. The trade is recorded in the journal, if any, before it
+	// is added. Throws an invalid_argument if the stock does not exist, and a runtime_error
+	// without adding the trade if an earlier write to the journal failed.
+	// See TradeRecord::addTrade for other exceptions.
+	//
+	void addTrade(StockId id, int quantity, BuyOrSellType buyOrSellType, double price, TimeStamp timeStamp);
+
+	// Adds a batch of trades, possibly for many stocks, to the group.
+	// Every stockId in the batch is checked first; if any does not exist an invalid_argument
+	// is thrown and no trades are added. With a journal, every trade is also checked against
+	// its stock's tick size, and the batch is recorded in the journal before any is added;
+	// if an earlier write to the journal failed a runtime_error is thrown and no trades are
+	// added. The batch is then grouped by stock and each stock's trades are merged into its
+	// TradeRecord in one pass, under the lock of the stock's shard. With a journal, the
+	// shards are held from the check until the merge, so that replaying the journal adds
+	// trades in the order they were added, ties included, whatever other threads do.
+	//
+	void addTrades(const StockTrade* trades, std::size_t count);
+
+	// Records every trade added through addTrade and addTrades in the given journal from
+	// now on; nullptr stops journalling. The journal is not owned by the group and must
+	// outlive its use here.
+	//
+	void setJournal(TradeJournal* journalIn);
+
+	// Adds every trade recorded in the journal at 'path' to the group, as when rebuilding
+	// the group's trades at startup, returning the number of trades replayed. The stocks
+	// must already have been added, in the same order as when the journal was written.
+	// Replayed trades are not journalled again.
+	// Throws a runtime_error if the journal cannot be read, and an invalid_argument if it
+	// names a stock which does not exist.
+	//
+	std::size_t replayJournal(const std::string& path);
+
+	// Writes every stock's definition and trades to a snapshot file at 'path'. The snapshot
+	// is written beside it and put on disk first, then replaces any existing file in one
+	// step, so that 'path' holds either the old snapshot or the new. Trades are written as
+	// the columns they are held in, so this costs little more than copying them.
+	// See Snapshot.h for the layout.
+	// Throws a runtime_error if the file cannot be written.
+	//
+	void writeSnapshot(const std::string& path)const;
+
+	// Adds the stocks and trades held in the snapshot file at 'path' to this group,
+	// which must be empty. The file is mapped into memory and each stock's trades are
+	// copied straight into its TradeRecord a chunk at a time, rather than each being
+	// read and inserted as a Trade. Every stock is loaded and checked before any is
+	// added, so the group is left empty if the snapshot cannot be loaded.
+	// Throws an InvalidOperation if the group already holds stocks, and a runtime_error
+	// if the file cannot be read or is not a valid snapshot.
+	//
+	void loadSnapshot(const std::string& path);
+
+	// Sets the retention policy of every stock's TradeRecord, including stocks added later.
+	// See RetentionPolicy.
+	//
+	void setRetentionPolicy(const RetentionPolicy& retentionIn);
+
+	// Returns the retention policy given to each stock
+	//
+	RetentionPolicy getRetentionPolicy()const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return retention;
+	}
+
+	// Sets a limit on the memory held for trades across the whole group, releasing the
+	// oldest trades of any stock first when it is exceeded; each stock keeps at least its
+	// newest chunk of trades. Each shard is held to an equal share of the budget.
+	// Zero removes the limit.
+	//
+	void setMemoryBudget(std::size_t bytes);
+
+	// Returns the memory held for trades across the whole group
+	//
+	std::size_t getMemoryUsage()const;
+
+	// Returns the window over which the All Share Index is maintained
+	//
+	std::chrono::minutes getIndexWindow()const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(stocksMutex);
+		return indexWindow;
+	}
+
+	// Changes the window over which the All Share Index is maintained, setting the
+	// window of every stock's TradeRecord to match. Stocks added later use it too.
+	// The window must be positive or an invalid_argument is thrown.
+	//
+	void setIndexWindow(std::chrono::minutes windowIn);
+
+	// Returns the clock the group and its stocks take the present moment from
+	//
+	const Clock& getClock()const
+	{
+		return *clock.load();
+	}
+
+	// Sets the clock the group and every stock's TradeRecord take the present moment from,
+	// including stocks added later, and recalculates the index as of that clock's present
+	// moment. The clock must outlive the group. The system clock is used until this is called.
+	//
+	void setClock(const Clock& clockIn);
+
+	// Returns the incrementally maintained All Share Index, using each stock's Volume
+	//	Weighted Stock Price over the index window. This is the geometric mean computed
+	//	from a running sum of logarithms, so it costs only the work needed to expire
+	//	trades that have left any stock's window since the last call. Each shard's
+	//	stocks are expired on one of the index threads.
+	//	Returns 0.0 if the group is empty or any stock has no price within the window.
+	//
+	double calculateAllShareIndex();
+
+	// Returns the All Share Index as published after the most recent change to any stock's
+	//	windowed Volume Weighted Stock Price, without taking any lock, so that any number
+	//	of threads may poll it without ever stalling threads adding trades. Each shard's
+	//	part is consistent, though shards may be read either side of a concurrent change.
+	//	Trades expiring from a window are only reflected once a trade is added to that
+	//	stock or calculateAllShareIndex is called.
+	//	Returns 0.0 if the group is empty or any stock has no price within the window.
+	//	For per stock values, see TradeRecord::getSnapshot.
+	//
+	double getPublishedAllShareIndex()const;
+
 	// Returns the All Share Index for the map, using a Volume Weighted Stock Price
 	//	based on trades over the last 'min' minutes.
+	//	When 'min' is the index window this returns the maintained index. Otherwise the
+	//	index over 'min' is kept from one call to the next, for a few recently used
+	//	windows, and each call recomputes only the stocks which have had trades added,
+	//	or trades leave 'min', since the last, in blocks shared across the index threads
+	//	(see setIndexThreadCount). The first call for a window computes every stock.
+	//	Other changes to a stock's trades, such as its retention policy, must be made
+	//	through the group to be seen.
 	//
 	double calculateAllShareIndexWithin(std::chrono::minutes min);
 
@@ -91,6 +750,47 @@ public:
 	{
 		return calculateAllShareIndexWithin(std::chrono::minutes(5));
 	}
+
+	// Subscribes to changes in a value, returning the subscription's id. 'callback' is
+	//	called on the group's dispatcher thread, with every change to the subscription
+	//	since its last call, whenever the value moves by more than 'threshold' from the
+	//	value last delivered; a threshold of zero delivers every change.
+	//	VOLUME_WEIGHTED_STOCK_PRICE (over the index window) and LAST_PRICE are watched
+	//	for the stock stockId, or for every stock, including those added later, when
+	//	stockId is EVERY_STOCK; stockId is ignored for ALL_SHARE_INDEX, which is taken
+	//	as getPublishedAllShareIndex would be.
+	//	Only stocks which have had trades added, or expired from their window or by
+	//	retention, since the dispatcher's last pass are looked at, and while there are no
+	//	subscriptions adding trades does no extra work. The dispatcher thread wakes by
+	//	itself when trades next leave a stock's window, so windowed prices change for
+	//	subscribers even while no trades arrive, as the group's clock passes the expiry
+	//	time; a clock that only moves when advanced is looked at again no sooner than
+	//	MIN_EXPIRY_WAIT later. Trades must be added through the
+	//	group, rather than directly to a stock's TradeRecord, while subscriptions exist.
+	//	A callback may call the group's methods, other than flushNotifications.
+	//	Throws an invalid_argument if the stock does not exist, threshold is negative or
+	//	callback is empty.
+	//
+	SubscriptionId subscribe(SubscribedValue subscribedValue,
+		StockId stockId,
+		double threshold,
+		ChangeCallback callback);
+
+	// Removes a subscription. Its callback may still be called by a delivery already
+	//	under way; call flushNotifications afterwards to be sure it will not be.
+	//	Throws an invalid_argument if there is no such subscription.
+	//
+	void unsubscribe(SubscriptionId id);
+
+	// Sets the shortest time between deliveries to subscribers, so that changes are
+	//	gathered into larger batches at the cost of later delivery. Zero, the default,
+	//	delivers as soon as the dispatcher thread wakes.
+	//
+	void setNotificationInterval(std::chrono::microseconds interval);
+
+	// Waits until every change made before the call has been delivered to subscribers
+	//
+	void flushNotifications();
 };
 
 
@@ -8,6 +8,7 @@
 
 #include"stdafx.h"
 #include"Exceptions.h"
+#include"Metrics.h"
 #include"StockGroup.h"
 #include<cassert>
 #include<random>
@@ -138,6 +139,10 @@ int main()
 		outputAllShareIndex(stocks);
 
 		cout << "\n\ndemonstration ended.\n";
+#ifdef SUPERSIMPLESTOCKS_METRICS
+		cout << endl;
+		Metrics::takeSnapshot().printTo(cout);
+#endif
 
 	}
 	catch (InvalidOperation& io)
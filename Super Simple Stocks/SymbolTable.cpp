@@ -0,0 +1,90 @@
+#include"stdafx.h"
+#include"SymbolTable.h"
+#include<cstring>
+#include<limits>
+#include<stdexcept>
+
+const StockId SymbolTable::EMPTY_SLOT = std::numeric_limits<StockId>::max();
+
+SymbolTable::SymbolTable() :
+	slots(16, EMPTY_SLOT)
+{
+	// done //
+}
+
+// Internal utility; FNV-1a hash of the given characters
+//
+std::size_t SymbolTable::hash(const char* data, std::size_t length)
+{
+	std::uint64_t value = 14695981039346656037ull;
+	for (std::size_t t = 0; t < length; ++t)
+	{
+		value ^= static_cast<unsigned char>(data[t]);
+		value *= 1099511628211ull;
+	}
+	return static_cast<std::size_t>(value);
+}
+
+// Internal utility; returns the slot holding the symbol, or the empty slot where it
+// would be placed.
+//
+std::size_t SymbolTable::findSlot(const char* data, std::size_t length)const
+{
+	const std::size_t mask = slots.size() - 1;
+	std::size_t slot = hash(data, length) & mask;
+	while (EMPTY_SLOT != slots[slot])
+	{
+		const StockSymbol& symbol = symbols[slots[slot]];
+		if (symbol.size() == length && 0 == std::memcmp(symbol.data(), data, length))
+		{
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+// Internal utility; doubles the number of slots and rehashes every symbol
+//
+void SymbolTable::grow()
+{
+	slots.assign(slots.size() * 2, EMPTY_SLOT);
+	for (StockId id = 0; id < symbols.size(); ++id)
+	{
+		slots[findSlot(symbols[id].data(), symbols[id].size())] = id;
+	}
+}
+
+// Sets id to the id of the given symbol and returns true, or returns false if the
+// symbol has not been interned.
+//
+bool SymbolTable::find(const char* data, std::size_t length, StockId& id)const
+{
+	const StockId found = slots[findSlot(data, length)];
+	if (EMPTY_SLOT == found)
+	{
+		return false;
+	}
+	id = found;
+	return true;
+}
+
+// Interns the symbol, returning its new id.
+// Throws an invalid_argument if the symbol has already been interned.
+//
+StockId SymbolTable::add(const StockSymbol& symbol)
+{
+	if (EMPTY_SLOT != slots[findSlot(symbol.data(), symbol.size())])
+	{
+		throw std::invalid_argument("SymbolTable::add:\tsymbol already exists.");
+	}
+	if ((symbols.size() + 1) * 2 > slots.size())
+	{
+		grow();
+	}
+
+	const StockId id = static_cast<StockId>(symbols.size());
+	symbols.push_back(symbol);
+	slots[findSlot(symbol.data(), symbol.size())] = id;
+	return id;
+}
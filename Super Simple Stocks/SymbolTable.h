@@ -0,0 +1,82 @@
+/*
+* SymbolTable.h
+*
+*	A SymbolTable interns StockSymbols, handing out a dense integer StockId for each
+*	distinct symbol in the order they are added. Ids can then be used to index
+*	straight into arrays, avoiding string comparison and copying on hot paths.
+*	Lookups hash the symbol's characters in place, so callers holding a symbol in
+*	a buffer need not build a std::string to resolve it.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_SYMBOL_TABLE
+#define SUPERSIMPLESTOCKS_SYMBOL_TABLE
+#include"Stock.h"
+#include<cstddef>
+#include<cstdint>
+#include<vector>
+
+// Dense handle for an interned StockSymbol: ids run from 0 to the number of symbols - 1
+//
+typedef std::uint32_t StockId;
+
+class SymbolTable
+{
+	// symbols[id] is the symbol interned as id
+	//
+	std::vector<StockSymbol> symbols;
+
+	// Open addressed hash table of ids, EMPTY_SLOT where unused. Its size is a power of
+	// two kept at least twice the number of symbols.
+	//
+	std::vector<StockId> slots;
+
+	static const StockId EMPTY_SLOT;
+
+	// Internal utility; FNV-1a hash of the given characters
+	//
+	static std::size_t hash(const char* data, std::size_t length);
+
+	// Internal utility; returns the slot holding the symbol, or the empty slot where it
+	// would be placed.
+	//
+	std::size_t findSlot(const char* data, std::size_t length)const;
+
+	// Internal utility; doubles the number of slots and rehashes every symbol
+	//
+	void grow();
+
+public:
+
+	SymbolTable();
+
+	// Returns the number of interned symbols
+	//
+	std::size_t size()const
+	{
+		return symbols.size();
+	}
+
+	// Sets id to the id of the given symbol and returns true, or returns false if the
+	// symbol has not been interned.
+	//
+	bool find(const char* data, std::size_t length, StockId& id)const;
+
+	bool find(const StockSymbol& symbol, StockId& id)const
+	{
+		return find(symbol.data(), symbol.size(), id);
+	}
+
+	// Interns the symbol, returning its new id.
+	// Throws an invalid_argument if the symbol has already been interned.
+	//
+	StockId add(const StockSymbol& symbol);
+
+	// Returns the symbol for the given id, which must be less than size()
+	//
+	const StockSymbol& getSymbol(StockId id)const
+	{
+		return symbols[id];
+	}
+};
+
+#endif
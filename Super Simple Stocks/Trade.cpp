@@ -1,19 +1,25 @@
 #include"stdafx.h"
 #include"Trade.h"
 #include"Exceptions.h"
+#include<cmath>
 
-// Construct a Trade object with a timestamp of the present moment.
+// Construct a Trade object with a timestamp of the present moment according to 'clock'.
 //  quantity must be 1 or greater or an invalid_argument will be thrown.
-//  price must be 0.0 or greater or an invalid_argument will be thrown.
+//  price must be finite and 0.0 or greater or an invalid_argument will be thrown.
 //
 Trade::Trade(unsigned int quantityIn,
 	BuyOrSellType buyOrSellTypeIn,
-	double priceIn) :
+	double priceIn,
+	const Clock& clock) :
 	quantity(quantityIn),
 	buyOrSellType(buyOrSellTypeIn),
 	price(priceIn),
-	timeStamp(std::chrono::system_clock::now())
+	timeStamp(clock.now())
 {
+	if (!std::isfinite(price))
+	{
+		throw std::invalid_argument("Trade::Trade:\tPrice given to trade must be finite.");
+	}
 	if (price < 0.0)
 	{
 		throw std::invalid_argument("Trade::Trade:\tPrice given to trade cannot be negative.");
@@ -26,7 +32,7 @@ Trade::Trade(unsigned int quantityIn,
 
 // Construct a Trade object with the given timeStamp.
 //  quantity must be 1 or greater or an invalid_argument will be thrown.
-//  price must be 0.0 or greater or an invalid_argument will be thrown.
+//  price must be finite and 0.0 or greater or an invalid_argument will be thrown.
 //
 Trade::Trade(unsigned int quantityIn,
 	BuyOrSellType buyOrSellTypeIn,
@@ -37,6 +43,10 @@ Trade::Trade(unsigned int quantityIn,
 	price(priceIn),
 	timeStamp(timeStampIn)
 {
+	if (!std::isfinite(price))
+	{
+		throw std::invalid_argument("Trade::Trade:\tPrice given to trade must be finite.");
+	}
 	if (price < 0.0)
 	{
 		throw std::invalid_argument("Trade::Trade:\tPrice given to trade cannot be negative.");
@@ -7,6 +7,7 @@
 #ifndef SUPERSIMPLESTOCKS_TRADE
 #define SUPERSIMPLESTOCKS_TRADE
 #define __STDC_WANT_LIB_EXT1__ 1
+#include"Clock.h"
 #include<ctime>
 #include<chrono>
 
@@ -16,8 +17,6 @@ enum BuyOrSellType
 	SELL_TYPE
 };
 
-typedef std::chrono::time_point<std::chrono::system_clock> TimeStamp;
-
 class Trade
 {
 	unsigned int quantity;
@@ -27,17 +26,18 @@ class Trade
 
 public:
 
-	// Construct a Trade object with a timestamp of the present moment.
+	// Construct a Trade object with a timestamp of the present moment according to 'clock'.
 	//  quantity must be 1 or greater or an invalid_argument will be thrown.
-	//  price must be 0.0 or greater or an invalid_argument will be thrown.
+	//  price must be finite and 0.0 or greater or an invalid_argument will be thrown.
 	//
 	Trade(unsigned int quantity,
 		BuyOrSellType buyOrSellType,
-		double price);
+		double price,
+		const Clock& clock = SystemClock::getInstance());
 
 	// Construct a Trade object with the given timeStamp.
 	//  quantity must be 1 or greater or an invalid_argument will be thrown.
-	//  price must be 0.0 or greater or an invalid_argument will be thrown.
+	//  price must be finite and 0.0 or greater or an invalid_argument will be thrown.
 	//
 	Trade(unsigned int quantity,
 		BuyOrSellType buyOrSellType,
@@ -0,0 +1,413 @@
+#include"stdafx.h"
+#include"TradeJournal.h"
+#include"MappedFile.h"
+#include<cstddef>
+#include<cstring>
+#include<stdexcept>
+#ifdef _WIN32
+#include<io.h>
+#else
+#include<unistd.h>
+#endif
+
+static_assert(sizeof(TradeJournal::Record) == 32, "TradeJournal::Record must be 32 bytes.");
+
+const std::chrono::microseconds TradeJournal::DEFAULT_COMMIT_INTERVAL(1000);
+
+namespace
+{
+	// The file starts with these bytes, followed by the format version and record size
+	//
+	const char JOURNAL_MAGIC[8] = { 'S', 'S', 'S', 'T', 'R', 'A', 'D', 'E' };
+	const std::uint32_t JOURNAL_VERSION = 1;
+
+	struct JournalHeader
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t recordSize;
+	};
+
+	// Number of records read at a time during replay
+	//
+	const std::size_t REPLAY_BATCH_SIZE = 4096;
+
+	// Returns the header every journal starts with
+	//
+	JournalHeader makeHeader()
+	{
+		JournalHeader header;
+		std::memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+		header.version = JOURNAL_VERSION;
+		header.recordSize = sizeof(TradeJournal::Record);
+		return header;
+	}
+
+	// Returns true IFF the file is shorter than a header and holds only the start of one,
+	// as when a crash interrupted creating the journal. Leaves the file at its start.
+	//
+	bool isUnfinishedJournal(std::FILE* file)
+	{
+		std::fseek(file, 0, SEEK_END);
+		const long length = std::ftell(file);
+		std::rewind(file);
+		if (length < 0 || static_cast<std::size_t>(length) >= sizeof(JournalHeader))
+		{
+			return false;
+		}
+		const JournalHeader header = makeHeader();
+		char bytes[sizeof(JournalHeader)];
+		const bool unfinished = static_cast<std::size_t>(length) == std::fread(bytes, 1, static_cast<std::size_t>(length), file)
+			&& 0 == std::memcmp(bytes, &header, static_cast<std::size_t>(length));
+		std::rewind(file);
+		return unfinished;
+	}
+
+	// Cuts the file down to 'length' bytes
+	//
+	bool truncateFile(std::FILE* file, long long length)
+	{
+		if (0 != std::fflush(file))
+		{
+			return false;
+		}
+#ifdef _WIN32
+		return 0 == _chsize_s(_fileno(file), length);
+#else
+		return 0 == ftruncate(fileno(file), static_cast<off_t>(length));
+#endif
+	}
+
+	// Writes the header to the start of an empty file and puts it on disk
+	//
+	bool writeHeader(std::FILE* file)
+	{
+		const JournalHeader header = makeHeader();
+		std::rewind(file);
+		return 1 == std::fwrite(&header, sizeof(header), 1, file) && syncFile(file);
+	}
+}
+
+// Opens the journal at 'path' for appending, creating it if it does not exist.
+// Any torn record at the end of an existing journal is removed. An empty file, or
+// one holding only the start of a header, as a crash while creating it leaves, is
+// started afresh as an empty journal.
+// Throws a runtime_error if the file cannot be opened or is not a journal.
+//
+TradeJournal::TradeJournal(const std::string& path, std::chrono::microseconds commitIntervalIn) :
+	file(nullptr),
+	commitInterval(commitIntervalIn),
+	appendedCount(0),
+	durableCount(0),
+	syncRequested(false),
+	failed(false),
+	stopping(false)
+{
+	file = std::fopen(path.c_str(), "r+b");
+	if (nullptr == file)
+	{
+		file = std::fopen(path.c_str(), "w+b");
+		if (nullptr == file)
+		{
+			throw std::runtime_error("TradeJournal::TradeJournal:\tcould not open " + path + ".");
+		}
+		if (!writeHeader(file))
+		{
+			std::fclose(file);
+			throw std::runtime_error("TradeJournal::TradeJournal:\tcould not write to " + path + ".");
+		}
+	}
+	else if (isUnfinishedJournal(file))
+	{
+		if (!truncateFile(file, 0) || !writeHeader(file))
+		{
+			std::fclose(file);
+			throw std::runtime_error("TradeJournal::TradeJournal:\tcould not write to " + path + ".");
+		}
+	}
+	else
+	{
+		if (!readHeader(file))
+		{
+			std::fclose(file);
+			throw std::runtime_error("TradeJournal::TradeJournal:\t" + path + " is not a trade journal.");
+		}
+
+		// find the end of the last intact record
+		long long validLength = sizeof(JournalHeader);
+		bool torn = false;
+		Record record;
+		std::size_t bytesRead;
+		while (sizeof(Record) == (bytesRead = std::fread(&record, 1, sizeof(Record), file)))
+		{
+			if (!isIntact(record))
+			{
+				torn = true;
+				break;
+			}
+			validLength += sizeof(Record);
+		}
+		torn = torn || bytesRead > 0;
+		std::fseek(file, 0, SEEK_END);
+		if (torn && !truncateFile(file, validLength))
+		{
+			std::fclose(file);
+			throw std::runtime_error("TradeJournal::TradeJournal:\tcould not remove a torn record from " + path + ".");
+		}
+		std::fseek(file, 0, SEEK_END);
+	}
+	writer = std::thread(&TradeJournal::writerLoop, this);
+}
+
+// Commits every appended record and closes the journal
+//
+TradeJournal::~TradeJournal()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	commitRequested.notify_one();
+	writer.join();
+	std::fclose(file);
+}
+
+// Internal utility; the body of the writer thread
+//
+void TradeJournal::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		// sleep until there is something to write, then give the records appended over
+		// the next commit interval the chance to share its sync
+		commitRequested.wait(lock, [this]
+		{
+			return stopping || syncRequested || !pending.empty();
+		});
+		commitRequested.wait_for(lock, commitInterval, [this]
+		{
+			return stopping || syncRequested || pending.size() >= COMMIT_GROUP_SIZE;
+		});
+		commitPending(lock);
+	}
+	commitPending(lock);
+}
+
+// Internal utility; writes and syncs the pending records. 'lock' must hold 'mutex',
+// and is released while writing.
+//
+void TradeJournal::commitPending(std::unique_lock<std::mutex>& lock)
+{
+	syncRequested = false;
+	if (failed)
+	{
+		// nothing more can be written, so records still waiting are dropped
+		pending.clear();
+		return;
+	}
+	if (pending.empty())
+	{
+		return;
+	}
+
+	std::vector<Record> writing;
+	writing.swap(pending);
+	const std::uint64_t committing = appendedCount;
+	lock.unlock();
+
+	const bool written = writing.size() == std::fwrite(writing.data(), sizeof(Record), writing.size(), file)
+		&& syncFile(file);
+
+	lock.lock();
+	if (written)
+	{
+		durableCount = committing;
+	}
+	else
+	{
+		failed = true;
+	}
+	// hand the buffer back so its capacity is reused
+	if (pending.empty())
+	{
+		writing.clear();
+		pending.swap(writing);
+	}
+	committed.notify_all();
+}
+
+// Records 'count' trades. This only copies them; they are on disk after the next
+// commit, at most a commit interval later, or once sync returns.
+// Safe to call from many threads at once.
+// Throws a runtime_error if an earlier write to the journal failed.
+//
+void TradeJournal::append(const StockTrade* stockTrades, std::size_t count)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (failed)
+	{
+		throw std::runtime_error("TradeJournal::append:\twriting to the journal failed.");
+	}
+	const bool wasIdle = pending.empty();
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		pending.push_back(encode(stockTrades[t]));
+	}
+	appendedCount += count;
+	if ((wasIdle && count > 0) || pending.size() >= COMMIT_GROUP_SIZE)
+	{
+		commitRequested.notify_one();
+	}
+}
+
+// Waits until every trade appended so far is on disk.
+// Throws a runtime_error if writing to the journal failed.
+//
+void TradeJournal::sync()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	const std::uint64_t target = appendedCount;
+	if (durableCount < target && !failed)
+	{
+		syncRequested = true;
+		commitRequested.notify_one();
+		committed.wait(lock, [&]
+		{
+			return failed || durableCount >= target;
+		});
+	}
+	if (failed)
+	{
+		throw std::runtime_error("TradeJournal::sync:\twriting to the journal failed.");
+	}
+}
+
+// Reads the journal at 'path', passing its trades to function(stockTrades, count)
+// in batches, in the order they were appended, and returns the number of trades read.
+// Reading stops at the first torn or corrupt record. An empty file, or one holding
+// only the start of a header, is read as an empty journal.
+// Throws a runtime_error if the file cannot be opened or is not a journal.
+//
+std::size_t TradeJournal::replay(const std::string& path,
+	const std::function<void(const StockTrade*, std::size_t)>& function)
+{
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (nullptr == file)
+	{
+		throw std::runtime_error("TradeJournal::replay:\tcould not open " + path + ".");
+	}
+	if (isUnfinishedJournal(file))
+	{
+		std::fclose(file);
+		return 0;
+	}
+	if (!readHeader(file))
+	{
+		std::fclose(file);
+		throw std::runtime_error("TradeJournal::replay:\t" + path + " is not a trade journal.");
+	}
+
+	std::vector<Record> records(REPLAY_BATCH_SIZE);
+	std::vector<StockTrade> stockTrades;
+	stockTrades.reserve(REPLAY_BATCH_SIZE);
+	std::size_t replayed = 0;
+	bool intact = true;
+	while (intact)
+	{
+		const std::size_t recordsRead = std::fread(records.data(), sizeof(Record), records.size(), file);
+		stockTrades.clear();
+		for (std::size_t t = 0; t < recordsRead && intact; ++t)
+		{
+			intact = isIntact(records[t]);
+			if (intact)
+			{
+				stockTrades.push_back(decode(records[t]));
+			}
+		}
+		intact = intact && recordsRead == records.size();
+
+		if (!stockTrades.empty())
+		{
+			try
+			{
+				function(stockTrades.data(), stockTrades.size());
+			}
+			catch (...)
+			{
+				std::fclose(file);
+				throw;
+			}
+			replayed += stockTrades.size();
+		}
+	}
+	std::fclose(file);
+	return replayed;
+}
+
+// Internal utility; returns the checksum of a record's contents
+//
+std::uint32_t TradeJournal::calculateChecksum(const Record& record)
+{
+	// FNV-1a over every byte before the checksum
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&record);
+	std::uint32_t value = 2166136261u;
+	for (std::size_t t = 0; t < offsetof(Record, checksum); ++t)
+	{
+		value ^= bytes[t];
+		value *= 16777619u;
+	}
+	return value;
+}
+
+// Internal utility; encodes the trade as a record
+//
+TradeJournal::Record TradeJournal::encode(const StockTrade& stockTrade)
+{
+	const Trade& trade = stockTrade.trade;
+	Record record;
+	record.timeStamp = std::chrono::duration_cast<std::chrono::nanoseconds>(trade.getTimeStamp().time_since_epoch()).count();
+	record.price = trade.getPrice();
+	record.stockId = stockTrade.stockId;
+	record.quantity = trade.getQuantity();
+	record.buyOrSellType = static_cast<std::uint8_t>(trade.getBuyOrSellType());
+	std::memset(record.reserved, 0, sizeof(record.reserved));
+	record.checksum = calculateChecksum(record);
+	return record;
+}
+
+// Internal utility; returns true IFF the record's checksum matches and its fields
+// make a valid trade.
+//
+bool TradeJournal::isIntact(const Record& record)
+{
+	return record.checksum == calculateChecksum(record)
+		&& record.quantity > 0
+		&& record.buyOrSellType <= SELL_TYPE
+		&& record.price >= 0.0;
+}
+
+// Internal utility; decodes an intact record
+//
+StockTrade TradeJournal::decode(const Record& record)
+{
+	const auto sinceEpoch = std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(record.timeStamp));
+	const StockTrade stockTrade =
+	{
+		record.stockId,
+		Trade(record.quantity, static_cast<BuyOrSellType>(record.buyOrSellType), record.price, TimeStamp(sinceEpoch))
+	};
+	return stockTrade;
+}
+
+// Internal utility; reads and checks the file header, returning false if the file
+// is not a journal.
+//
+bool TradeJournal::readHeader(std::FILE* file)
+{
+	JournalHeader header;
+	return 1 == std::fread(&header, sizeof(header), 1, file)
+		&& 0 == std::memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC))
+		&& JOURNAL_VERSION == header.version
+		&& sizeof(Record) == header.recordSize;
+}
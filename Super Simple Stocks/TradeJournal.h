@@ -0,0 +1,151 @@
+/*
+* TradeJournal.h
+*
+*	A TradeJournal is an append only file recording every trade accepted by a
+*	StockGroup, so that the group's trades can be rebuilt after a restart.
+*	Each trade is written as a fixed size binary record carrying its own checksum,
+*	so a record torn by a crash part way through a write is detected and dropped.
+*	Appending only copies the record into memory. A background thread sleeps until
+*	there is something to write, then writes and syncs everything appended within a
+*	commit interval of the first waiting record, so the cost of each sync to disk is
+*	shared by every trade in the group (group commit) and an idle journal costs nothing.
+*	Records identify stocks by StockId, so a journal must be replayed into a group
+*	holding the same stocks, added in the same order, as the group that wrote it.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_TRADE_JOURNAL
+#define SUPERSIMPLESTOCKS_TRADE_JOURNAL
+#include"StockGroup.h"
+#include<chrono>
+#include<condition_variable>
+#include<cstddef>
+#include<cstdint>
+#include<cstdio>
+#include<functional>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<vector>
+
+class TradeJournal
+{
+public:
+
+	// The on disk layout of one trade. timeStamp is in nanoseconds since the epoch of
+	// the system clock. checksum covers every byte before it.
+	//
+	struct Record
+	{
+		std::int64_t timeStamp;
+		double price;
+		std::uint32_t stockId;
+		std::uint32_t quantity;
+		std::uint8_t buyOrSellType;
+		std::uint8_t reserved[3];
+		std::uint32_t checksum;
+	};
+
+	static const std::chrono::microseconds DEFAULT_COMMIT_INTERVAL;
+
+	// Number of pending records which wakes the writer before the commit interval is up
+	//
+	static const std::size_t COMMIT_GROUP_SIZE = 4096;
+
+private:
+
+	std::FILE* file;
+	std::chrono::microseconds commitInterval;
+
+	// Guards everything below
+	//
+	std::mutex mutex;
+	std::condition_variable commitRequested;
+	std::condition_variable committed;
+
+	// Records appended but not yet handed to the writer
+	//
+	std::vector<Record> pending;
+
+	// Number of records appended in total, and the number known to be on disk
+	//
+	std::uint64_t appendedCount;
+	std::uint64_t durableCount;
+
+	bool syncRequested;
+	bool failed;
+	bool stopping;
+
+	std::thread writer;
+
+	TradeJournal(const TradeJournal&) = delete;
+	TradeJournal& operator=(const TradeJournal&) = delete;
+
+	// Internal utility; the body of the writer thread
+	//
+	void writerLoop();
+
+	// Internal utility; writes and syncs the pending records. 'lock' must hold 'mutex',
+	// and is released while writing.
+	//
+	void commitPending(std::unique_lock<std::mutex>& lock);
+
+	// Internal utility; returns the checksum of a record's contents
+	//
+	static std::uint32_t calculateChecksum(const Record& record);
+
+	// Internal utility; encodes the trade as a record
+	//
+	static Record encode(const StockTrade& stockTrade);
+
+	// Internal utility; returns true IFF the record's checksum matches and its fields
+	// make a valid trade.
+	//
+	static bool isIntact(const Record& record);
+
+	// Internal utility; decodes an intact record
+	//
+	static StockTrade decode(const Record& record);
+
+	// Internal utility; reads and checks the file header, returning false if the file
+	// is not a journal.
+	//
+	static bool readHeader(std::FILE* file);
+
+public:
+
+	// Opens the journal at 'path' for appending, creating it if it does not exist.
+	// Any torn record at the end of an existing journal is removed. An empty file, or
+	// one holding only the start of a header, as a crash while creating it leaves, is
+	// started afresh as an empty journal.
+	// Throws a runtime_error if the file cannot be opened or is not a journal.
+	//
+	explicit TradeJournal(const std::string& path,
+		std::chrono::microseconds commitIntervalIn = DEFAULT_COMMIT_INTERVAL);
+
+	// Commits every appended record and closes the journal
+	//
+	~TradeJournal();
+
+	// Records 'count' trades. This only copies them; they are on disk after the next
+	// commit, at most a commit interval later, or once sync returns.
+	// Safe to call from many threads at once.
+	// Throws a runtime_error if an earlier write to the journal failed.
+	//
+	void append(const StockTrade* stockTrades, std::size_t count);
+
+	// Waits until every trade appended so far is on disk.
+	// Throws a runtime_error if writing to the journal failed.
+	//
+	void sync();
+
+	// Reads the journal at 'path', passing its trades to function(stockTrades, count)
+	// in batches, in the order they were appended, and returns the number of trades read.
+	// Reading stops at the first torn or corrupt record. An empty file, or one holding
+	// only the start of a header, is read as an empty journal.
+	// Throws a runtime_error if the file cannot be opened or is not a journal.
+	//
+	static std::size_t replay(const std::string& path,
+		const std::function<void(const StockTrade*, std::size_t)>& function);
+};
+
+#endif
@@ -1,41 +1,725 @@
 #include"stdafx.h"
 #include"TradeRecord.h"
+#include"Exceptions.h"
+#include"Metrics.h"
+#include<algorithm>
+#include<cmath>
+#include<ostream>
 #include<stdexcept>
 #include<string>
+#include<vector>
 
-// Adds a Trade to the TradeRecord, using the current time as its timeStamp
+const std::chrono::minutes TradeRecord::DEFAULT_WINDOW(5);
+
+// Build an empty TradeRecord maintaining a Volume Weighted Stock Price over the
+// given window. The window must be positive or an invalid_argument is thrown.
+// Trades are stored in memory from allocatorIn, which must outlive the record.
+//
+TradeRecord::TradeRecord(std::chrono::minutes windowIn, Allocator& allocatorIn) :
+	trades(allocatorIn),
+	clock(&SystemClock::getInstance()),
+	listener(nullptr),
+	listenerKey(0),
+	chunksAtLastRetention(0),
+	lastTradeTime(TimeStamp::min()),
+	lastPrice(0.0)
+{
+	if (windowIn <= std::chrono::minutes::zero())
+	{
+		throw std::invalid_argument("TradeRecord::TradeRecord:\twindow must be positive.");
+	}
+	window.span = std::chrono::duration_cast<std::chrono::system_clock::duration>(windowIn);
+	rebuildWindow(window, clock->now());
+	publishSnapshot();
+}
+
+// Changes the window over which the Volume Weighted Stock Price is maintained.
+// This rescans the trades within the new window once.
+// The window must be positive or an invalid_argument is thrown.
+//
+void TradeRecord::setWindow(std::chrono::minutes windowIn)
+{
+	if (windowIn <= std::chrono::minutes::zero())
+	{
+		throw std::invalid_argument("TradeRecord::setWindow:\twindow must be positive.");
+	}
+	window.span = std::chrono::duration_cast<std::chrono::system_clock::duration>(windowIn);
+	rebuildWindow(window, clock->now());
+	publishSnapshot();
+	notifyListener();
+}
+
+// Returns the horizons maintained alongside the window, shortest first
+//
+std::vector<std::chrono::minutes> TradeRecord::getHorizons()const
+{
+	std::vector<std::chrono::minutes> spans;
+	spans.reserve(horizons.size());
+	for (const auto& horizon : horizons)
+	{
+		spans.push_back(std::chrono::duration_cast<std::chrono::minutes>(horizon.span));
+	}
+	return spans;
+}
+
+// Sets further windows, or horizons, over which Volume Weighted Stock Prices are
+// maintained alongside the record's window, replacing any set before; an empty set
+// removes them all. Each trade is added to the sums of every horizon it falls within
+// as it arrives, and subtracted from each as it expires, so no query rescans the
+// trades: calculateHorizonPrices finds the price over every horizon at once, and
+// calculateVolumeWeightedStockPriceWithin costs amortized constant time for any of
+// them. A horizon given more than once is kept once. This rescans the trades within
+// each horizon once.
+// Every horizon must be positive or an invalid_argument is thrown.
+//
+void TradeRecord::setHorizons(const std::vector<std::chrono::minutes>& horizonsIn)
+{
+	std::vector<std::chrono::minutes> spans(horizonsIn);
+	for (const auto span : spans)
+	{
+		if (span <= std::chrono::minutes::zero())
+		{
+			throw std::invalid_argument("TradeRecord::setHorizons:\thorizons must be positive.");
+		}
+	}
+	std::sort(spans.begin(), spans.end());
+	spans.erase(std::unique(spans.begin(), spans.end()), spans.end());
+
+	std::vector<SlidingWindow> newHorizons(spans.size());
+	const TimeStamp now = clock->now();
+	for (std::size_t h = 0; h < spans.size(); ++h)
+	{
+		newHorizons[h].span = std::chrono::duration_cast<std::chrono::system_clock::duration>(spans[h]);
+		rebuildWindow(newHorizons[h], now);
+	}
+	horizons.swap(newHorizons);
+}
+
+// Fills 'prices' with the Volume Weighted Stock Price and order flow over each horizon
+// as of the present, shortest horizon first, replacing its contents. This costs amortized
+// constant time per horizon.
+//
+void TradeRecord::calculateHorizonPrices(std::vector<HorizonPrice>& prices)const
+{
+	SUPERSIMPLESTOCKS_METRICS_TIME_QUERY(VWSP_QUERY_NANOSECONDS);
+	const TimeStamp now = clock->now();
+	prices.resize(horizons.size());
+	for (std::size_t h = 0; h < horizons.size(); ++h)
+	{
+		advanceWindow(horizons[h], now);
+		prices[h].horizon = std::chrono::duration_cast<std::chrono::minutes>(horizons[h].span);
+		prices[h].volumeWeightedStockPrice = getWindowPrice(horizons[h], prices[h].foundTrades);
+		prices[h].orderFlow = getOrderFlow(horizons[h].sums);
+	}
+}
+
+// Sets the smallest step this record's prices move in. Prices of trades added are then
+// rounded to the nearest tick, and the sums behind its Volume Weighted prices and bars
+// are exact integers, so are identical however and whenever the trades were added.
+// Zero returns to floating point prices.
+// Throws an InvalidOperation if the record holds any trades or bars, and an
+// invalid_argument if tickSizeIn is negative or not finite.
+//
+void TradeRecord::setTickSize(double tickSizeIn)
+{
+	for (const auto& series : barSeries)
+	{
+		if (!series.getBars().empty())
+		{
+			throw InvalidOperation("TradeRecord::setTickSize:\trecord already holds bars.");
+		}
+	}
+	trades.setTickSize(tickSizeIn);
+	for (auto& series : barSeries)
+	{
+		series.setTickSize(tickSizeIn);
+	}
+	window.sums = FlowSums();
+	for (auto& horizon : horizons)
+	{
+		horizon.sums = FlowSums();
+	}
+}
+
+// Sets the clock this TradeRecord takes the present moment from, which must outlive it,
+// and rebuilds the window to end at that clock's present moment. The system clock is
+// used until this is called.
+//
+void TradeRecord::setClock(const Clock& clockIn)
+{
+	clock = &clockIn;
+	rebuildWindows(clock->now());
+	publishSnapshot();
+	notifyListener();
+}
+
+// Sets the retention policy limiting this record's history and applies it immediately.
+//
+void TradeRecord::setRetentionPolicy(const RetentionPolicy& retentionIn)
+{
+	retention = retentionIn;
+	applyRetention(clock->now());
+}
+
+// Internal utility; returns the time before which trades are older than the retention
+// policy's maxAge and outside the window and every horizon.
+//
+TimeStamp TradeRecord::getRetentionCutoff(TimeStamp now)const
+{
+	TimeStamp cutoff = now - std::chrono::duration_cast<std::chrono::system_clock::duration>(retention.maxAge);
+	if (window.lowerBound < cutoff)
+	{
+		cutoff = window.lowerBound;
+	}
+	for (const auto& horizon : horizons)
+	{
+		if (horizon.lowerBound < cutoff)
+		{
+			cutoff = horizon.lowerBound;
+		}
+	}
+	return cutoff;
+}
+
+// Internal utility; releases whatever trades the retention policy no longer requires.
+//
+void TradeRecord::applyRetention(TimeStamp now)
+{
+	const std::size_t chunkCount = trades.getChunkCount();
+	std::size_t evicting = 0;
+
+	if (retention.maxAge > std::chrono::minutes::zero())
+	{
+		const TimeStamp cutoff = getRetentionCutoff(now);
+		while (evicting < chunkCount && trades.getChunkNewestTimeStamp(evicting) < cutoff)
+		{
+			++evicting;
+		}
+	}
+
+	if (retention.maxBytes > 0)
+	{
+		std::size_t memoryUsage = trades.getMemoryUsage();
+		for (std::size_t t = 0; t < evicting; ++t)
+		{
+			memoryUsage -= trades.getChunkMemoryUsage(t);
+		}
+		while (evicting + 1 < chunkCount && memoryUsage > retention.maxBytes)
+		{
+			memoryUsage -= trades.getChunkMemoryUsage(evicting);
+			++evicting;
+		}
+	}
+
+	evictOldestChunks(evicting);
+	chunksAtLastRetention = trades.getChunkCount();
+}
+
+// Releases the oldest 'count' chunks of trades, returning the number of trades released.
+// Any released trades within the window or a horizon are removed from its sums.
+// The listener is not notified.
+//
+std::size_t TradeRecord::evictOldestChunks(std::size_t count)
+{
+	if (0 == count)
+	{
+		return 0;
+	}
+
+	const auto firstKept = trades.beginOfChunk(count);
+	releaseFromWindow(window, firstKept);
+	for (auto& horizon : horizons)
+	{
+		releaseFromWindow(horizon, firstKept);
+	}
+	const std::size_t released = trades.eraseFirstChunks(count);
+	publishSnapshot();
+	return released;
+}
+
+// Internal utility; subtracts from the given window's sums any of its trades before
+// firstKept, which are about to be released.
+//
+void TradeRecord::releaseFromWindow(SlidingWindow& slidingWindow, TradeStore::const_iterator firstKept)const
+{
+	const bool keepingAny = firstKept != trades.end();
+	if (keepingAny && slidingWindow.earliestTimeStamp > firstKept.getTimeStamp())
+	{
+		// none of the released trades are within the window
+		return;
+	}
+	if (keepingAny)
+	{
+		FlowSums released;
+		sumTrades(trades.lowerBound(slidingWindow.earliestTimeStamp), firstKept, released);
+		slidingWindow.sums -= released;
+		slidingWindow.earliestTimeStamp = firstKept.getTimeStamp();
+	}
+	else
+	{
+		slidingWindow.earliestTimeStamp = TimeStamp::max();
+		slidingWindow.sums = FlowSums();
+	}
+}
+
+// Internal utility; adds the trade to the given window's sums if it falls within it.
+//
+void TradeRecord::addToWindow(SlidingWindow& slidingWindow, const Trade& trade)const
+{
+	if (trade.getTimeStamp() < slidingWindow.lowerBound)
+	{
+		return;
+	}
+	trades.accumulate(slidingWindow.sums, trade);
+	if (trade.getTimeStamp() < slidingWindow.earliestTimeStamp)
+	{
+		slidingWindow.earliestTimeStamp = trade.getTimeStamp();
+	}
+}
+
+// Internal utility; adds a newly stored trade to the sums of the window and every
+// horizon, and to every bar series.
+//
+void TradeRecord::addToSummaries(const Trade& trade)
+{
+	addToWindow(window, trade);
+	for (auto& horizon : horizons)
+	{
+		addToWindow(horizon, trade);
+	}
+	for (auto& series : barSeries)
+	{
+		series.addTrade(trade);
+	}
+	if (trade.getTimeStamp() >= lastTradeTime)
+	{
+		lastTradeTime = trade.getTimeStamp();
+		lastPrice = trade.getPrice();
+	}
+}
+
+// Internal utility; publishes the current windowed Volume Weighted Stock Price, last
+// price and trade count to 'snapshot'.
+//
+void TradeRecord::publishSnapshot()
+{
+	TradeSnapshot latest;
+	latest.asOf = clock->now();
+	advanceWindow(window, latest.asOf);
+	latest.volumeWeightedStockPrice = getWindowPrice(window, latest.foundTrades);
+	latest.orderFlow = getOrderFlow(window.sums);
+	latest.lastPrice = lastPrice;
+	latest.lastTradeTime = lastTradeTime;
+	latest.tradeCount = trades.size();
+	snapshot.store(latest);
+}
+
+// Starts rolling trades up into bars of the given resolution, keeping at most maxBars
+// bars (zero for no limit). Bars are built for the trades already held, then updated
+// as each trade is added, and are kept when the trades themselves are released.
+// Throws an InvalidOperation if bars of that resolution are already kept, and an
+// invalid_argument if the resolution is not positive.
+//
+void TradeRecord::addBarSeries(std::chrono::seconds resolution, std::size_t maxBars)
+{
+	auto seriesItr = std::lower_bound(barSeries.begin(), barSeries.end(), resolution,
+		[](const BarSeries& series, std::chrono::seconds value)
+	{
+		return series.getResolution() < value;
+	});
+	if (seriesItr != barSeries.end() && seriesItr->getResolution() == resolution)
+	{
+		throw InvalidOperation("TradeRecord::addBarSeries:\tbars of that resolution are already kept.");
+	}
+
+	BarSeries series(resolution, maxBars, trades.getTickSize());
+	for (auto tradeItr = trades.begin(); tradeItr != trades.end(); ++tradeItr)
+	{
+		series.addTrade(*tradeItr);
+	}
+	barSeries.insert(seriesItr, std::move(series));
+}
+
+// Returns the bars kept at the given resolution.
+// Throws an invalid_argument if bars of that resolution are not kept.
+//
+const BarSeries& TradeRecord::accessBarSeries(std::chrono::seconds resolution)const
+{
+	for (const auto& series : barSeries)
+	{
+		if (series.getResolution() == resolution)
+		{
+			return series;
+		}
+	}
+	throw std::invalid_argument("TradeRecord::accessBarSeries:\tbars of that resolution are not kept.");
+}
+
+// Summarizes the trades in [startTimeStamp, endTimeStamp) from the bars: the bars of the
+// coarsest resolution that fit whole within the period cover as much of it as they can,
+// the finer resolutions cover what is left at either end in the same way, and the trades
+// themselves cover whatever is left after the finest, so that the summary is exact
+// however the period is aligned. Trades released by retention are missing from the
+// parts of the period covered by trades rather than bars.
+// Returns false if there are no trades in the period.
+// Throws an InvalidOperation if no bars are kept.
+//
+bool TradeRecord::summarizeBars(TimeStamp startTimeStamp, TimeStamp endTimeStamp, Bar& summary)const
+{
+	if (barSeries.empty())
+	{
+		throw InvalidOperation("TradeRecord::summarizeBars:\tno bars are kept.");
+	}
+	Bar result = Bar();
+	result.start = startTimeStamp;
+	result.tickSize = trades.getTickSize();
+	summarizeBarsBetween(barSeries.size(), startTimeStamp, endTimeStamp, result);
+	if (0 == result.tradeCount)
+	{
+		return false;
+	}
+	summary = result;
+	return true;
+}
+
+// Internal utility; merges the trades in [startTimeStamp, endTimeStamp) into 'summary',
+// from the bars of the coarsest of the first seriesCount bar series that fit whole
+// within the period, and from finer series or the trades themselves at either end.
+//
+void TradeRecord::summarizeBarsBetween(std::size_t seriesCount,
+	TimeStamp startTimeStamp,
+	TimeStamp endTimeStamp,
+	Bar& summary)const
+{
+	if (startTimeStamp >= endTimeStamp)
+	{
+		return;
+	}
+	for (std::size_t s = seriesCount; s-- > 0;)
+	{
+		const BarSeries& series = barSeries[s];
+		TimeStamp interiorStart = series.getBarStart(startTimeStamp);
+		if (interiorStart < startTimeStamp)
+		{
+			interiorStart += series.getResolution();
+		}
+		const TimeStamp interiorEnd = series.getBarStart(endTimeStamp);
+		if (interiorStart < interiorEnd)
+		{
+			Bar interior = Bar();
+			if (series.summarize(interiorStart, interiorEnd, interior))
+			{
+				summary.merge(interior);
+			}
+			summarizeBarsBetween(s, startTimeStamp, interiorStart, summary);
+			summarizeBarsBetween(s, interiorEnd, endTimeStamp, summary);
+			return;
+		}
+	}
+
+	// no bar fits within the period, so it is summarized from the trades
+	const auto last = trades.lowerBound(endTimeStamp);
+	for (auto tradeItr = trades.lowerBound(startTimeStamp); tradeItr != last; ++tradeItr)
+	{
+		summary.add(*tradeItr);
+	}
+}
+
+// Internal utility; moves the given window's lower bound forward to now - span,
+// subtracting any trades which have fallen out of it.
+//
+void TradeRecord::advanceWindow(SlidingWindow& slidingWindow, TimeStamp now)const
+{
+	const TimeStamp newLowerBound = now - slidingWindow.span;
+	if (newLowerBound <= slidingWindow.lowerBound)
+	{
+		return;
+	}
+	if (slidingWindow.earliestTimeStamp >= newLowerBound)
+	{
+		// nothing has left the window
+		slidingWindow.lowerBound = newLowerBound;
+		return;
+	}
+
+	const auto expiredEnd = trades.lowerBound(newLowerBound);
+	FlowSums expired;
+	sumTrades(trades.lowerBound(slidingWindow.lowerBound), expiredEnd, expired);
+	slidingWindow.sums -= expired;
+
+	slidingWindow.lowerBound = newLowerBound;
+	if (expiredEnd == trades.end())
+	{
+		// Reset exactly so that rounding from repeated subtraction cannot accumulate
+		slidingWindow.earliestTimeStamp = TimeStamp::max();
+		slidingWindow.sums = FlowSums();
+	}
+	else
+	{
+		slidingWindow.earliestTimeStamp = expiredEnd.getTimeStamp();
+	}
+}
+
+// Internal utility; advances the window and every horizon to now.
+//
+void TradeRecord::advanceWindows(TimeStamp now)const
+{
+	advanceWindow(window, now);
+	for (auto& horizon : horizons)
+	{
+		advanceWindow(horizon, now);
+	}
+}
+
+// Internal utility; rebuilds the given window's sums from scratch for it to end now.
+//
+void TradeRecord::rebuildWindow(SlidingWindow& slidingWindow, TimeStamp now)const
+{
+	slidingWindow.lowerBound = now - slidingWindow.span;
+	slidingWindow.sums = FlowSums();
+	const auto first = trades.lowerBound(slidingWindow.lowerBound);
+	slidingWindow.earliestTimeStamp = (first == trades.end()) ? TimeStamp::max() : first.getTimeStamp();
+	sumTrades(first, trades.end(), slidingWindow.sums);
+}
+
+// Internal utility; rebuilds the window and every horizon to end now.
+//
+void TradeRecord::rebuildWindows(TimeStamp now)const
+{
+	rebuildWindow(window, now);
+	for (auto& horizon : horizons)
+	{
+		rebuildWindow(horizon, now);
+	}
+}
+
+// Internal utility; the Volume Weighted Stock Price over the given window, which must
+// have been advanced to the present.
+//
+double TradeRecord::getWindowPrice(const SlidingWindow& slidingWindow, bool&foundTrades)const
+{
+	foundTrades = slidingWindow.earliestTimeStamp != TimeStamp::max();
+	return trades.getVolumeWeightedPrice(slidingWindow.sums.getTotal());
+}
+
+// Internal utility; returns the window or horizon of the given span, or nullptr if
+// neither is maintained.
+//
+TradeRecord::SlidingWindow* TradeRecord::findWindow(std::chrono::system_clock::duration span)const
+{
+	if (span == window.span)
+	{
+		return &window;
+	}
+	for (auto& horizon : horizons)
+	{
+		if (span == horizon.span)
+		{
+			return &horizon;
+		}
+	}
+	return nullptr;
+}
+
+// Internal utility; the order flow over the given sums
+//
+OrderFlow TradeRecord::getOrderFlow(const FlowSums& sums)const
+{
+	OrderFlow flow;
+	flow.buyVolumeWeightedPrice = trades.getVolumeWeightedPrice(sums.buys);
+	flow.sellVolumeWeightedPrice = trades.getVolumeWeightedPrice(sums.sells);
+	flow.buyQuantity = sums.buys.quantity;
+	flow.sellQuantity = sums.sells.quantity;
+	return flow;
+}
+
+// Internal utility; adds the quantity and price*quantity of the trades in [first, last)
+// to the buys or sells of 'sums' by their side. With a tick size each chunk's run of
+// the trades costs one subtraction of its running totals per side; otherwise trades
+// are added up one by one, so that floating point sums carry no rounding from trades
+// outside the range.
+//
+void TradeRecord::sumTrades(TradeStore::const_iterator first,
+	TradeStore::const_iterator last,
+	FlowSums& sums)const
+{
+	trades.forEachRun(first, last, [&](const TradeStore::Chunk& chunk, std::size_t begin, std::size_t end)
+	{
+		trades.accumulateRun(chunk, begin, end, sums);
+		SUPERSIMPLESTOCKS_METRICS_COUNT(TRADES_SCANNED, (trades.getTickSize() > 0.0) ? 0 : end - begin);
+	});
+}
+
+// Adds a Trade to the TradeRecord, using the present moment of its clock as its timeStamp
 // This operation may improve insertion performance by assuming the trade is the newest trade.
 //   As with Trade::Trade:
 //			quantity must be 1 or greater or an invalid_argument will be thrown.
-//			price must be 0.0 or greater or an invalid_argument will be thrown.
+//			price must be finite and 0.0 or greater or an invalid_argument will be thrown.
+// See TradeStore::roundToTick for the limit on trades with a tick size.
 //
 void TradeRecord::addTrade(int quantity, BuyOrSellType buyOrSellType, double price)
 {
-	TimeStamp now = std::chrono::system_clock::now();
-	trades.emplace_hint(
-		trades.end(),
-		std::piecewise_construct,
-		std::forward_as_tuple(now),
-		std::forward_as_tuple(quantity, buyOrSellType, price, now));
+	SUPERSIMPLESTOCKS_METRICS_TIME(ADD_TRADE_NANOSECONDS);
+	TimeStamp now = clock->now();
+	const Trade trade = trades.roundToTick(Trade(quantity, buyOrSellType, price, now));
+	trades.insert(trade);
+	advanceWindows(now);
+	addToSummaries(trade);
+	checkRetention();
+	publishSnapshot();
+	notifyListener();
+	SUPERSIMPLESTOCKS_METRICS_COUNT(TRADES_INGESTED, 1);
 }
 
 // Adds a Trade to the TradeRecord, using the given time as its timeStamp
 //   As with Trade::Trade:
 //			quantity must be 1 or greater or an invalid_argument will be thrown.
-//			price must be 0.0 or greater or an invalid_argument will be thrown.
+//			price must be finite and 0.0 or greater or an invalid_argument will be thrown.
+// See TradeStore::roundToTick for the limit on trades with a tick size.
 //
 void TradeRecord::addTrade(int quantity, BuyOrSellType buyOrSellType, double price, TimeStamp timeStamp)
 {
-	trades.emplace(std::piecewise_construct,
-		std::forward_as_tuple(timeStamp),
-		std::forward_as_tuple(quantity, buyOrSellType, price, timeStamp));
+	SUPERSIMPLESTOCKS_METRICS_TIME(ADD_TRADE_NANOSECONDS);
+	const Trade trade = trades.roundToTick(Trade(quantity, buyOrSellType, price, timeStamp));
+	trades.insert(trade);
+	addToSummaries(trade);
+	checkRetention();
+	publishSnapshot();
+	notifyListener();
+	SUPERSIMPLESTOCKS_METRICS_COUNT(TRADES_INGESTED, 1);
 }
 
 // Adds an existing Trade to the TradeRecord.
+// See TradeStore::roundToTick for the limit on trades with a tick size.
+//
+void TradeRecord::addTrade(const Trade tradeIn)
+{
+	SUPERSIMPLESTOCKS_METRICS_TIME(ADD_TRADE_NANOSECONDS);
+	const Trade trade = trades.roundToTick(tradeIn);
+	trades.insert(trade);
+	addToSummaries(trade);
+	checkRetention();
+	publishSnapshot();
+	notifyListener();
+	SUPERSIMPLESTOCKS_METRICS_COUNT(TRADES_INGESTED, 1);
+}
+
+// Adds 'count' existing Trades to the TradeRecord in one pass. The trades need not be
+// in time order; if they are not, they are sorted in a single working buffer first.
+// The listener, if any, is notified once for the whole batch.
+// With a tick size, every trade is rounded and checked before any is added;
+// see TradeStore::roundToTick.
 //
-void TradeRecord::addTrade(const Trade trade)
+void TradeRecord::addTrades(const Trade* tradesIn, std::size_t count)
 {
-	trades.insert(std::make_pair(trade.getTimeStamp(), trade));
+	if (0 == count)
+	{
+		return;
+	}
+
+	auto earlier = [](const Trade& a, const Trade& b)
+	{
+		return a.getTimeStamp() < b.getTimeStamp();
+	};
+
+	std::vector<Trade> sorted;
+	const Trade* sortedTrades = tradesIn;
+	if (trades.getTickSize() > 0.0)
+	{
+		sorted.reserve(count);
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			sorted.push_back(trades.roundToTick(tradesIn[t]));
+		}
+		sortedTrades = sorted.data();
+	}
+	if (!std::is_sorted(sortedTrades, sortedTrades + count, earlier))
+	{
+		if (sorted.empty())
+		{
+			sorted.assign(tradesIn, tradesIn + count);
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), earlier);
+		sortedTrades = sorted.data();
+	}
+
+	trades.insertSorted(sortedTrades, count);
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		addToSummaries(sortedTrades[t]);
+	}
+	checkRetention();
+	publishSnapshot();
+	notifyListener();
+	SUPERSIMPLESTOCKS_METRICS_COUNT(TRADES_INGESTED, count);
+}
+
+// Adds 'count' trades given as separate columns, as held in a snapshot, copying each
+// column a chunk at a time without building individual Trades. timeStamps holds
+// each trade's time since the epoch in ticks of the system clock.
+// Every trade is checked first, and none are added if any fails: an invalid_argument
+// is thrown unless the trades start at or after the newest trade held and are in time
+// order, and each has a quantity of 1 or more, a finite price of 0.0 or more, a type of
+// BUY_TYPE or SELL_TYPE and, with a tick size, a price in whole ticks within the limit
+// of TradeStore::roundToTick.
+//
+void TradeRecord::restoreTrades(const std::int64_t* timeStamps,
+	const double* prices,
+	const unsigned int* quantities,
+	const unsigned char* buyOrSellTypes,
+	std::size_t count)
+{
+	if (0 == count)
+	{
+		return;
+	}
+	auto toTimeStamp = [](std::int64_t ticks)
+	{
+		return TimeStamp(std::chrono::system_clock::duration(ticks));
+	};
+	if ((!trades.empty() && toTimeStamp(timeStamps[0]) < trades.getNewestTimeStamp())
+		|| !std::is_sorted(timeStamps, timeStamps + count))
+	{
+		throw std::invalid_argument("TradeRecord::restoreTrades:\ttrades must follow the newest trade, in time order.");
+	}
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		if (0 == quantities[t]
+			|| !std::isfinite(prices[t])
+			|| prices[t] < 0.0
+			|| (BUY_TYPE != buyOrSellTypes[t] && SELL_TYPE != buyOrSellTypes[t]))
+		{
+			throw std::invalid_argument("TradeRecord::restoreTrades:\ttrade " + std::to_string(t) + " is not a valid trade.");
+		}
+		if (trades.getTickSize() > 0.0)
+		{
+			// throws if the price in ticks times the quantity cannot be summed exactly
+			const Trade trade(quantities[t], static_cast<BuyOrSellType>(buyOrSellTypes[t]), prices[t], toTimeStamp(timeStamps[t]));
+			if (trades.roundToTick(trade).getPrice() != prices[t])
+			{
+				throw std::invalid_argument("TradeRecord::restoreTrades:\ttrade " + std::to_string(t) + " is not priced in whole ticks.");
+			}
+		}
+	}
+
+	trades.appendColumns(timeStamps, prices, quantities, buyOrSellTypes, count);
+	for (auto& series : barSeries)
+	{
+		for (std::size_t t = 0; t < count; ++t)
+		{
+			series.addTrade(Trade(quantities[t], static_cast<BuyOrSellType>(buyOrSellTypes[t]), prices[t], toTimeStamp(timeStamps[t])));
+		}
+	}
+	if (toTimeStamp(timeStamps[count - 1]) >= lastTradeTime)
+	{
+		lastTradeTime = toTimeStamp(timeStamps[count - 1]);
+		lastPrice = prices[count - 1];
+	}
+
+	rebuildWindows(clock->now());
+	checkRetention();
+	publishSnapshot();
+	notifyListener();
 }
 
 // Returns the Volume Weighted Stock Price based on the last five minutes of trades
@@ -50,11 +734,61 @@ double TradeRecord::calculateVolumeWeightedStockPriceWithinFiveMinutes(bool&foun
 // Returns the Volume Weighted Stock Price based on the last "min" minutes.
 // Out parameter foundTrades will be true if there were trades within that time.
 //		If not, foundTrades will be false, and the return value 0.0
+// If "min" matches the TradeRecord's window or one of its horizons then the maintained
+// sums are used, costing amortized constant time; otherwise the running totals of
+// the trades within "min" are used, costing two binary searches.
 //
 double TradeRecord::calculateVolumeWeightedStockPriceWithin(bool&foundTrades, const std::chrono::minutes min)const
 {
-	TimeStamp startTimeStamp = std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(min);
-	return calculateVolumeWeightedStockPriceSince(foundTrades, startTimeStamp);
+	SUPERSIMPLESTOCKS_METRICS_TIME_QUERY(VWSP_QUERY_NANOSECONDS);
+	const TimeStamp now = clock->now();
+	const auto span = std::chrono::duration_cast<std::chrono::system_clock::duration>(min);
+	SlidingWindow* maintained = findWindow(span);
+	if (nullptr == maintained)
+	{
+		return volumeWeightedStockPriceBetween(foundTrades, now - span, TimeStamp::max());
+	}
+
+	advanceWindow(*maintained, now);
+	return getWindowPrice(*maintained, foundTrades);
+}
+
+// Returns the time after which the oldest trade within the last "min" minutes will have
+// left them, changing the Volume Weighted Stock Price within "min", or TimeStamp::max()
+// if there are no trades within "min". Costs one binary search.
+//
+TimeStamp TradeRecord::getExpiryTimeWithin(const std::chrono::minutes min)const
+{
+	const auto span = std::chrono::duration_cast<std::chrono::system_clock::duration>(min);
+	const TradeStore::const_iterator oldest = trades.lowerBound(clock->now() - span);
+	if (oldest == trades.end() || TimeStamp::max() - span <= oldest.getTimeStamp())
+	{
+		return TimeStamp::max();
+	}
+	return oldest.getTimeStamp() + span;
+}
+
+// Returns the buy and sell order flow over the last "min" minutes: the Volume Weighted
+// price and total quantity of each side, from which its imbalance follows.
+// If "min" matches the TradeRecord's window or one of its horizons then the maintained
+// sums are used, which every trade is added to as it arrives, costing amortized
+// constant time; otherwise the trades within "min" are scanned.
+//
+OrderFlow TradeRecord::calculateOrderFlowWithin(const std::chrono::minutes min)const
+{
+	SUPERSIMPLESTOCKS_METRICS_TIME_QUERY(VWSP_QUERY_NANOSECONDS);
+	const TimeStamp now = clock->now();
+	const auto span = std::chrono::duration_cast<std::chrono::system_clock::duration>(min);
+	SlidingWindow* maintained = findWindow(span);
+	if (nullptr == maintained)
+	{
+		FlowSums sums;
+		sumTrades(trades.lowerBound(now - span), trades.end(), sums);
+		return getOrderFlow(sums);
+	}
+
+	advanceWindow(*maintained, now);
+	return getOrderFlow(maintained->sums);
 }
 
 // Returns the Volume Weighted Stock Price from the given time startTimeStamp until the present.
@@ -63,31 +797,47 @@ double TradeRecord::calculateVolumeWeightedStockPriceWithin(bool&foundTrades, co
 //
 double TradeRecord::calculateVolumeWeightedStockPriceSince(bool&foundTrades, const TimeStamp startTimeStamp)const
 {
-	if (trades.empty())
-	{
-		foundTrades = false;
-		return 0.0;
-	}
-
-	double quantitySum = 0;
-	double sumOfPriceAndQuantity = 0;
+	return calculateVolumeWeightedStockPriceBetween(foundTrades, startTimeStamp, TimeStamp::max());
+}
 
-	for (auto tradeItr = trades.crbegin(); tradeItr != trades.crend(); ++tradeItr)
+// Returns the Volume Weighted Stock Price over trades from startTimeStamp to endTimeStamp inclusive.
+// This uses running totals held by the trade store, so costs two binary searches rather
+// than a walk over the trades in the range.
+// Out parameter foundTrades will be true if there were trades within that time.
+//		If not, foundTrades will be false, and the return value 0.0
+// Throws an InvalidTimeError if endTimeStamp is before startTimeStamp.
+//
+double TradeRecord::calculateVolumeWeightedStockPriceBetween(bool&foundTrades,
+	const TimeStamp startTimeStamp,
+	const TimeStamp endTimeStamp)const
+{
+	if (endTimeStamp < startTimeStamp)
 	{
-		if (tradeItr->first < startTimeStamp)
-		{
-			break;
-		}
-		quantitySum += tradeItr->second.getQuantity();
-		sumOfPriceAndQuantity += tradeItr->second.getPrice()*tradeItr->second.getQuantity();
+		throw InvalidTimeError("TradeRecord::calculateVolumeWeightedStockPriceBetween:\tend is before start.");
 	}
 
-	foundTrades = true;
-	if (0.0 == quantitySum)
+	SUPERSIMPLESTOCKS_METRICS_TIME_QUERY(VWSP_QUERY_NANOSECONDS);
+	return volumeWeightedStockPriceBetween(foundTrades, startTimeStamp, endTimeStamp);
+}
+
+// Internal utility; the Volume Weighted Stock Price over trades from startTimeStamp to
+// endTimeStamp inclusive, which must not be before startTimeStamp.
+//
+double TradeRecord::volumeWeightedStockPriceBetween(bool&foundTrades,
+	const TimeStamp startTimeStamp,
+	const TimeStamp endTimeStamp)const
+{
+	const auto first = trades.lowerBound(startTimeStamp);
+	const auto last = trades.upperBound(endTimeStamp);
+	foundTrades = first != last;
+	if (!foundTrades)
 	{
 		return 0.0;
 	}
-	return sumOfPriceAndQuantity / quantitySum;
+
+	TradeSums sums;
+	trades.sumRange(first, last, sums);
+	return trades.getVolumeWeightedPrice(sums);
 }
 
 // Outputs the Trade Record to the given output stream as a text formatted table.
@@ -102,14 +852,18 @@ void TradeRecord::printTo(std::ostream&out, const std::string title)
 	out << "\tTrade Record for " << title << endl
 		<< "-------------------------------------------------------------------------------\n"
 		<< "Quantity\tBuy Or Sell\tPrice\t\tTime stamp\n";
-	for (auto itr = trades.cbegin(); itr != trades.end(); ++itr)
+	for (auto itr = trades.begin(); itr != trades.end(); ++itr)
 	{
-		std::time_t time = std::chrono::system_clock::to_time_t(itr->second.getTimeStamp());
+		std::time_t time = std::chrono::system_clock::to_time_t(itr.getTimeStamp());
 		std::tm date;
+#ifdef _WIN32
 		localtime_s(&date, &time);
-		out << itr->second.getQuantity()
-			<< "\t\t" << (itr->second.getBuyOrSellType() == BUY_TYPE ? "Buy" : "Sell")
-			<< "\t\t" << itr->second.getPrice()
+#else
+		localtime_r(&time, &date);
+#endif
+		out << itr.getQuantity()
+			<< "\t\t" << (itr.getBuyOrSellType() == BUY_TYPE ? "Buy" : "Sell")
+			<< "\t\t" << itr.getPrice()
 			<< "\t\t" << date.tm_hour << ':' << date.tm_min << ':' << date.tm_sec
 			<< endl;
 	}
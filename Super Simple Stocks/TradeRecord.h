@@ -3,59 +3,580 @@
 *
 * An instance of TradeRecord manages a collection of trades for a particular stock,
 * and provides methods for querying those trades and adding new trades.
+*
+* A TradeRecord is not thread-safe, even for its const methods: windowed queries expire
+* trades from the maintained window and horizons as they go, so two threads querying at
+* once, or one querying while another adds trades, race. Only getSnapshot may be called
+* concurrently with other calls. StockGroup serializes access to its stocks' records.
 */
 #pragma once
 #ifndef SUPERSIMPLESTOCKS_TRADE_RECORD
 #define SUPERSIMPLESTOCKS_TRADE_RECORD
-#include"Trade.h"
-#include<map>
+#include"BarSeries.h"
+#include"Clock.h"
+#include"SeqLock.h"
+#include"TradeStore.h"
+#include<cstddef>
+#include<cstdint>
+#include<iosfwd>
+#include<string>
+#include<vector>
+
+/* Implemented by owners of TradeRecords which need to know when a record's
+*	windowed Volume Weighted Stock Price may have changed.
+*/
+class TradeRecordListener
+{
+public:
+
+	virtual ~TradeRecordListener()
+	{
+		// done //
+	}
+
+	// Called after trades are added to a TradeRecord or its window is changed.
+	// 'key' is the value the listener was registered with.
+	//
+	virtual void onTradesChanged(std::size_t key) = 0;
+};
+
+/* Limits on how much trade history a TradeRecord keeps. Trades are released a chunk at
+*	a time as trades are added: maxBytes is checked whenever the record starts a new
+*	chunk, and maxAge on every insert against the age of the oldest chunk, so that a
+*	stock trading too slowly to fill chunks still releases its old trades. maxAge never
+*	releases trades still within the record's window or horizons; maxBytes may, but
+*	always leaves the newest chunk. A value of zero leaves that limit unset.
+*/
+struct RetentionPolicy
+{
+	std::chrono::minutes maxAge;
+	std::size_t maxBytes;
+
+	explicit RetentionPolicy(std::chrono::minutes maxAgeIn = std::chrono::minutes::zero(),
+		std::size_t maxBytesIn = 0) :
+		maxAge(maxAgeIn),
+		maxBytes(maxBytesIn)
+	{
+		// done //
+	}
+
+	// Returns true IFF either limit is set
+	//
+	bool isLimited()const
+	{
+		return maxAge > std::chrono::minutes::zero() || maxBytes > 0;
+	}
+};
+
+/* The buy and sell order flow over a window of a TradeRecord's trades. Each Volume
+*	Weighted price is over the trades of that side alone, and is 0.0 if there were none.
+*/
+struct OrderFlow
+{
+	double buyVolumeWeightedPrice;
+	double sellVolumeWeightedPrice;
+	std::uint64_t buyQuantity;
+	std::uint64_t sellQuantity;
+
+	// Returns the order flow imbalance, (buyQuantity - sellQuantity) / (buyQuantity + sellQuantity):
+	// 1.0 when every trade was a buy, -1.0 when every trade was a sell, and 0.0 when
+	// there were no trades
+	//
+	double getImbalance()const
+	{
+		const std::uint64_t totalQuantity = buyQuantity + sellQuantity;
+		if (0 == totalQuantity)
+		{
+			return 0.0;
+		}
+		return (static_cast<double>(buyQuantity) - static_cast<double>(sellQuantity)) / static_cast<double>(totalQuantity);
+	}
+};
+
+/* The latest values computed by a TradeRecord, as published for reader threads.
+*	volumeWeightedStockPrice, foundTrades and orderFlow are over the record's window as
+*	of 'asOf', the time the snapshot was published. lastPrice is the price of the trade
+*	with the newest time stamp, lastTradeTime; both are meaningless while tradeCount is zero.
+*/
+struct TradeSnapshot
+{
+	TimeStamp asOf;
+	double volumeWeightedStockPrice;
+	bool foundTrades;
+	OrderFlow orderFlow;
+	double lastPrice;
+	TimeStamp lastTradeTime;
+	std::size_t tradeCount;
+};
+
+/* The Volume Weighted Stock Price over one of a TradeRecord's horizons, as filled in
+*	by TradeRecord::calculateHorizonPrices
+*/
+struct HorizonPrice
+{
+	std::chrono::minutes horizon;
+	double volumeWeightedStockPrice;
+	bool foundTrades;
+	OrderFlow orderFlow;
+};
 
 class TradeRecord
 {
-	// Multimap 'trades' stores trades ordered by time, but with the possibility for several
-	// trades to exist at the same point in time without issue.
+	// 'trades' stores trades ordered by time in contiguous columns, with the possibility
+	// for several trades to exist at the same point in time without issue.
 	//
-	std::multimap<TimeStamp, Trade> trades;
+	TradeStore trades;
+
+	// SlidingWindow keeps running sums of price*quantity and quantity over the trades
+	// within 'span' of the present, for buys and sells apart, so that windowed VWSP and
+	// order flow queries need not walk 'trades'.
+	// lowerBound only ever moves forward; trades falling behind it are subtracted lazily
+	// when the window is next queried. earliestTimeStamp is the oldest trade still summed,
+	// or TimeStamp::max() when the window is empty, and lets a query skip expiry entirely
+	// when nothing has left the window.
+	//
+	struct SlidingWindow
+	{
+		std::chrono::system_clock::duration span;
+		TimeStamp lowerBound;
+		TimeStamp earliestTimeStamp;
+		FlowSums sums;
+	};
+
+	// The window is mutable so that const queries can expire trades from it as time
+	// passes. Those queries therefore write to the record, which is why const methods
+	// are no more thread-safe than the rest.
+	//
+	mutable SlidingWindow window;
+
+	// Further windows maintained alongside 'window', shortest first, so that the Volume
+	// Weighted Stock Price over each is also found without walking 'trades'; see setHorizons
+	//
+	mutable std::vector<SlidingWindow> horizons;
+
+	// Where the present moment is read from; not owned
+	//
+	const Clock* clock;
+
+	TradeRecordListener* listener;
+	std::size_t listenerKey;
+
+	RetentionPolicy retention;
+
+	// Number of chunks in 'trades' when retention was last applied
+	//
+	std::size_t chunksAtLastRetention;
+
+	// Internal utility; applies the retention policy if the store has started a new chunk
+	// since it was last applied, or if the oldest chunk has aged past maxAge and out of
+	// the window and every horizon, which costs one comparison per horizon.
+	//
+	void checkRetention()
+	{
+		if (!retention.isLimited())
+		{
+			return;
+		}
+		if (trades.getChunkCount() != chunksAtLastRetention)
+		{
+			applyRetention(clock->now());
+		}
+		else if (retention.maxAge > std::chrono::minutes::zero() && trades.getChunkCount() > 0)
+		{
+			const TimeStamp now = clock->now();
+			if (trades.getChunkNewestTimeStamp(0) < getRetentionCutoff(now))
+			{
+				applyRetention(now);
+			}
+		}
+	}
+
+	// Internal utility; returns the time before which trades are older than the retention
+	// policy's maxAge and outside the window and every horizon.
+	//
+	TimeStamp getRetentionCutoff(TimeStamp now)const;
+
+	// Internal utility; releases whatever trades the retention policy no longer requires.
+	//
+	void applyRetention(TimeStamp now);
+
+	// Internal utility; informs the listener, if any, that trades have changed.
+	//
+	void notifyListener()
+	{
+		if (nullptr != listener)
+		{
+			listener->onTradesChanged(listenerKey);
+		}
+	}
+
+	// Bar rollups of the trades, ordered from finest to coarsest resolution
+	//
+	std::vector<BarSeries> barSeries;
+
+	// The newest trade by time stamp, kept even once the trade itself is released
+	//
+	TimeStamp lastTradeTime;
+	double lastPrice;
+
+	// The values last published for readers on other threads
+	//
+	SeqLock<TradeSnapshot> snapshot;
+
+	// Internal utility; publishes the current windowed Volume Weighted Stock Price, last
+	// price and trade count to 'snapshot'.
+	//
+	void publishSnapshot();
+
+	// Internal utility; adds the trade to the given window's sums if it falls within it.
+	//
+	void addToWindow(SlidingWindow& slidingWindow, const Trade& trade)const;
+
+	// Internal utility; adds a newly stored trade to the sums of the window and every
+	// horizon, and to every bar series.
+	//
+	void addToSummaries(const Trade& trade);
+
+	// Internal utility; adds the quantity and price*quantity of the trades in [first, last)
+	// to the buys or sells of 'sums' by their side. With a tick size each chunk's run of
+	// the trades costs one subtraction of its running totals per side; otherwise trades
+	// are added up one by one, so that floating point sums carry no rounding from trades
+	// outside the range.
+	//
+	void sumTrades(TradeStore::const_iterator first,
+		TradeStore::const_iterator last,
+		FlowSums& sums)const;
+
+	// Internal utility; moves the given window's lower bound forward to now - span,
+	// subtracting any trades which have fallen out of it.
+	//
+	void advanceWindow(SlidingWindow& slidingWindow, TimeStamp now)const;
+
+	// Internal utility; advances the window and every horizon to now.
+	//
+	void advanceWindows(TimeStamp now)const;
+
+	// Internal utility; rebuilds the given window's sums from scratch for it to end now.
+	//
+	void rebuildWindow(SlidingWindow& slidingWindow, TimeStamp now)const;
+
+	// Internal utility; rebuilds the window and every horizon to end now.
+	//
+	void rebuildWindows(TimeStamp now)const;
+
+	// Internal utility; subtracts from the given window's sums any of its trades before
+	// firstKept, which are about to be released.
+	//
+	void releaseFromWindow(SlidingWindow& slidingWindow, TradeStore::const_iterator firstKept)const;
+
+	// Internal utility; the Volume Weighted Stock Price over the given window, which must
+	// have been advanced to the present.
+	//
+	double getWindowPrice(const SlidingWindow& slidingWindow, bool&foundTrades)const;
+
+	// Internal utility; returns the window or horizon of the given span, or nullptr if
+	// neither is maintained.
+	//
+	SlidingWindow* findWindow(std::chrono::system_clock::duration span)const;
+
+	// Internal utility; the order flow over the given sums
+	//
+	OrderFlow getOrderFlow(const FlowSums& sums)const;
+
+	// Internal utility; merges the trades in [startTimeStamp, endTimeStamp) into 'summary',
+	// from the bars of the coarsest of the first seriesCount bar series that fit whole
+	// within the period, and from finer series or the trades themselves at either end.
+	//
+	void summarizeBarsBetween(std::size_t seriesCount,
+		TimeStamp startTimeStamp,
+		TimeStamp endTimeStamp,
+		Bar& summary)const;
+
+	// Internal utility; the Volume Weighted Stock Price over trades from startTimeStamp to
+	// endTimeStamp inclusive, which must not be before startTimeStamp.
+	//
+	double volumeWeightedStockPriceBetween(bool&foundTrades,
+		const TimeStamp startTimeStamp,
+		const TimeStamp endTimeStamp)const;
 
 public:
 
-	// Adds a Trade to the TradeRecord, using the current time as its timeStamp
+	static const std::chrono::minutes DEFAULT_WINDOW;
+
+	// Build an empty TradeRecord maintaining a Volume Weighted Stock Price over the
+	// given window. The window must be positive or an invalid_argument is thrown.
+	// Trades are stored in memory from allocatorIn, which must outlive the record.
+	//
+	explicit TradeRecord(std::chrono::minutes windowIn = DEFAULT_WINDOW,
+		Allocator& allocatorIn = HeapAllocator::getInstance());
+
+	// Returns the window over which this TradeRecord maintains its Volume Weighted Stock Price
+	//
+	std::chrono::minutes getWindow()const
+	{
+		return std::chrono::duration_cast<std::chrono::minutes>(window.span);
+	}
+
+	// Changes the window over which the Volume Weighted Stock Price is maintained.
+	// This rescans the trades within the new window once.
+	// The window must be positive or an invalid_argument is thrown.
+	//
+	void setWindow(std::chrono::minutes windowIn);
+
+	// Returns the horizons maintained alongside the window, shortest first
+	//
+	std::vector<std::chrono::minutes> getHorizons()const;
+
+	// Sets further windows, or horizons, over which Volume Weighted Stock Prices are
+	// maintained alongside the record's window, replacing any set before; an empty set
+	// removes them all. Each trade is added to the sums of every horizon it falls within
+	// as it arrives, and subtracted from each as it expires, so no query rescans the
+	// trades: calculateHorizonPrices finds the price over every horizon at once, and
+	// calculateVolumeWeightedStockPriceWithin costs amortized constant time for any of
+	// them. A horizon given more than once is kept once. This rescans the trades within
+	// each horizon once.
+	// Every horizon must be positive or an invalid_argument is thrown.
+	//
+	void setHorizons(const std::vector<std::chrono::minutes>& horizonsIn);
+
+	// Fills 'prices' with the Volume Weighted Stock Price and order flow over each horizon
+	// as of the present, shortest horizon first, replacing its contents. This costs amortized
+	// constant time per horizon.
+	//
+	void calculateHorizonPrices(std::vector<HorizonPrice>& prices)const;
+
+	// Returns the smallest step this record's prices move in, or zero if they are held
+	// in floating point
+	//
+	double getTickSize()const
+	{
+		return trades.getTickSize();
+	}
+
+	// Sets the smallest step this record's prices move in. Prices of trades added are then
+	// rounded to the nearest tick, and the sums behind its Volume Weighted prices and bars
+	// are exact integers, so are identical however and whenever the trades were added.
+	// Zero returns to floating point prices.
+	// Throws an InvalidOperation if the record holds any trades or bars, and an
+	// invalid_argument if tickSizeIn is negative or not finite.
+	//
+	void setTickSize(double tickSizeIn);
+
+	// Returns the clock this TradeRecord takes the present moment from
+	//
+	const Clock& getClock()const
+	{
+		return *clock;
+	}
+
+	// Sets the clock this TradeRecord takes the present moment from, which must outlive it,
+	// and rebuilds the window to end at that clock's present moment. The system clock is
+	// used until this is called.
+	//
+	void setClock(const Clock& clockIn);
+
+	// Returns the time after which the oldest trade in the window will have expired,
+	// changing the windowed Volume Weighted Stock Price, or TimeStamp::max() if the
+	// window holds no trades.
+	//
+	TimeStamp getWindowExpiryTime()const
+	{
+		if (TimeStamp::max() - window.span <= window.earliestTimeStamp)
+		{
+			return TimeStamp::max();
+		}
+		return window.earliestTimeStamp + window.span;
+	}
+
+	// Returns the retention policy limiting this record's history
+	//
+	const RetentionPolicy& getRetentionPolicy()const
+	{
+		return retention;
+	}
+
+	// Sets the retention policy limiting this record's history and applies it immediately.
+	//
+	void setRetentionPolicy(const RetentionPolicy& retentionIn);
+
+	// Returns the number of trades held
+	//
+	std::size_t getTradeCount()const
+	{
+		return trades.size();
+	}
+
+	// Returns read only access to the trades held, in time order
+	//
+	const TradeStore& accessTradeStore()const
+	{
+		return trades;
+	}
+
+	// Returns the number of bytes of memory held for trades
+	//
+	std::size_t getMemoryUsage()const
+	{
+		return trades.getMemoryUsage();
+	}
+
+	// Returns the number of chunks of trades held
+	//
+	std::size_t getChunkCount()const
+	{
+		return trades.getChunkCount();
+	}
+
+	// Returns the time stamp of the newest trade in the oldest chunk, which is as far as
+	// evictOldestChunks(1) would release trades, or TimeStamp::max() if no trades are held.
+	//
+	TimeStamp getOldestChunkTimeStamp()const
+	{
+		return trades.empty() ? TimeStamp::max() : trades.getChunkNewestTimeStamp(0);
+	}
+
+	// Releases the oldest 'count' chunks of trades, returning the number of trades released.
+	// Any released trades within the window or a horizon are removed from its sums.
+	// The listener is not notified.
+	//
+	std::size_t evictOldestChunks(std::size_t count);
+
+	// Starts rolling trades up into bars of the given resolution, keeping at most maxBars
+	// bars (zero for no limit). Bars are built for the trades already held, then updated
+	// as each trade is added, and are kept when the trades themselves are released.
+	// Throws an InvalidOperation if bars of that resolution are already kept, and an
+	// invalid_argument if the resolution is not positive.
+	//
+	void addBarSeries(std::chrono::seconds resolution, std::size_t maxBars = 0);
+
+	// Returns the bars kept at the given resolution.
+	// Throws an invalid_argument if bars of that resolution are not kept.
+	//
+	const BarSeries& accessBarSeries(std::chrono::seconds resolution)const;
+
+	// Summarizes the trades in [startTimeStamp, endTimeStamp) from the bars: the bars of the
+	// coarsest resolution that fit whole within the period cover as much of it as they can,
+	// the finer resolutions cover what is left at either end in the same way, and the trades
+	// themselves cover whatever is left after the finest, so that the summary is exact
+	// however the period is aligned. Trades released by retention are missing from the
+	// parts of the period covered by trades rather than bars.
+	// Returns false if there are no trades in the period.
+	// Throws an InvalidOperation if no bars are kept.
+	//
+	bool summarizeBars(TimeStamp startTimeStamp, TimeStamp endTimeStamp, Bar& summary)const;
+
+	// Returns the values most recently published by the thread adding trades: the windowed
+	// Volume Weighted Stock Price, last price and trade count. Unlike every other method,
+	// this may be called from any number of threads while another thread adds trades,
+	// and never blocks that thread. Values are published after every change to the trades
+	// or window, so the windowed price is as of the last change rather than the present.
+	//
+	TradeSnapshot getSnapshot()const
+	{
+		return snapshot.load();
+	}
+
+	// Registers a listener to be told whenever trades are added to this record, passing
+	// back the given key. Only one listener is held; nullptr removes it.
+	//
+	void setListener(TradeRecordListener* listenerIn, std::size_t keyIn)
+	{
+		listener = listenerIn;
+		listenerKey = keyIn;
+	}
+
+	// Adds a Trade to the TradeRecord, using the present moment of its clock as its timeStamp
 	// This operation may improve insertion performance by assuming the trade is the newest trade.
 	//   As with Trade::Trade:
 	//			quantity must be 1 or greater or an invalid_argument will be thrown.
-	//			price must be 0.0 or greater or an invalid_argument will be thrown.
+	//			price must be finite and 0.0 or greater or an invalid_argument will be thrown.
+	// See TradeStore::roundToTick for the limit on trades with a tick size.
 	//
 	void addTrade(int quantity, BuyOrSellType buyOrSellType, double price);
 
 	// Adds a Trade to the TradeRecord, using the given time as its timeStamp
 	//   As with Trade::Trade:
 	//			quantity must be 1 or greater or an invalid_argument will be thrown.
-	//			price must be 0.0 or greater or an invalid_argument will be thrown.
+	//			price must be finite and 0.0 or greater or an invalid_argument will be thrown.
+	// See TradeStore::roundToTick for the limit on trades with a tick size.
 	//
 	void addTrade(int quantity, BuyOrSellType buyOrSellType, double price, TimeStamp timeStamp);
 
 	// Adds an existing Trade to the TradeRecord.
+	// See TradeStore::roundToTick for the limit on trades with a tick size.
+	//
+	void addTrade(const Trade tradeIn);
+
+	// Adds 'count' existing Trades to the TradeRecord in one pass. The trades need not be
+	// in time order; if they are not, they are sorted in a single working buffer first.
+	// The listener, if any, is notified once for the whole batch.
+	// With a tick size, every trade is rounded and checked before any is added;
+	// see TradeStore::roundToTick.
+	//
+	void addTrades(const Trade* tradesIn, std::size_t count);
+
+	// Adds 'count' trades given as separate columns, as held in a snapshot, copying each
+	// column a chunk at a time without building individual Trades. timeStamps holds
+	// each trade's time since the epoch in ticks of the system clock.
+	// Every trade is checked first, and none are added if any fails: an invalid_argument
+	// is thrown unless the trades start at or after the newest trade held and are in time
+	// order, and each has a quantity of 1 or more, a finite price of 0.0 or more, a type of
+	// BUY_TYPE or SELL_TYPE and, with a tick size, a price in whole ticks within the limit
+	// of TradeStore::roundToTick.
 	//
-	void addTrade(const Trade trade);
+	void restoreTrades(const std::int64_t* timeStamps,
+		const double* prices,
+		const unsigned int* quantities,
+		const unsigned char* buyOrSellTypes,
+		std::size_t count);
 
 	// Returns the Volume Weighted Stock Price based on the last five minutes of trades
 	// Out parameter foundTrades will be true if there were trades within that time.
 	//		If not, foundTrades will be false, and the return value 0.0
+	// This is constant time while the TradeRecord's window is five minutes (the default).
 	//
 	double calculateVolumeWeightedStockPriceWithinFiveMinutes(bool&foundTrades)const;
 
 	// Returns the Volume Weighted Stock Price based on the last "min" minutes.
 	// Out parameter foundTrades will be true if there were trades within that time.
 	//		If not, foundTrades will be false, and the return value 0.0
+	// If "min" matches the TradeRecord's window or one of its horizons then the maintained
+	// sums are used, costing amortized constant time; otherwise the running totals of
+	// the trades within "min" are used, costing two binary searches.
 	//
 	double calculateVolumeWeightedStockPriceWithin(bool&foundTrades, const std::chrono::minutes min)const;
 
+	// Returns the time after which the oldest trade within the last "min" minutes will have
+	// left them, changing the Volume Weighted Stock Price within "min", or TimeStamp::max()
+	// if there are no trades within "min". Costs one binary search.
+	//
+	TimeStamp getExpiryTimeWithin(const std::chrono::minutes min)const;
+
+	// Returns the buy and sell order flow over the last "min" minutes: the Volume Weighted
+	// price and total quantity of each side, from which its imbalance follows.
+	// If "min" matches the TradeRecord's window or one of its horizons then the maintained
+	// sums are used, which every trade is added to as it arrives, costing amortized
+	// constant time; otherwise the trades within "min" are scanned.
+	//
+	OrderFlow calculateOrderFlowWithin(const std::chrono::minutes min)const;
+
 	// Returns the Volume Weighted Stock Price from the given time startTimeStamp until the present.
 	// Out parameter foundTrades will be true if there were trades within that time.
 	//		If not, foundTrades will be false, and the return value 0.0
 	//
 	double calculateVolumeWeightedStockPriceSince(bool&foundTrades, const TimeStamp startTimeStamp)const;
 
+	// Returns the Volume Weighted Stock Price over trades from startTimeStamp to endTimeStamp inclusive.
+	// This uses running totals held by the trade store, so costs two binary searches rather
+	// than a walk over the trades in the range.
+	// Out parameter foundTrades will be true if there were trades within that time.
+	//		If not, foundTrades will be false, and the return value 0.0
+	// Throws an InvalidTimeError if endTimeStamp is before startTimeStamp.
+	//
+	double calculateVolumeWeightedStockPriceBetween(bool&foundTrades,
+		const TimeStamp startTimeStamp,
+		const TimeStamp endTimeStamp)const;
+
 	// Outputs the Trade Record to the given output stream as a text formatted table.
 	// "title" will be used at the start of the table.
 	// Note that this table could presumably be quite large, hence a distinct method
@@ -0,0 +1,598 @@
+#include"stdafx.h"
+#include"TradeStore.h"
+#include"Exceptions.h"
+#include"Metrics.h"
+#include<algorithm>
+#include<cassert>
+#include<cmath>
+#include<cstring>
+#include<new>
+#include<stdexcept>
+
+// Build an empty TradeStore taking its chunks from allocatorIn, which must outlive it
+//
+TradeStore::TradeStore(Allocator& allocatorIn) :
+	allocator(allocatorIn),
+	tradeCount(0),
+	chunkBytes(0),
+	tickSize(0.0),
+	firstStaleChunk(0)
+{
+	// done //
+}
+
+// Sets the smallest step prices move in, so that prices are held as whole numbers of
+// ticks and sums of price*quantity are exact; zero returns to floating point prices.
+// Throws an InvalidOperation if the store holds trades, and an invalid_argument if
+// tickSizeIn is negative or not finite.
+//
+void TradeStore::setTickSize(double tickSizeIn)
+{
+	if (!(tickSizeIn >= 0.0) || std::isinf(tickSizeIn))
+	{
+		throw std::invalid_argument("TradeStore::setTickSize:\ttick size must be zero or positive.");
+	}
+	if (!chunks.empty())
+	{
+		throw InvalidOperation("TradeStore::setTickSize:\tstore already holds trades.");
+	}
+	tickSize = tickSizeIn;
+}
+
+// Returns the trade as it would be held by this store: with its price rounded to
+// the nearest tick if the store has a tick size, otherwise unchanged. Trades given
+// to a store with a tick size must have been rounded by it first.
+// Throws an invalid_argument if the price is not finite, or if the price in ticks
+// times the quantity is not less than MAX_TICKS_TIMES_QUANTITY.
+//
+Trade TradeStore::roundToTick(const Trade& trade)const
+{
+	if (0.0 == tickSize)
+	{
+		return trade;
+	}
+	if (!std::isfinite(trade.getPrice()))
+	{
+		throw std::invalid_argument("TradeStore::roundToTick:\tprice must be finite.");
+	}
+	const double ticks = std::round(trade.getPrice() / tickSize);
+	if (ticks * trade.getQuantity() >= static_cast<double>(MAX_TICKS_TIMES_QUANTITY))
+	{
+		throw std::invalid_argument("TradeStore::roundToTick:\tprice in ticks times quantity is too large to sum exactly.");
+	}
+	return Trade(trade.getQuantity(), trade.getBuyOrSellType(), ticks * tickSize, trade.getTimeStamp());
+}
+
+// Internal utility; returns a new empty chunk of the given capacity from the allocator
+//
+TradeStore::ChunkPointer TradeStore::newChunk(std::size_t capacity)
+{
+	static_assert(0 == sizeof(Chunk) % alignof(std::uint64_t), "TradeStore::newChunk:\tcolumns must follow the Chunk aligned.");
+	// the eight byte columns first, so that every column is aligned
+	const std::size_t buyColumns = (tickSize > 0.0) ? 2 : 0;
+	const std::size_t bytes = sizeof(Chunk)
+		+ capacity * (sizeof(TimeStamp) + sizeof(double) + (2 + buyColumns) * sizeof(std::uint64_t) + sizeof(unsigned int) + sizeof(unsigned char));
+	char* memory = static_cast<char*>(allocator.allocate(bytes, alignof(Chunk)));
+	ChunkDeleter deleter;
+	deleter.allocator = &allocator;
+	ChunkPointer chunk(new (memory) Chunk, deleter);
+	chunk->count = 0;
+	chunk->capacity = capacity;
+	chunk->bytes = bytes;
+	char* column = memory + sizeof(Chunk);
+	chunk->timeStamps = reinterpret_cast<TimeStamp*>(column);
+	column += capacity * sizeof(TimeStamp);
+	chunk->prices = reinterpret_cast<double*>(column);
+	column += capacity * sizeof(double);
+	chunk->cumulativeQuantities = reinterpret_cast<std::uint64_t*>(column);
+	column += capacity * sizeof(std::uint64_t);
+	chunk->cumulativePricesAndQuantities = reinterpret_cast<double*>(column);
+	chunk->cumulativeTicksAndQuantities = reinterpret_cast<std::uint64_t*>(column);
+	column += capacity * sizeof(std::uint64_t);
+	chunk->cumulativeBuyQuantities = nullptr;
+	chunk->cumulativeBuyTicksAndQuantities = nullptr;
+	if (buyColumns > 0)
+	{
+		chunk->cumulativeBuyQuantities = reinterpret_cast<std::uint64_t*>(column);
+		column += capacity * sizeof(std::uint64_t);
+		chunk->cumulativeBuyTicksAndQuantities = reinterpret_cast<std::uint64_t*>(column);
+		column += capacity * sizeof(std::uint64_t);
+	}
+	chunk->quantities = reinterpret_cast<unsigned int*>(column);
+	column += capacity * sizeof(unsigned int);
+	chunk->buyOrSellTypes = reinterpret_cast<unsigned char*>(column);
+	chunkBytes += bytes;
+	SUPERSIMPLESTOCKS_METRICS_COUNT(TRADE_BYTES_HELD, bytes);
+	return chunk;
+}
+
+// Destroys a chunk and returns its memory to the allocator it came from
+//
+void TradeStore::ChunkDeleter::operator()(Chunk* chunk)const
+{
+	const std::size_t bytes = chunk->bytes;
+	chunk->~Chunk();
+	allocator->deallocate(chunk, bytes, alignof(Chunk));
+	SUPERSIMPLESTOCKS_METRICS_COUNT(TRADE_BYTES_HELD, -static_cast<std::int64_t>(bytes));
+}
+
+// Internal utility; releases the chunks from 'first' onwards
+//
+void TradeStore::eraseChunksFrom(std::size_t first)
+{
+	for (std::size_t t = first; t < chunks.size(); ++t)
+	{
+		chunkBytes -= chunks[t]->bytes;
+	}
+	chunks.resize(first);
+}
+
+// Internal utility; returns the index of the chunk a trade at timeStamp belongs in,
+// placing it after any trades with an equal timeStamp. The store must not be empty.
+//
+std::size_t TradeStore::findChunkFor(TimeStamp timeStamp)const
+{
+	assert(!chunks.empty());
+	// first chunk starting after timeStamp; the trade belongs in the chunk before it
+	auto itr = std::upper_bound(chunks.cbegin(), chunks.cend(), timeStamp,
+		[](TimeStamp value, const ChunkPointer& chunk)
+	{
+		return value < chunk->timeStamps[0];
+	});
+	if (itr == chunks.cbegin())
+	{
+		return 0;
+	}
+	return (itr - chunks.cbegin()) - 1;
+}
+
+// Internal utility; writes the trade to position 'offset' of the chunk, shifting
+// later entries along. The chunk must not be full.
+//
+void TradeStore::insertInto(Chunk& chunk, std::size_t offset, const Trade& trade)
+{
+	assert(chunk.count < chunk.capacity);
+	assert(offset <= chunk.count);
+	const std::size_t moving = chunk.count - offset;
+	std::memmove(&chunk.timeStamps[offset + 1], &chunk.timeStamps[offset], moving * sizeof(TimeStamp));
+	std::memmove(&chunk.prices[offset + 1], &chunk.prices[offset], moving * sizeof(double));
+	std::memmove(&chunk.quantities[offset + 1], &chunk.quantities[offset], moving * sizeof(unsigned int));
+	std::memmove(&chunk.buyOrSellTypes[offset + 1], &chunk.buyOrSellTypes[offset], moving * sizeof(unsigned char));
+
+	chunk.timeStamps[offset] = trade.getTimeStamp();
+	chunk.prices[offset] = trade.getPrice();
+	chunk.quantities[offset] = trade.getQuantity();
+	chunk.buyOrSellTypes[offset] = static_cast<unsigned char>(trade.getBuyOrSellType());
+	++chunk.count;
+}
+
+// Internal utility; moves the upper half of a full chunk into a new chunk placed after it.
+//
+void TradeStore::splitChunk(std::size_t chunkIndex)
+{
+	Chunk& lower = *chunks[chunkIndex];
+	ChunkPointer upper = newChunk(lower.capacity);
+
+	const std::size_t kept = lower.count / 2;
+	const std::size_t moving = lower.count - kept;
+	std::memcpy(upper->timeStamps, &lower.timeStamps[kept], moving * sizeof(TimeStamp));
+	std::memcpy(upper->prices, &lower.prices[kept], moving * sizeof(double));
+	std::memcpy(upper->quantities, &lower.quantities[kept], moving * sizeof(unsigned int));
+	std::memcpy(upper->buyOrSellTypes, &lower.buyOrSellTypes[kept], moving * sizeof(unsigned char));
+	upper->count = moving;
+	lower.count = kept;
+	accumulateFrom(*upper, 0);
+
+	chunks.insert(chunks.begin() + chunkIndex + 1, std::move(upper));
+	invalidateBasesAfter(chunkIndex);
+}
+
+// Internal utility; recomputes the chunk's running totals from entry 'offset' onwards.
+//
+void TradeStore::accumulateFrom(Chunk& chunk, std::size_t offset)const
+{
+	std::uint64_t quantitySum = (0 == offset) ? 0 : chunk.cumulativeQuantities[offset - 1];
+	for (std::size_t t = offset; t < chunk.count; ++t)
+	{
+		quantitySum += chunk.quantities[t];
+		chunk.cumulativeQuantities[t] = quantitySum;
+	}
+
+	if (tickSize > 0.0)
+	{
+		// each trade is below MAX_TICKS_TIMES_QUANTITY, so a whole chunk fits in 64 bits
+		std::uint64_t sumOfTicksAndQuantity = (0 == offset) ? 0 : chunk.cumulativeTicksAndQuantities[offset - 1];
+		std::uint64_t buyQuantitySum = (0 == offset) ? 0 : chunk.cumulativeBuyQuantities[offset - 1];
+		std::uint64_t buySumOfTicksAndQuantity = (0 == offset) ? 0 : chunk.cumulativeBuyTicksAndQuantities[offset - 1];
+		for (std::size_t t = offset; t < chunk.count; ++t)
+		{
+			const std::uint64_t ticksAndQuantity = toTicks(chunk.prices[t], tickSize) * chunk.quantities[t];
+			sumOfTicksAndQuantity += ticksAndQuantity;
+			chunk.cumulativeTicksAndQuantities[t] = sumOfTicksAndQuantity;
+			if (BUY_TYPE == chunk.buyOrSellTypes[t])
+			{
+				buyQuantitySum += chunk.quantities[t];
+				buySumOfTicksAndQuantity += ticksAndQuantity;
+			}
+			chunk.cumulativeBuyQuantities[t] = buyQuantitySum;
+			chunk.cumulativeBuyTicksAndQuantities[t] = buySumOfTicksAndQuantity;
+		}
+	}
+	else
+	{
+		double sumOfPriceAndQuantity = (0 == offset) ? 0.0 : chunk.cumulativePricesAndQuantities[offset - 1];
+		for (std::size_t t = offset; t < chunk.count; ++t)
+		{
+			sumOfPriceAndQuantity += chunk.prices[t] * chunk.quantities[t];
+			chunk.cumulativePricesAndQuantities[t] = sumOfPriceAndQuantity;
+		}
+	}
+}
+
+// Adds the entries [begin, end) of a chunk of this store to the buys or sells of
+// 'sums' by their side. With a tick size this takes constant time from the chunk's
+// running totals, exactly; otherwise the entries are added one by one, so that the
+// floating point sums carry no rounding from trades outside the range.
+//
+void TradeStore::accumulateRun(const Chunk& chunk, std::size_t begin, std::size_t end, FlowSums& sums)const
+{
+	if (begin >= end)
+	{
+		return;
+	}
+	if (tickSize > 0.0)
+	{
+		auto runOf = [begin, end](const std::uint64_t* cumulative)
+		{
+			return cumulative[end - 1] - ((0 == begin) ? 0 : cumulative[begin - 1]);
+		};
+		const std::uint64_t buyQuantity = runOf(chunk.cumulativeBuyQuantities);
+		const std::uint64_t buyTicksAndQuantity = runOf(chunk.cumulativeBuyTicksAndQuantities);
+		sums.buys.quantity += buyQuantity;
+		sums.buys.ticksAndQuantity += TickSum(buyTicksAndQuantity);
+		sums.sells.quantity += runOf(chunk.cumulativeQuantities) - buyQuantity;
+		sums.sells.ticksAndQuantity += TickSum(runOf(chunk.cumulativeTicksAndQuantities) - buyTicksAndQuantity);
+		return;
+	}
+	for (std::size_t t = begin; t < end; ++t)
+	{
+		TradeSums& side = (BUY_TYPE == chunk.buyOrSellTypes[t]) ? sums.buys : sums.sells;
+		side.quantity += chunk.quantities[t];
+		side.priceAndQuantity += chunk.prices[t] * chunk.quantities[t];
+	}
+}
+
+// Internal utility; brings every chunk's base sums up to date.
+//
+void TradeStore::refreshBases()const
+{
+	for (std::size_t t = firstStaleChunk; t < chunks.size(); ++t)
+	{
+		Chunk& chunk = *chunks[t];
+		if (0 == t)
+		{
+			chunk.base = TradeSums();
+		}
+		else
+		{
+			const Chunk& previous = *chunks[t - 1];
+			chunk.base = previous.base;
+			addChunkTotals(previous, previous.count, chunk.base);
+		}
+	}
+	firstStaleChunk = chunks.size();
+}
+
+// Internal utility; adds the running totals of the chunk's first 'count' entries to 'sums'.
+//
+void TradeStore::addChunkTotals(const Chunk& chunk, std::size_t count, TradeSums& sums)const
+{
+	if (0 == count)
+	{
+		return;
+	}
+	sums.quantity += chunk.cumulativeQuantities[count - 1];
+	if (tickSize > 0.0)
+	{
+		sums.ticksAndQuantity += TickSum(chunk.cumulativeTicksAndQuantities[count - 1]);
+	}
+	else
+	{
+		sums.priceAndQuantity += chunk.cumulativePricesAndQuantities[count - 1];
+	}
+}
+
+// Sets 'sums' to the sums over the trades in [first, last).
+// Running totals restart at each chunk, so the ends of the range are each found as a
+// difference within one chunk, or added trade by trade if they hold no more than
+// DIRECT_SUM_TRADES trades, and the chunks between them are added whole. Up to
+// DIRECT_SUM_CHUNKS chunks between them are added one by one, so that floating point
+// sums over short ranges carry rounding only from the chunks they touch; longer ranges
+// take the difference of the chunks' base sums, refreshing them first if trades have
+// been inserted out of order, and their rounding is small beside the range's own sum.
+// Sums in ticks are exact.
+//
+void TradeStore::sumRange(const_iterator first, const_iterator last, TradeSums& sums)const
+{
+	sums = TradeSums();
+	if (first == last)
+	{
+		return;
+	}
+	if (last.chunk == chunks.size())
+	{
+		last = const_iterator(this, chunks.size() - 1, chunks.back()->count);
+	}
+
+	if (first.chunk == last.chunk)
+	{
+		addChunkRange(*chunks[first.chunk], first.offset, last.offset, sums);
+		return;
+	}
+
+	const Chunk& firstChunk = *chunks[first.chunk];
+	addChunkRange(firstChunk, first.offset, firstChunk.count, sums);
+	if (last.chunk - first.chunk - 1 <= DIRECT_SUM_CHUNKS)
+	{
+		for (std::size_t t = first.chunk + 1; t < last.chunk; ++t)
+		{
+			addChunkTotals(*chunks[t], chunks[t]->count, sums);
+		}
+	}
+	else
+	{
+		if (firstStaleChunk < chunks.size())
+		{
+			refreshBases();
+		}
+		TradeSums between = chunks[last.chunk]->base;
+		between -= chunks[first.chunk + 1]->base;
+		sums += between;
+	}
+	addChunkTotals(*chunks[last.chunk], last.offset, sums);
+}
+
+// Internal utility; adds the sums over the chunk's entries [begin, end) to 'sums', as a
+// difference of the chunk's own running totals, or without a tick size and for no more
+// than DIRECT_SUM_TRADES entries, by adding up the entries themselves.
+//
+void TradeStore::addChunkRange(const Chunk& chunk, std::size_t begin, std::size_t end, TradeSums& sums)const
+{
+	if (tickSize <= 0.0 && end - begin <= DIRECT_SUM_TRADES)
+	{
+		for (std::size_t t = begin; t < end; ++t)
+		{
+			sums.quantity += chunk.quantities[t];
+			sums.priceAndQuantity += chunk.prices[t] * chunk.quantities[t];
+		}
+		return;
+	}
+
+	TradeSums range;
+	addChunkTotals(chunk, end, range);
+	TradeSums before;
+	addChunkTotals(chunk, begin, before);
+	range -= before;
+	sums += range;
+}
+
+// Internal utility; appends a trade at or after the newest trade
+//
+void TradeStore::append(const Trade& trade)
+{
+	assert(empty() || trade.getTimeStamp() >= getNewestTimeStamp());
+	if (chunks.empty() || chunks.back()->capacity == chunks.back()->count)
+	{
+		chunks.push_back(newChunk(getNextChunkCapacity()));
+	}
+	Chunk& last = *chunks.back();
+	insertInto(last, last.count, trade);
+	accumulateFrom(last, last.count - 1);
+	++tradeCount;
+}
+
+// Internal utility; removes every trade from the given position onwards
+//
+void TradeStore::truncate(const_iterator position)
+{
+	std::size_t keptChunks = position.chunk;
+	if (position.chunk < chunks.size())
+	{
+		Chunk& chunk = *chunks[position.chunk];
+		tradeCount -= chunk.count - position.offset;
+		chunk.count = position.offset;
+		if (position.offset > 0)
+		{
+			++keptChunks;
+		}
+	}
+	for (std::size_t t = position.chunk + 1; t < chunks.size(); ++t)
+	{
+		tradeCount -= chunks[t]->count;
+	}
+	eraseChunksFrom(keptChunks);
+	if (firstStaleChunk > chunks.size())
+	{
+		firstStaleChunk = chunks.size();
+	}
+}
+
+// Adds a trade in time order, after any existing trades with the same time stamp.
+// Trades at or after the newest trade are appended in constant time.
+//
+void TradeStore::insert(const Trade& trade)
+{
+	const TimeStamp timeStamp = trade.getTimeStamp();
+
+	if (empty() || timeStamp >= getNewestTimeStamp())
+	{
+		append(trade);
+		return;
+	}
+
+	std::size_t chunkIndex = findChunkFor(timeStamp);
+	if (chunks[chunkIndex]->capacity == chunks[chunkIndex]->count)
+	{
+		splitChunk(chunkIndex);
+		if (timeStamp >= chunks[chunkIndex + 1]->timeStamps[0])
+		{
+			++chunkIndex;
+		}
+	}
+
+	Chunk& chunk = *chunks[chunkIndex];
+	const TimeStamp* position = std::upper_bound(chunk.timeStamps, chunk.timeStamps + chunk.count, timeStamp);
+	const std::size_t offset = position - chunk.timeStamps;
+	insertInto(chunk, offset, trade);
+	accumulateFrom(chunk, offset);
+	invalidateBasesAfter(chunkIndex);
+	++tradeCount;
+}
+
+// Returns an iterator to the first trade at or after timeStamp
+//
+TradeStore::const_iterator TradeStore::lowerBound(TimeStamp timeStamp)const
+{
+	// first chunk whose newest trade is at or after timeStamp
+	auto itr = std::lower_bound(chunks.cbegin(), chunks.cend(), timeStamp,
+		[](const ChunkPointer& chunk, TimeStamp value)
+	{
+		return chunk->timeStamps[chunk->count - 1] < value;
+	});
+	if (itr == chunks.cend())
+	{
+		return end();
+	}
+
+	const Chunk& chunk = **itr;
+	const TimeStamp* position = std::lower_bound(chunk.timeStamps, chunk.timeStamps + chunk.count, timeStamp);
+	return const_iterator(this, itr - chunks.cbegin(), position - chunk.timeStamps);
+}
+
+// Returns an iterator to the first trade after timeStamp
+//
+TradeStore::const_iterator TradeStore::upperBound(TimeStamp timeStamp)const
+{
+	// first chunk whose newest trade is after timeStamp
+	auto itr = std::upper_bound(chunks.cbegin(), chunks.cend(), timeStamp,
+		[](TimeStamp value, const ChunkPointer& chunk)
+	{
+		return value < chunk->timeStamps[chunk->count - 1];
+	});
+	if (itr == chunks.cend())
+	{
+		return end();
+	}
+
+	const Chunk& chunk = **itr;
+	const TimeStamp* position = std::upper_bound(chunk.timeStamps, chunk.timeStamps + chunk.count, timeStamp);
+	return const_iterator(this, itr - chunks.cbegin(), position - chunk.timeStamps);
+}
+
+// Adds 'count' trades, which must already be sorted by time stamp, in a single merge.
+// Trades overlapping existing ones are merged by moving the later existing trades
+// aside once and appending both sequences, unless that would move many more trades
+// than are being added, in which case each is inserted individually.
+//
+void TradeStore::insertSorted(const Trade* sortedTrades, std::size_t count)
+{
+	std::size_t t = 0;
+	while (t < count && (empty() || sortedTrades[t].getTimeStamp() >= getNewestTimeStamp()))
+	{
+		append(sortedTrades[t++]);
+	}
+	if (t == count)
+	{
+		return;
+	}
+
+	const const_iterator position = upperBound(sortedTrades[t].getTimeStamp());
+	std::size_t movingTrades = 0;
+	for (std::size_t chunkIndex = position.chunk; chunkIndex < chunks.size(); ++chunkIndex)
+	{
+		movingTrades += chunks[chunkIndex]->count;
+	}
+	movingTrades -= position.offset;
+	if (movingTrades > 8 * (count - t))
+	{
+		for (; t < count; ++t)
+		{
+			insert(sortedTrades[t]);
+		}
+		return;
+	}
+
+	std::vector<Trade> moved;
+	moved.reserve(movingTrades);
+	for (auto itr = position; itr != end(); ++itr)
+	{
+		moved.push_back(*itr);
+	}
+	truncate(position);
+
+	// existing trades go before new trades with the same time stamp
+	auto movedItr = moved.cbegin();
+	while (movedItr != moved.cend() || t < count)
+	{
+		if (t == count || (movedItr != moved.cend() && movedItr->getTimeStamp() <= sortedTrades[t].getTimeStamp()))
+		{
+			append(*movedItr++);
+		}
+		else
+		{
+			append(sortedTrades[t++]);
+		}
+	}
+}
+
+// Appends 'count' trades given as separate columns, copying them a chunk at a time.
+// timeStamps holds each trade's time since the epoch in ticks of the system clock.
+// The trades must be sorted by time stamp and start at or after the newest trade.
+//
+void TradeStore::appendColumns(const std::int64_t* timeStamps,
+	const double* prices,
+	const unsigned int* quantities,
+	const unsigned char* buyOrSellTypes,
+	std::size_t count)
+{
+	static_assert(sizeof(TimeStamp) == sizeof(std::int64_t), "TradeStore::appendColumns:\tTimeStamp must be 64 bits.");
+	std::size_t copied = 0;
+	while (copied < count)
+	{
+		if (chunks.empty() || chunks.back()->capacity == chunks.back()->count)
+		{
+			chunks.push_back(newChunk(getNextChunkCapacity()));
+		}
+		Chunk& last = *chunks.back();
+		const std::size_t offset = last.count;
+		const std::size_t copying = std::min(last.capacity - offset, count - copied);
+		std::memcpy(static_cast<void*>(&last.timeStamps[offset]), timeStamps + copied, copying * sizeof(TimeStamp));
+		std::memcpy(&last.prices[offset], prices + copied, copying * sizeof(double));
+		std::memcpy(&last.quantities[offset], quantities + copied, copying * sizeof(unsigned int));
+		std::memcpy(&last.buyOrSellTypes[offset], buyOrSellTypes + copied, copying * sizeof(unsigned char));
+		last.count += copying;
+		accumulateFrom(last, offset);
+		copied += copying;
+	}
+	tradeCount += count;
+}
+
+// Releases the oldest 'count' chunks and the trades within them, returning the
+// number of trades removed.
+//
+std::size_t TradeStore::eraseFirstChunks(std::size_t count)
+{
+	assert(count <= chunks.size());
+	std::size_t removed = 0;
+	for (std::size_t t = 0; t < count; ++t)
+	{
+		removed += chunks[t]->count;
+		chunkBytes -= chunks[t]->bytes;
+	}
+	// later chunks' base sums now include trades no longer held, which is harmless
+	// as ranges are always found as the difference between two positions
+	chunks.erase(chunks.begin(), chunks.begin() + count);
+	firstStaleChunk = (firstStaleChunk > count) ? firstStaleChunk - count : 0;
+	tradeCount -= removed;
+	return removed;
+}
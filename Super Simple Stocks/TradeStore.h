@@ -0,0 +1,458 @@
+/*
+* TradeStore.h
+*
+* A TradeStore holds the trades of a single stock in time order, laid out as
+* contiguous columns (time stamps, prices, quantities and buy/sell types) split
+* into chunks. A store's first chunk is small, and each chunk appended after it is
+* twice the size of the one before up to CHUNK_CAPACITY trades, so that a stock with
+* few trades holds little memory while a busy one is held in large chunks.
+*	Appending the newest trade is the common case and is a plain write to the end
+*	of the last chunk. Trades arriving out of order are inserted into the chunk
+*	covering their time, splitting that chunk if it is full.
+*	Scanning a range of trades walks each chunk's columns sequentially rather than
+*	chasing tree nodes.
+*	Each chunk also keeps running totals of quantity and price*quantity, so that the
+*	sums over any range of trades can be found from two positions without a scan.
+*	Old trades are released a whole chunk at a time from the front of the store.
+*	Chunks are taken from, and returned to, the Allocator the store is built with.
+*	A store may be given a tick size, in which case its prices are whole numbers of
+*	ticks and its running totals of price*quantity are exact integers (see TradeSums.h).
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_TRADE_STORE
+#define SUPERSIMPLESTOCKS_TRADE_STORE
+#include"Allocator.h"
+#include"Trade.h"
+#include"TradeSums.h"
+#include<cstddef>
+#include<cstdint>
+#include<memory>
+#include<vector>
+
+class TradeStore
+{
+public:
+
+	// Number of trades held by the largest chunks
+	//
+	static const std::size_t CHUNK_CAPACITY = 1024;
+
+	// Number of trades held by a store's first chunk
+	//
+	static const std::size_t FIRST_CHUNK_CAPACITY = 16;
+
+	// Number of whole chunks within a range that sumRange adds one by one, rather than
+	// taking the difference of their base sums
+	//
+	static const std::size_t DIRECT_SUM_CHUNKS = 16;
+
+	// Number of entries of a chunk up to which sumRange adds floating point sums trade by
+	// trade, rather than taking the difference of the chunk's running totals
+	//
+	static const std::size_t DIRECT_SUM_TRADES = 64;
+
+	// A block of up to 'capacity' trades in time order, stored column-wise. The columns
+	// follow the Chunk in the same allocation of 'bytes' bytes.
+	// Only the first 'count' entries of each column are valid.
+	// cumulativeQuantities[i] and cumulativePricesAndQuantities[i] hold the sums over
+	// entries 0 to i of this chunk; 'base' holds the sums over all earlier chunks.
+	// In a store with a tick size, cumulativeTicksAndQuantities is used in place of
+	// cumulativePricesAndQuantities, sharing its column, and holds sums of price in
+	// ticks times quantity; cumulativeBuyQuantities and cumulativeBuyTicksAndQuantities
+	// hold the same sums over buys alone, so that the sums of either side over a run
+	// of entries are a subtraction away. Without a tick size they are null.
+	//
+	struct Chunk
+	{
+		std::size_t count;
+		std::size_t capacity;
+		std::size_t bytes;
+		TradeSums base;
+		TimeStamp* timeStamps;
+		double* prices;
+		unsigned int* quantities;
+		unsigned char* buyOrSellTypes;
+		std::uint64_t* cumulativeQuantities;
+		double* cumulativePricesAndQuantities;
+		std::uint64_t* cumulativeTicksAndQuantities;
+		std::uint64_t* cumulativeBuyQuantities;
+		std::uint64_t* cumulativeBuyTicksAndQuantities;
+	};
+
+	// Forward iterator over the trades in time order. Iterators are invalidated by any
+	// insertion into the store.
+	//
+	class const_iterator
+	{
+		friend class TradeStore;
+
+		const TradeStore* store;
+		std::size_t chunk;
+		std::size_t offset;
+
+		const_iterator(const TradeStore* storeIn, std::size_t chunkIn, std::size_t offsetIn) :
+			store(storeIn),
+			chunk(chunkIn),
+			offset(offsetIn)
+		{
+			// done //
+		}
+
+		const Chunk& accessChunk()const
+		{
+			return *store->chunks[chunk];
+		}
+
+	public:
+
+		TimeStamp getTimeStamp()const
+		{
+			return accessChunk().timeStamps[offset];
+		}
+
+		double getPrice()const
+		{
+			return accessChunk().prices[offset];
+		}
+
+		unsigned int getQuantity()const
+		{
+			return accessChunk().quantities[offset];
+		}
+
+		BuyOrSellType getBuyOrSellType()const
+		{
+			return static_cast<BuyOrSellType>(accessChunk().buyOrSellTypes[offset]);
+		}
+
+		// Returns a copy of the trade at this position
+		//
+		Trade operator*()const
+		{
+			return Trade(getQuantity(), getBuyOrSellType(), getPrice(), getTimeStamp());
+		}
+
+		const_iterator& operator++()
+		{
+			if (++offset == accessChunk().count)
+			{
+				++chunk;
+				offset = 0;
+			}
+			return *this;
+		}
+
+		bool operator==(const const_iterator& other)const
+		{
+			return chunk == other.chunk && offset == other.offset;
+		}
+
+		bool operator!=(const const_iterator& other)const
+		{
+			return !(*this == other);
+		}
+	};
+
+private:
+
+	// Destroys a chunk and returns its memory to the allocator it came from
+	//
+	struct ChunkDeleter
+	{
+		Allocator* allocator;
+
+		void operator()(Chunk* chunk)const;
+	};
+
+	typedef std::unique_ptr<Chunk, ChunkDeleter> ChunkPointer;
+
+	Allocator& allocator;
+	std::vector<ChunkPointer> chunks;
+	std::size_t tradeCount;
+
+	// Sum of the bytes of every chunk held
+	//
+	std::size_t chunkBytes;
+
+	// The smallest step prices move in, or zero if prices are not held in ticks
+	//
+	double tickSize;
+
+	// Chunks from this index onwards have out of date base sums, following an
+	// insertion into an earlier chunk. They are brought up to date on the next query.
+	//
+	mutable std::size_t firstStaleChunk;
+
+	TradeStore(const TradeStore&) = delete;
+	TradeStore& operator=(const TradeStore&) = delete;
+
+	// Internal utility; returns a new empty chunk of the given capacity from the allocator
+	//
+	ChunkPointer newChunk(std::size_t capacity);
+
+	// Internal utility; returns the capacity of the next chunk appended to the store
+	//
+	std::size_t getNextChunkCapacity()const
+	{
+		if (chunks.empty())
+		{
+			return FIRST_CHUNK_CAPACITY;
+		}
+		return (chunks.back()->capacity < CHUNK_CAPACITY / 2) ? 2 * chunks.back()->capacity : CHUNK_CAPACITY;
+	}
+
+	// Internal utility; releases the chunks from 'first' onwards
+	//
+	void eraseChunksFrom(std::size_t first);
+
+	// Internal utility; returns the index of the chunk a trade at timeStamp belongs in,
+	// placing it after any trades with an equal timeStamp. The store must not be empty.
+	//
+	std::size_t findChunkFor(TimeStamp timeStamp)const;
+
+	// Internal utility; writes the trade to position 'offset' of the chunk, shifting
+	// later entries along. The chunk must not be full.
+	//
+	static void insertInto(Chunk& chunk, std::size_t offset, const Trade& trade);
+
+	// Internal utility; moves the upper half of a full chunk into a new chunk placed after it.
+	//
+	void splitChunk(std::size_t chunkIndex);
+
+	// Internal utility; appends a trade at or after the newest trade
+	//
+	void append(const Trade& trade);
+
+	// Internal utility; removes every trade from the given position onwards
+	//
+	void truncate(const_iterator position);
+
+	// Internal utility; recomputes the chunk's running totals from entry 'offset' onwards.
+	//
+	void accumulateFrom(Chunk& chunk, std::size_t offset)const;
+
+	// Internal utility; marks the base sums of chunks after chunkIndex as out of date.
+	//
+	void invalidateBasesAfter(std::size_t chunkIndex)
+	{
+		if (chunkIndex + 1 < firstStaleChunk)
+		{
+			firstStaleChunk = chunkIndex + 1;
+		}
+	}
+
+	// Internal utility; brings every chunk's base sums up to date.
+	//
+	void refreshBases()const;
+
+	// Internal utility; adds the running totals of the chunk's first 'count' entries to 'sums'.
+	//
+	void addChunkTotals(const Chunk& chunk, std::size_t count, TradeSums& sums)const;
+
+	// Internal utility; adds the sums over the chunk's entries [begin, end) to 'sums', as a
+	// difference of the chunk's own running totals, or without a tick size and for no more
+	// than DIRECT_SUM_TRADES entries, by adding up the entries themselves.
+	//
+	void addChunkRange(const Chunk& chunk, std::size_t begin, std::size_t end, TradeSums& sums)const;
+
+public:
+
+	// Build an empty TradeStore taking its chunks from allocatorIn, which must outlive it
+	//
+	explicit TradeStore(Allocator& allocatorIn = HeapAllocator::getInstance());
+
+	// Returns the number of trades in the store
+	//
+	std::size_t size()const
+	{
+		return tradeCount;
+	}
+
+	// Returns true IFF there are no trades in the store
+	//
+	bool empty()const
+	{
+		return 0 == tradeCount;
+	}
+
+	// Sets the smallest step prices move in, so that prices are held as whole numbers of
+	// ticks and sums of price*quantity are exact; zero returns to floating point prices.
+	// Throws an InvalidOperation if the store holds trades, and an invalid_argument if
+	// tickSizeIn is negative or not finite.
+	//
+	void setTickSize(double tickSizeIn);
+
+	// Returns the smallest step prices move in, or zero if prices are not held in ticks
+	//
+	double getTickSize()const
+	{
+		return tickSize;
+	}
+
+	// Returns the trade as it would be held by this store: with its price rounded to
+	// the nearest tick if the store has a tick size, otherwise unchanged. Trades given
+	// to a store with a tick size must have been rounded by it first.
+	// Throws an invalid_argument if the price is not finite, or if the price in ticks
+	// times the quantity is not less than MAX_TICKS_TIMES_QUANTITY.
+	//
+	Trade roundToTick(const Trade& trade)const;
+
+	// Adds a trade, already rounded by roundToTick, to 'sums'
+	//
+	void accumulate(TradeSums& sums, const Trade& trade)const
+	{
+		sums.quantity += trade.getQuantity();
+		if (tickSize > 0.0)
+		{
+			sums.ticksAndQuantity += TickSum(toTicks(trade.getPrice(), tickSize) * trade.getQuantity());
+		}
+		else
+		{
+			sums.priceAndQuantity += trade.getPrice() * trade.getQuantity();
+		}
+	}
+
+	// Adds a trade, already rounded by roundToTick, to the buys or sells of 'sums' by its side
+	//
+	void accumulate(FlowSums& sums, const Trade& trade)const
+	{
+		accumulate(BUY_TYPE == trade.getBuyOrSellType() ? sums.buys : sums.sells, trade);
+	}
+
+	// Adds the entries [begin, end) of a chunk of this store to the buys or sells of
+	// 'sums' by their side. With a tick size this takes constant time from the chunk's
+	// running totals, exactly; otherwise the entries are added one by one, so that the
+	// floating point sums carry no rounding from trades outside the range.
+	//
+	void accumulateRun(const Chunk& chunk, std::size_t begin, std::size_t end, FlowSums& sums)const;
+
+	// Returns the Volume Weighted price over 'sums', or 0.0 if they hold no trades
+	//
+	double getVolumeWeightedPrice(const TradeSums& sums)const
+	{
+		return sums.getVolumeWeightedPrice(tickSize);
+	}
+
+	// Returns the number of chunks holding trades
+	//
+	std::size_t getChunkCount()const
+	{
+		return chunks.size();
+	}
+
+	// Returns the number of bytes of memory held for trades
+	//
+	std::size_t getMemoryUsage()const
+	{
+		return chunkBytes + chunks.capacity() * sizeof(ChunkPointer);
+	}
+
+	// Returns the number of bytes of memory held by the given chunk
+	//
+	std::size_t getChunkMemoryUsage(std::size_t chunkIndex)const
+	{
+		return chunks[chunkIndex]->bytes;
+	}
+
+	// Returns the time stamp of the newest trade in the given chunk
+	//
+	TimeStamp getChunkNewestTimeStamp(std::size_t chunkIndex)const
+	{
+		const Chunk& chunk = *chunks[chunkIndex];
+		return chunk.timeStamps[chunk.count - 1];
+	}
+
+	// Returns the time stamp of the newest trade. The store must not be empty.
+	//
+	TimeStamp getNewestTimeStamp()const
+	{
+		const Chunk& last = *chunks.back();
+		return last.timeStamps[last.count - 1];
+	}
+
+	// Adds a trade in time order, after any existing trades with the same time stamp.
+	// Trades at or after the newest trade are appended in constant time.
+	//
+	void insert(const Trade& trade);
+
+	// Adds 'count' trades, which must already be sorted by time stamp, in a single merge.
+	// Trades overlapping existing ones are merged by moving the later existing trades
+	// aside once and appending both sequences, unless that would move many more trades
+	// than are being added, in which case each is inserted individually.
+	//
+	void insertSorted(const Trade* sortedTrades, std::size_t count);
+
+	// Appends 'count' trades given as separate columns, copying them a chunk at a time.
+	// timeStamps holds each trade's time since the epoch in ticks of the system clock.
+	// The trades must be sorted by time stamp and start at or after the newest trade.
+	//
+	void appendColumns(const std::int64_t* timeStamps,
+		const double* prices,
+		const unsigned int* quantities,
+		const unsigned char* buyOrSellTypes,
+		std::size_t count);
+
+	const_iterator begin()const
+	{
+		return const_iterator(this, 0, 0);
+	}
+
+	const_iterator end()const
+	{
+		return const_iterator(this, chunks.size(), 0);
+	}
+
+	// Returns an iterator to the first trade of the given chunk, or end() if chunkIndex
+	// is the number of chunks
+	//
+	const_iterator beginOfChunk(std::size_t chunkIndex)const
+	{
+		return const_iterator(this, chunkIndex, 0);
+	}
+
+	// Releases the oldest 'count' chunks and the trades within them, returning the
+	// number of trades removed.
+	//
+	std::size_t eraseFirstChunks(std::size_t count);
+
+	// Returns an iterator to the first trade at or after timeStamp
+	//
+	const_iterator lowerBound(TimeStamp timeStamp)const;
+
+	// Returns an iterator to the first trade after timeStamp
+	//
+	const_iterator upperBound(TimeStamp timeStamp)const;
+
+	// Sets 'sums' to the sums over the trades in [first, last).
+	// Running totals restart at each chunk, so the ends of the range are each found as a
+	// difference within one chunk, or added trade by trade if they hold no more than
+	// DIRECT_SUM_TRADES trades, and the chunks between them are added whole. Up to
+	// DIRECT_SUM_CHUNKS chunks between them are added one by one, so that floating point
+	// sums over short ranges carry rounding only from the chunks they touch; longer ranges
+	// take the difference of the chunks' base sums, refreshing them first if trades have
+	// been inserted out of order, and their rounding is small beside the range's own sum.
+	// Sums in ticks are exact.
+	//
+	void sumRange(const_iterator first, const_iterator last, TradeSums& sums)const;
+
+	// Calls function(chunk, begin, end) for each run of contiguous entries between
+	// first and last, so that callers can loop directly over the chunk's columns.
+	//
+	template<typename Function>
+	void forEachRun(const_iterator first, const_iterator last, Function function)const
+	{
+		while (first.chunk < last.chunk)
+		{
+			const Chunk& chunk = *chunks[first.chunk];
+			function(chunk, first.offset, chunk.count);
+			++first.chunk;
+			first.offset = 0;
+		}
+		if (first.chunk < chunks.size() && first.offset < last.offset)
+		{
+			function(*chunks[first.chunk], first.offset, last.offset);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+* TradeSums.h
+*
+*	The sums a Volume Weighted price is found from: total quantity, and total price
+*	times quantity.
+*
+*	A stock may be given a tick size, the smallest step its price moves in. Its prices
+*	are then held as whole numbers of ticks, and price times quantity is summed as an
+*	exact integer in a TickSum, so sums over the same trades are identical whatever
+*	order they were added and subtracted in, on any thread and in any run.
+*	Without a tick size, price times quantity is summed in floating point as before.
+*
+*	FlowSums keeps the same sums apart for buys and sells.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_TRADE_SUMS
+#define SUPERSIMPLESTOCKS_TRADE_SUMS
+#include<cmath>
+#include<cstdint>
+
+// Every trade's price in ticks times quantity must be less than this, so that a chunk
+// of a TradeStore can sum its trades in 64 bits and every price in ticks is exactly
+// representable as a double
+//
+const std::uint64_t MAX_TICKS_TIMES_QUANTITY = static_cast<std::uint64_t>(1) << 53;
+
+// Returns the whole number of ticks nearest to 'price', for a positive tickSize
+//
+inline std::uint64_t toTicks(double price, double tickSize)
+{
+	return static_cast<std::uint64_t>(std::llround(price / tickSize));
+}
+
+// An unsigned 128 bit integer, enough to hold the sum of price in ticks times quantity
+// over any number of trades exactly. Subtraction wraps, as for any unsigned integer,
+// so a sum may be taken away from a larger sum containing it.
+//
+class TickSum
+{
+	std::uint64_t low;
+	std::uint64_t high;
+
+public:
+
+	TickSum() :
+		low(0),
+		high(0)
+	{
+		// done //
+	}
+
+	explicit TickSum(std::uint64_t value) :
+		low(value),
+		high(0)
+	{
+		// done //
+	}
+
+	TickSum& operator+=(const TickSum& other)
+	{
+		const std::uint64_t previousLow = low;
+		low += other.low;
+		high += other.high + (low < previousLow ? 1 : 0);
+		return *this;
+	}
+
+	TickSum& operator-=(const TickSum& other)
+	{
+		const std::uint64_t previousLow = low;
+		low -= other.low;
+		high -= other.high + (low > previousLow ? 1 : 0);
+		return *this;
+	}
+
+	bool operator==(const TickSum& other)const
+	{
+		return low == other.low && high == other.high;
+	}
+
+	bool operator!=(const TickSum& other)const
+	{
+		return !(*this == other);
+	}
+
+	// Returns the nearest double to this sum
+	//
+	double toDouble()const
+	{
+		return static_cast<double>(high) * 18446744073709551616.0 + static_cast<double>(low);
+	}
+};
+
+// Sums over a set of trades. quantity is always exact. Trades with a tick size add
+// their price in ticks times quantity to ticksAndQuantity; trades without add price
+// times quantity to priceAndQuantity. Only one of the two is used for any one stock.
+//
+struct TradeSums
+{
+	std::uint64_t quantity;
+	double priceAndQuantity;
+	TickSum ticksAndQuantity;
+
+	TradeSums() :
+		quantity(0),
+		priceAndQuantity(0.0)
+	{
+		// done //
+	}
+
+	TradeSums& operator+=(const TradeSums& other)
+	{
+		quantity += other.quantity;
+		priceAndQuantity += other.priceAndQuantity;
+		ticksAndQuantity += other.ticksAndQuantity;
+		return *this;
+	}
+
+	TradeSums& operator-=(const TradeSums& other)
+	{
+		quantity -= other.quantity;
+		priceAndQuantity -= other.priceAndQuantity;
+		ticksAndQuantity -= other.ticksAndQuantity;
+		return *this;
+	}
+
+	// Returns the Volume Weighted price of the trades summed, 0.0 if there are none.
+	// tickSize is that of the trades' stock, or zero if it has none.
+	//
+	double getVolumeWeightedPrice(double tickSize)const
+	{
+		if (0 == quantity)
+		{
+			return 0.0;
+		}
+		if (tickSize > 0.0)
+		{
+			return ticksAndQuantity.toDouble() / static_cast<double>(quantity) * tickSize;
+		}
+		return priceAndQuantity / static_cast<double>(quantity);
+	}
+};
+
+// Sums over a set of trades, kept apart for buys and for sells
+//
+struct FlowSums
+{
+	TradeSums buys;
+	TradeSums sells;
+
+	FlowSums& operator+=(const FlowSums& other)
+	{
+		buys += other.buys;
+		sells += other.sells;
+		return *this;
+	}
+
+	FlowSums& operator-=(const FlowSums& other)
+	{
+		buys -= other.buys;
+		sells -= other.sells;
+		return *this;
+	}
+
+	// Returns the sums over buys and sells together
+	//
+	TradeSums getTotal()const
+	{
+		TradeSums total = buys;
+		total += sells;
+		return total;
+	}
+};
+
+#endif
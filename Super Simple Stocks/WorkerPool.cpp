@@ -0,0 +1,152 @@
+#include"stdafx.h"
+#include"WorkerPool.h"
+#include<algorithm>
+
+// Build a pool of 'threadCount' threads in total, counting the thread calling run,
+// so a count of one runs every task on the caller. Zero uses one thread per core.
+//
+WorkerPool::WorkerPool(std::size_t threadCount) :
+	task(nullptr),
+	taskCount(0),
+	nextTask(0),
+	generation(0),
+	busyWorkers(0),
+	stopping(false)
+{
+	if (0 == threadCount)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	workers.reserve(threadCount - 1);
+	for (std::size_t t = 1; t < threadCount; ++t)
+	{
+		workers.emplace_back(&WorkerPool::workerLoop, this);
+	}
+}
+
+//
+//
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+// Internal utility; the body of each worker thread
+//
+void WorkerPool::workerLoop()
+{
+	std::size_t seenGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [&]
+			{
+				return stopping || generation != seenGeneration;
+			});
+			if (stopping)
+			{
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		runTasks();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (0 == --busyWorkers)
+		{
+			workFinished.notify_one();
+		}
+	}
+}
+
+// Internal utility; claims and runs tasks until none remain
+//
+void WorkerPool::runTasks()
+{
+	for (std::size_t t = nextTask++; t < taskCount; t = nextTask++)
+	{
+		try
+		{
+			(*task)(t);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!failure)
+			{
+				failure = std::current_exception();
+			}
+		}
+	}
+}
+
+// Calls function(t) for each t in [0, taskCount), spread across the pool, returning
+// once every call has finished. If any call throws, the remaining tasks are still
+// run and the first exception is rethrown. Only one thread may call run at a time.
+//
+void WorkerPool::run(std::size_t taskCountIn, const std::function<void(std::size_t)>& function)
+{
+	if (workers.empty() || taskCountIn <= 1)
+	{
+		std::exception_ptr thrown;
+		for (std::size_t t = 0; t < taskCountIn; ++t)
+		{
+			try
+			{
+				function(t);
+			}
+			catch (...)
+			{
+				if (!thrown)
+				{
+					thrown = std::current_exception();
+				}
+			}
+		}
+		if (thrown)
+		{
+			std::rethrow_exception(thrown);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &function;
+		taskCount = taskCountIn;
+		nextTask = 0;
+		failure = nullptr;
+		busyWorkers = workers.size();
+		++generation;
+	}
+	workAvailable.notify_all();
+
+	runTasks();
+
+	std::exception_ptr thrown;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		workFinished.wait(lock, [&]
+		{
+			return 0 == busyWorkers;
+		});
+		task = nullptr;
+		taskCount = 0;
+		thrown = failure;
+		failure = nullptr;
+	}
+	if (thrown)
+	{
+		std::rethrow_exception(thrown);
+	}
+}
@@ -0,0 +1,84 @@
+/*
+* WorkerPool.h
+*
+*	A WorkerPool keeps a fixed set of threads ready to share out the tasks of a
+*	parallel loop. run() hands the pool a number of tasks and a function to call for
+*	each, takes part in the work itself, and returns once every task has finished.
+*	Tasks are claimed one at a time from a shared counter, so threads finishing early
+*	pick up the remaining work.
+*/
+#pragma once
+#ifndef SUPERSIMPLESTOCKS_WORKER_POOL
+#define SUPERSIMPLESTOCKS_WORKER_POOL
+#include<atomic>
+#include<condition_variable>
+#include<cstddef>
+#include<exception>
+#include<functional>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+class WorkerPool
+{
+	std::vector<std::thread> workers;
+
+	// Guards everything below, other than nextTask
+	//
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workFinished;
+
+	// The loop being run: task is called with each index in [0, taskCount).
+	// generation advances with each call to run, waking the workers.
+	//
+	const std::function<void(std::size_t)>* task;
+	std::size_t taskCount;
+	std::atomic<std::size_t> nextTask;
+	std::size_t generation;
+
+	// Number of workers still inside the current loop
+	//
+	std::size_t busyWorkers;
+
+	// The first exception thrown by a task, rethrown by run
+	//
+	std::exception_ptr failure;
+
+	bool stopping;
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Internal utility; the body of each worker thread
+	//
+	void workerLoop();
+
+	// Internal utility; claims and runs tasks until none remain
+	//
+	void runTasks();
+
+public:
+
+	// Build a pool of 'threadCount' threads in total, counting the thread calling run,
+	// so a count of one runs every task on the caller. Zero uses one thread per core.
+	//
+	explicit WorkerPool(std::size_t threadCount = 0);
+
+	~WorkerPool();
+
+	// Returns the number of threads sharing each loop, including the caller
+	//
+	std::size_t getThreadCount()const
+	{
+		return workers.size() + 1;
+	}
+
+	// Calls function(t) for each t in [0, taskCount), spread across the pool, returning
+	// once every call has finished. If any call throws, the remaining tasks are still
+	// run and the first exception is rethrown. Only one thread may call run at a time.
+	//
+	void run(std::size_t taskCount, const std::function<void(std::size_t)>& function);
+};
+
+#endif